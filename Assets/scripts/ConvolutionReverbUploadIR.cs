@@ -5,7 +5,16 @@ using System.Runtime.InteropServices;
 public class ConvolutionReverbUploadIR : MonoBehaviour
 {
     [DllImport("AudioPluginDemo")]
-    private static extern bool ConvolutionReverb_UploadSample(int index, float[] data, int numsamples, int numchannels, int samplerate, [MarshalAs(UnmanagedType.LPStr)] string name);
+    private static extern bool ConvolutionReverb_BeginUpload(int index, int numsamples, int numchannels, int samplerate, [MarshalAs(UnmanagedType.LPStr)] string name);
+
+    [DllImport("AudioPluginDemo")]
+    private static extern bool ConvolutionReverb_AppendUpload(int index, float[] data, int numsamples);
+
+    [DllImport("AudioPluginDemo")]
+    private static extern bool ConvolutionReverb_CommitUpload(int index);
+
+    // Long impulse responses are uploaded in chunks of this many sample frames, so that they never need one large managed array
+    private const int chunkSize = 65536;
 
     public AudioClip[] impulse = new AudioClip[0];
     public int index;
@@ -34,9 +43,17 @@ public class ConvolutionReverbUploadIR : MonoBehaviour
             if (s != null && s.loadState == AudioDataLoadState.Loaded && !uploaded[currindex])
             {
                 Debug.Log("Uploading impulse response " + s.name + " to slot " + currindex);
-                float[] data = new float[s.samples];
-                s.GetData(data, 0);
-                ConvolutionReverb_UploadSample(currindex, data, data.Length / s.channels, s.channels, s.frequency, s.name);
+                ConvolutionReverb_BeginUpload(currindex, s.samples, s.channels, s.frequency, s.name);
+                float[] data = new float[Mathf.Min(s.samples, chunkSize) * s.channels];
+                for (int offset = 0; offset < s.samples; offset += chunkSize)
+                {
+                    int num = Mathf.Min(s.samples - offset, chunkSize);
+                    if (data.Length != num * s.channels)
+                        data = new float[num * s.channels];
+                    s.GetData(data, offset);
+                    ConvolutionReverb_AppendUpload(currindex, data, num);
+                }
+                ConvolutionReverb_CommitUpload(currindex);
                 uploaded[currindex] = true;
                 currImpulse[currindex] = s;
             }
@@ -67,7 +67,10 @@ public class ConvolutionReverbCustomGUI : IAudioEffectPluginGUI
             r2.y += r2.height;
             DrawCurve(r2, imp2, 1.0f, m_Impulse2Color, 150, wet, gain);
 
+            float[] partitions; plugin.GetFloatBuffer("Partitions", out partitions, 2);
+
             string name = "Impulse: " + Marshal.PtrToStringAnsi(ConvolutionReverb_GetSampleName((int)useSample));
+            name += string.Format("   Partitions: {0} ({1:F2} s)", (int)partitions[0], partitions[1] / samplerate);
             GUIHelpers.DrawText(r2.x + 5, r2.y - 5, r2.width, name, Color.white);
         }
         AudioCurveRendering.EndCurveFrame();
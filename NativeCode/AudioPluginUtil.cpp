@@ -1,10 +1,36 @@
 #include "AudioPluginUtil.h"
 #include <stdarg.h>
+#include <time.h>
+
+#if PLATFORM_WIN
+#   include <malloc.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define NAP_SIMD_SSE2 1
+#   define NAP_SIMD_AVX2 1
+#   include <emmintrin.h>
+#   include <immintrin.h>
+#   if defined(_MSC_VER)
+#       include <intrin.h>
+#       define NAP_TARGET_AVX2
+#   else
+#       define NAP_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#   endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#   define NAP_SIMD_NEON 1
+#   include <arm_neon.h>
+#endif
 
 namespace AudioPluginUtil
 {
 
-#define ENABLE_TESTS ((PLATFORM_WIN || PLATFORM_OSX) && 1)
+#define ENABLE_BENCHMARKS (ENABLE_TESTS && 0)
 
 char* strnew(const char* src)
 {
@@ -26,483 +52,5039 @@ char* tmpstr(int index, const char* fmtstr, ...)
 
 template<typename T> void UnitySwap(T& a, T& b) { T t = a; a = b; b = t; }
 
-template<typename T>
-static void FFTProcess(UnityComplexNumber* data, int numsamples, bool forward)
+// Element access for the scalar kernels, so that the same code transforms interleaved (UnityComplexNumber) and split complex signals
+struct InterleavedLayout
+{
+    typedef UnityComplexNumber* Signal;
+    static inline float& Re(const Signal& x, int n) { return x[n].re; }
+    static inline float& Im(const Signal& x, int n) { return x[n].im; }
+    static inline void Set(const Signal& x, int n, float re, float im) { x[n].Set(re, im); }
+    static inline void Swap(const Signal& x, int i, int j) { UnitySwap(x[i], x[j]); }
+};
+
+struct SplitLayout
+{
+    typedef SplitComplex Signal;
+    static inline float& Re(const Signal& x, int n) { return x.re[n]; }
+    static inline float& Im(const Signal& x, int n) { return x.im[n]; }
+    static inline void Set(const Signal& x, int n, float re, float im) { x.re[n] = re; x.im[n] = im; }
+    static inline void Swap(const Signal& x, int i, int j) { UnitySwap(x.re[i], x.re[j]); UnitySwap(x.im[i], x.im[j]); }
+};
+
+template<class L>
+static void FFTPermute(const typename L::Signal* data, int numsignals, const unsigned int* swaps, int numswaps)
 {
-    unsigned int count = 1, numbits = 0;
-    while ((int)count < numsamples)
+    for (int c = 0; c < numsignals; c++)
     {
-        count += count;
-        ++numbits;
+        const typename L::Signal& x = data[c];
+        for (int n = 0; n < numswaps; n++)
+            L::Swap(x, swaps[n * 2], swaps[n * 2 + 1]);
     }
+}
 
-    static unsigned int* reversetable[32] = { NULL };
-    unsigned int* tbl = reversetable[numbits];
-    if (tbl == NULL)
+// All transform kernels process a batch of numsignals equally long signals stage by stage, so the twiddles of a stage are
+// fetched from memory once for the whole batch. The SIMD and mixed-radix kernels go further and apply each loaded twiddle
+// to all signals before moving on.
+template<typename T, bool forward, class L>
+static void FFTProcess(const typename L::Signal* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<T>* twiddles)
+{
+    FFTPermute<L>(data, numsignals, swaps, numswaps);
+
+    for (int j = 1; j < numsamples; j += j)
     {
-        tbl = new unsigned int[numsamples];
-        for (unsigned int n = 0; n < (unsigned)numsamples; n++)
+        const UnityComplexNumberT<T>* w = twiddles + j - 1;
+        int step = j + j;
+        for (int i = 0; i < numsamples; i += step)
         {
-            unsigned int j = 1, k = 0, m = numsamples >> 1;
-            while (m > 0)
+            for (int c = 0; c < numsignals; c++)
             {
-                if (n & m)
-                    k |= j;
-                j += j;
-                m >>= 1;
+                const typename L::Signal& x = data[c];
+                for (int m = 0; m < j; ++m)
+                {
+                    const int a = i + m, b = a + j;
+                    T wre = w[m].re, wim = (forward) ? w[m].im : -w[m].im;
+                    T bre = L::Re(x, b), bim = L::Im(x, b);
+                    T tre = wre * bre - wim * bim;
+                    T tim = wre * bim + wim * bre;
+                    T are = L::Re(x, a), aim = L::Im(x, a);
+                    L::Set(x, b, float(are - tre), float(aim - tim));
+                    L::Set(x, a, float(are + tre), float(aim + tim));
+                }
             }
-            tbl[n] = k;
-        }
-#if ENABLE_TESTS
-        for (unsigned int n = 0; n < (unsigned)numsamples; n++)
-        {
-            assert(tbl[tbl[n]] == n);
         }
-#endif
-        reversetable[numbits] = tbl;
     }
+}
 
-    for (unsigned int i = 0; i < (unsigned)numsamples; i++)
+// SIMD kernels for single-precision plans. The butterfly stages are fused pairwise into radix-4 passes (radix-2^2),
+// which halves the number of sweeps over the data compared to FFTProcess. The twiddles of the second stage of a pass
+// are the ones of the first stage rotated by -i (or +i for the backward transform), so no extra tables are needed.
+// FFTProcess is kept as the reference implementation and is still used for high-precision plans.
+typedef void (*FFTPassFunc)(UnityComplexNumber* const* data, int numsignals, int numsamples, int j, const UnityComplexNumberT<float>* twiddles, bool forward);
+
+// Stages of span 1 and 2 as scalar 4-point transforms, since they are too narrow to fill a vector
+template<class L>
+static void FFTFirstRadix4Pass(const typename L::Signal* data, int numsignals, int numsamples, bool forward)
+{
+    for (int c = 0; c < numsignals; c++)
     {
-        unsigned int j = tbl[i];
-        if (i < j)
+        const typename L::Signal& x = data[c];
+        for (int i = 0; i < numsamples; i += 4)
         {
-            UnitySwap(data[i].re, data[j].re);
-            UnitySwap(data[i].im, data[j].im);
+            float x0re = L::Re(x, i), x0im = L::Im(x, i), x1re = L::Re(x, i + 1), x1im = L::Im(x, i + 1);
+            float x2re = L::Re(x, i + 2), x2im = L::Im(x, i + 2), x3re = L::Re(x, i + 3), x3im = L::Im(x, i + 3);
+            float b0re = x0re + x1re, b0im = x0im + x1im;
+            float b1re = x0re - x1re, b1im = x0im - x1im;
+            float b2re = x2re + x3re, b2im = x2im + x3im;
+            float b3re = x2re - x3re, b3im = x2im - x3im;
+            float u3re = (forward) ? b3im : -b3im, u3im = (forward) ? -b3re : b3re;
+            L::Set(x, i, b0re + b2re, b0im + b2im);
+            L::Set(x, i + 1, b1re + u3re, b1im + u3im);
+            L::Set(x, i + 2, b0re - b2re, b0im - b2im);
+            L::Set(x, i + 3, b1re - u3re, b1im - u3im);
         }
     }
+}
 
-    T w0 = (forward) ? -T(kPI_double) : T(kPI_double);
-    for (int j = 1; j < numsamples; j += j)
+template<FFTPassFunc radix4pass, FFTPassFunc radix2pass>
+static void FFTProcessSIMD(UnityComplexNumber* const* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, bool forward)
+{
+    if (numsamples < 8)
     {
-        UnityComplexNumberT<T> wr, wd;
-        wr.Set(T(cos(w0)), T(sin(w0)));
-        wd.Set(T(1.0), T(0.0));
-        int step = j + j;
-        for (int m = 0; m < j; ++m)
-        {
-            for (int i = m; i < numsamples; i += step)
-            {
-                UnityComplexNumberT<T> t;
-                UnityComplexNumber::Mul(wd, data[i + j], t);
-                UnityComplexNumber::Sub(data[i], t, data[i + j]);
-                UnityComplexNumber::Add(data[i], t, data[i]);
-            }
-            UnityComplexNumber::Mul(wd, wr, wd);
-        }
-        w0 *= T(0.5);
+        if (forward)
+            FFTProcess<float, true, InterleavedLayout>(data, numsignals, numsamples, swaps, numswaps, twiddles);
+        else
+            FFTProcess<float, false, InterleavedLayout>(data, numsignals, numsamples, swaps, numswaps, twiddles);
+        return;
     }
+
+    FFTPermute<InterleavedLayout>(data, numsignals, swaps, numswaps);
+    FFTFirstRadix4Pass<InterleavedLayout>(data, numsignals, numsamples, forward);
+
+    int j = 4;
+    for (; j * 4 <= numsamples; j *= 4)
+        radix4pass(data, numsignals, numsamples, j, twiddles, forward);
+    if (j < numsamples)
+        radix2pass(data, numsignals, numsamples, j, twiddles, forward);
 }
 
-void FFT::Forward(UnityComplexNumber* data, int numsamples, bool highprecision)
+// The split complex passes read the real and imaginary parts of the twiddles from separate tables (FFTPlan::splittwiddlesf),
+// so that no lanes need to be rearranged at all. The stage of span j reads its real parts at j - 1 and its imaginary parts
+// numsamples - 1 entries further on.
+typedef void (*FFTSplitPassFunc)(const SplitComplex* data, int numsignals, int numsamples, int j, const float* twiddles, bool forward);
+
+template<FFTSplitPassFunc radix4pass, FFTSplitPassFunc radix2pass>
+static void FFTProcessSplitSIMD(const SplitComplex* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, const float* splittwiddles, bool forward)
 {
-    if (highprecision)
-        FFTProcess<double>(data, numsamples, true);
+    if (numsamples < 8)
+    {
+        if (forward)
+            FFTProcess<float, true, SplitLayout>(data, numsignals, numsamples, swaps, numswaps, twiddles);
+        else
+            FFTProcess<float, false, SplitLayout>(data, numsignals, numsamples, swaps, numswaps, twiddles);
+        return;
+    }
+
+    FFTPermute<SplitLayout>(data, numsignals, swaps, numswaps);
+    FFTFirstRadix4Pass<SplitLayout>(data, numsignals, numsamples, forward);
+
+    int j = 4;
+    for (; j * 4 <= numsamples; j *= 4)
+        radix4pass(data, numsignals, numsamples, j, splittwiddles, forward);
+    if (j < numsamples)
+        radix2pass(data, numsignals, numsamples, j, splittwiddles, forward);
+}
+
+static void FFTProcessScalar(UnityComplexNumber* const* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, bool forward)
+{
+    if (forward)
+        FFTProcess<float, true, InterleavedLayout>(data, numsignals, numsamples, swaps, numswaps, twiddles);
     else
-        FFTProcess<float>(data, numsamples, true);
+        FFTProcess<float, false, InterleavedLayout>(data, numsignals, numsamples, swaps, numswaps, twiddles);
 }
 
-void FFT::Backward(UnityComplexNumber* data, int numsamples, bool highprecision)
+static void FFTProcessSplitScalar(const SplitComplex* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, const float* splittwiddles, bool forward)
 {
-    if (highprecision)
-        FFTProcess<double>(data, numsamples, false);
+    if (forward)
+        FFTProcess<float, true, SplitLayout>(data, numsignals, numsamples, swaps, numswaps, twiddles);
     else
-        FFTProcess<float>(data, numsamples, false);
+        FFTProcess<float, false, SplitLayout>(data, numsignals, numsamples, swaps, numswaps, twiddles);
+}
 
-    const float scale = 1.0f / (float)numsamples;
-    for (int n = 0; n < numsamples; n++)
+// Element-wise complex multiplication and multiply-accumulate of split complex arrays from index start onwards.
+// The SIMD versions below process whole registers and leave the remaining elements to these.
+static inline void SplitComplexMulRange(const SplitComplex& a, const SplitComplex& b, const SplitComplex& result, int start, int numelements)
+{
+    for (int n = start; n < numelements; n++)
     {
-        data[n].re *= scale;
-        data[n].im *= scale;
+        float re = a.re[n] * b.re[n] - a.im[n] * b.im[n];
+        float im = a.re[n] * b.im[n] + a.im[n] * b.re[n];
+        result.re[n] = re;
+        result.im[n] = im;
     }
 }
 
-void FFTAnalyzer::Cleanup()
+static inline void SplitComplexMulAddRange(const SplitComplex& a, const SplitComplex& b, const SplitComplex& acc, int start, int numelements)
 {
-    delete[] window;
-    delete[] ibuffer;
-    delete[] obuffer;
-    delete[] ispec1;
-    delete[] ispec2;
-    delete[] ospec1;
-    delete[] ospec2;
-    delete[] cspec;
+    for (int n = start; n < numelements; n++)
+    {
+        float re = a.re[n] * b.re[n] - a.im[n] * b.im[n];
+        float im = a.re[n] * b.im[n] + a.im[n] * b.re[n];
+        acc.re[n] += re;
+        acc.im[n] += im;
+    }
 }
 
-void FFTAnalyzer::AnalyzeInput(float* data, int numchannels, int numsamples, float decaySpeed)
+static void SplitComplexMulScalar(const SplitComplex& a, const SplitComplex& b, const SplitComplex& result, int numelements)
 {
-    CheckInitialized();
+    SplitComplexMulRange(a, b, result, 0, numelements);
+}
 
-    for (int n = 0; n < spectrumSize - numsamples; n++)
-        ibuffer[n] = ibuffer[n + numsamples];
-    for (int n = 0; n < numsamples; n++)
-        ibuffer[n + spectrumSize - numsamples] = data[n * numchannels];
-    for (int n = 0; n < spectrumSize; n++)
-        cspec[n].Set(ibuffer[n] * window[n], 0.0f);
-    Forward(cspec, spectrumSize, true);
-    for (int n = 0; n < spectrumSize / 2; n++)
+static void SplitComplexMulAddScalar(const SplitComplex& a, const SplitComplex& b, const SplitComplex& acc, int numelements)
+{
+    SplitComplexMulAddRange(a, b, acc, 0, numelements);
+}
+
+static inline void SplitComplexMulAddBF16Range(const SplitComplexBF16& a, const SplitComplex& b, const SplitComplex& acc, int start, int numelements)
+{
+    for (int n = start; n < numelements; n++)
     {
-        float a = cspec[n].Magnitude();
-        ispec1[n] = (a > ispec2[n]) ? a : ispec2[n] * decaySpeed;
+        float are = BF16ToFloat(a.re[n]), aim = BF16ToFloat(a.im[n]);
+        float re = are * b.re[n] - aim * b.im[n];
+        float im = are * b.im[n] + aim * b.re[n];
+        acc.re[n] += re;
+        acc.im[n] += im;
     }
 }
 
-void FFTAnalyzer::AnalyzeOutput(float* data, int numchannels, int numsamples, float decaySpeed)
+static void SplitComplexMulAddBF16Scalar(const SplitComplexBF16& a, const SplitComplex& b, const SplitComplex& acc, int numelements)
 {
-    CheckInitialized();
+    SplitComplexMulAddBF16Range(a, b, acc, 0, numelements);
+}
 
-    for (int n = 0; n < spectrumSize - numsamples; n++)
-        obuffer[n] = obuffer[n + numsamples];
-    for (int n = 0; n < numsamples; n++)
-        obuffer[n + spectrumSize - numsamples] = data[n * numchannels];
-    for (int n = 0; n < spectrumSize; n++)
-        cspec[n].Set(obuffer[n] * window[n], 0.0f);
-    Forward(cspec, spectrumSize, true);
-    for (int n = 0; n < spectrumSize / 2; n++)
+static inline void FIRMulAddRange(const float* h, int numtaps, const float* x, float* y, int start, int numsamples)
+{
+    for (int n = start; n < numsamples; n++)
     {
-        float a = cspec[n].Magnitude();
-        ospec1[n] = (a > ospec2[n]) ? a : ospec2[n] * decaySpeed;
+        float sum = 0.0f;
+        for (int k = 0; k < numtaps; k++)
+            sum += h[k] * x[n - k];
+        y[n] += sum;
     }
+}
 
-    float* tmp;
-    tmp = ispec1; ispec1 = ispec2; ispec2 = tmp;
-    tmp = ospec1; ospec1 = ospec2; ospec2 = tmp;
-
-    if (numSpectraReady < 2)
-        numSpectraReady++;
+static void FIRMulAddScalar(const float* h, int numtaps, const float* x, float* y, int numsamples)
+{
+    FIRMulAddRange(h, numtaps, x, y, 0, numsamples);
 }
 
-void FFTAnalyzer::CheckInitialized()
+static inline float DotProductRange(const float* a, const float* b, int start, int numelements)
 {
-    if (window == NULL)
-    {
-        window = new float[spectrumSize];
-        ibuffer = new float[spectrumSize];
-        obuffer = new float[spectrumSize];
-        ispec1 = new float[spectrumSize / 2];
-        ispec2 = new float[spectrumSize / 2];
-        ospec1 = new float[spectrumSize / 2];
-        ospec2 = new float[spectrumSize / 2];
-        cspec = new UnityComplexNumber[spectrumSize];
-        for (int n = 0; n < spectrumSize; n++)
-            window[n] = 0.54f - 0.46f * cosf(n * (kPI / (float)spectrumSize));
-        memset(ibuffer, 0, sizeof(float) * spectrumSize);
-        memset(obuffer, 0, sizeof(float) * spectrumSize);
-        memset(ispec1, 0, sizeof(float) * (spectrumSize / 2));
-        memset(ispec2, 0, sizeof(float) * (spectrumSize / 2));
-        memset(ospec1, 0, sizeof(float) * (spectrumSize / 2));
-        memset(ospec2, 0, sizeof(float) * (spectrumSize / 2));
-        memset(cspec, 0, sizeof(UnityComplexNumber) * spectrumSize);
-    }
+    float sum = 0.0f;
+    for (int n = start; n < numelements; n++)
+        sum += a[n] * b[n];
+    return sum;
 }
 
-bool FFTAnalyzer::CanBeRead() const
+static float DotProductScalar(const float* a, const float* b, int numelements)
 {
-    return numSpectraReady >= 2;
+    return DotProductRange(a, b, 0, numelements);
 }
 
-void FFTAnalyzer::ReadBuffer(float* buffer, int numsamples, bool readInputBuffer)
+#if NAP_SIMD_SSE2
+
+// Flips the sign of the real (even) and/or imaginary (odd) parts when xor'ed
+static inline __m128 SignMaskSSE2(bool even, bool odd)
 {
-    if (!CanBeRead())
-    {
-        memset(buffer, 0, sizeof(float) * numsamples);
-        return;
-    }
-    if (numsamples > spectrumSize)
-        numsamples = spectrumSize;
-    float* buf = (readInputBuffer) ? ispec2 : ospec2;
-    float scale = (float)((spectrumSize / 2) - 2) / (float)(numsamples - 1);
-    for (int n = 0; n < numsamples; n++)
-    {
-        float f = n * scale;
-        int i = FastFloor(f);
-        buffer[n] = buf[i] + (buf[i + 1] - buf[i]) * (f - i);
-    }
+    int e = (even) ? (int)0x80000000 : 0, o = (odd) ? (int)0x80000000 : 0;
+    return _mm_castsi128_ps(_mm_set_epi32(o, e, o, e));
 }
 
-HistoryBuffer::HistoryBuffer()
-    : length(0)
-    , writeindex(0)
-    , data(NULL)
+// Two interleaved complex numbers per register
+static inline __m128 ComplexMulSSE2(__m128 a, __m128 w)
 {
+    __m128 wre = _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 2, 0, 0));
+    __m128 wim = _mm_shuffle_ps(w, w, _MM_SHUFFLE(3, 3, 1, 1));
+    __m128 aswap = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_add_ps(_mm_mul_ps(a, wre), _mm_xor_ps(_mm_mul_ps(aswap, wim), SignMaskSSE2(true, false)));
 }
 
-HistoryBuffer::~HistoryBuffer()
+// Multiplication by -i for the forward and +i for the backward transform
+static inline __m128 RotateSSE2(__m128 a, __m128 sign)
 {
-    delete[] data;
+    return _mm_xor_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), sign);
 }
 
-void HistoryBuffer::Init(int _length)
+static void FFTRadix4PassSSE2(UnityComplexNumber* const* data, int numsignals, int numsamples, int j, const UnityComplexNumberT<float>* twiddles, bool forward)
 {
-    length = _length;
-    data = new float[length];
-    memset(data, 0, sizeof(float) * length);
+    const float* w1 = &twiddles[j - 1].re;
+    const float* w2 = &twiddles[j + j - 1].re;
+    __m128 conj = SignMaskSSE2(false, !forward);
+    __m128 rot = SignMaskSSE2(!forward, forward);
+    for (int i = 0; i < numsamples; i += 4 * j)
+    {
+        for (int m = 0; m < 2 * j; m += 4)
+        {
+            __m128 wa = _mm_xor_ps(_mm_loadu_ps(w1 + m), conj);
+            __m128 wb = _mm_xor_ps(_mm_loadu_ps(w2 + m), conj);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* x0 = &data[c][i].re + m;
+                float* x1 = x0 + 2 * j;
+                float* x2 = x0 + 4 * j;
+                float* x3 = x0 + 6 * j;
+                __m128 a0 = _mm_loadu_ps(x0), t1 = ComplexMulSSE2(_mm_loadu_ps(x1), wa);
+                __m128 a2 = _mm_loadu_ps(x2), t3 = ComplexMulSSE2(_mm_loadu_ps(x3), wa);
+                __m128 b0 = _mm_add_ps(a0, t1), b1 = _mm_sub_ps(a0, t1);
+                __m128 u2 = ComplexMulSSE2(_mm_add_ps(a2, t3), wb);
+                __m128 u3 = RotateSSE2(ComplexMulSSE2(_mm_sub_ps(a2, t3), wb), rot);
+                _mm_storeu_ps(x0, _mm_add_ps(b0, u2));
+                _mm_storeu_ps(x1, _mm_add_ps(b1, u3));
+                _mm_storeu_ps(x2, _mm_sub_ps(b0, u2));
+                _mm_storeu_ps(x3, _mm_sub_ps(b1, u3));
+            }
+        }
+    }
 }
 
-void HistoryBuffer::ReadBuffer(float* buffer, int numsamplesTarget, int numsamplesSource, float offset)
+static void FFTRadix2PassSSE2(UnityComplexNumber* const* data, int numsignals, int numsamples, int j, const UnityComplexNumberT<float>* twiddles, bool forward)
 {
-    numsamplesTarget--; // reserve last sample for count of how much we were able to read
-    float speed = (float)numsamplesSource / (float)numsamplesTarget;
-    int n, w = writeindex; // since ReadBuffer is called from the GUI thread, writeindex may be modified by the DSP thread simultaneously
-    float p = offset;
-    for (n = 0; n < numsamplesTarget; n++)
+    const float* w = &twiddles[j - 1].re;
+    __m128 conj = SignMaskSSE2(false, !forward);
+    for (int i = 0; i < numsamples; i += 2 * j)
     {
-        float f = w - p;
-        if (f < 0.0f)
-            f += length;
-        int i = FastFloor(f);
-        float s1 = data[(i == 0) ? (length - 1) : (i - 1)];
-        float s2 = data[i];
-        buffer[numsamplesTarget - 1 - n] = s1 + (s2 - s1) * (f - i);
-        p += speed;
-        if (p >= length)
-            break;
+        for (int m = 0; m < 2 * j; m += 4)
+        {
+            __m128 wm = _mm_xor_ps(_mm_loadu_ps(w + m), conj);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* a = &data[c][i].re + m;
+                float* b = a + 2 * j;
+                __m128 x = _mm_loadu_ps(a);
+                __m128 t = ComplexMulSSE2(_mm_loadu_ps(b), wm);
+                _mm_storeu_ps(a, _mm_add_ps(x, t));
+                _mm_storeu_ps(b, _mm_sub_ps(x, t));
+            }
+        }
     }
-    buffer[numsamplesTarget] = (float)n; // how many samples were written
 }
 
-Mutex::Mutex()
+static void FFTProcessSSE2(UnityComplexNumber* const* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, bool forward)
 {
-#if PLATFORM_WIN
-#if PLATFORM_WINRT
-    BOOL const result = InitializeCriticalSectionEx(&crit_sec, 0, CRITICAL_SECTION_NO_DEBUG_INFO);
-    assert(FALSE != result);
-#else
-    InitializeCriticalSection(&crit_sec);
-#endif
-#else
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&mutex, &attr);
-    pthread_mutexattr_destroy(&attr);
-#endif
+    FFTProcessSIMD<FFTRadix4PassSSE2, FFTRadix2PassSSE2>(data, numsignals, numsamples, swaps, numswaps, twiddles, forward);
 }
 
-Mutex::~Mutex()
+// Four split complex numbers, i.e. the real parts in one register and the imaginary parts in another
+struct SplitVecSSE2
 {
-#if PLATFORM_WIN
-    DeleteCriticalSection(&crit_sec);
-#else
-    pthread_mutex_destroy(&mutex);
-#endif
+    __m128 re, im;
+};
+
+static inline SplitVecSSE2 LoadSplitSSE2(const float* re, const float* im)
+{
+    SplitVecSSE2 r = { _mm_loadu_ps(re), _mm_loadu_ps(im) };
+    return r;
 }
 
-bool Mutex::TryLock()
+static inline void StoreSplitSSE2(float* re, float* im, SplitVecSSE2 a)
 {
-#if PLATFORM_WIN
-    return TryEnterCriticalSection(&crit_sec) != 0;
-#else
-    return pthread_mutex_trylock(&mutex) == 0;
-#endif
+    _mm_storeu_ps(re, a.re);
+    _mm_storeu_ps(im, a.im);
 }
 
-void Mutex::Lock()
+static inline SplitVecSSE2 SplitMulSSE2(SplitVecSSE2 a, SplitVecSSE2 w)
 {
-#if PLATFORM_WIN
-    EnterCriticalSection(&crit_sec);
-#else
-    pthread_mutex_lock(&mutex);
-#endif
+    SplitVecSSE2 r = {
+        _mm_sub_ps(_mm_mul_ps(a.re, w.re), _mm_mul_ps(a.im, w.im)),
+        _mm_add_ps(_mm_mul_ps(a.re, w.im), _mm_mul_ps(a.im, w.re))
+    };
+    return r;
 }
 
-void Mutex::Unlock()
+static inline SplitVecSSE2 SplitAddSSE2(SplitVecSSE2 a, SplitVecSSE2 b)
 {
-#if PLATFORM_WIN
-    LeaveCriticalSection(&crit_sec);
-#else
-    pthread_mutex_unlock(&mutex);
-#endif
+    SplitVecSSE2 r = { _mm_add_ps(a.re, b.re), _mm_add_ps(a.im, b.im) };
+    return r;
 }
 
-void RegisterParameter(
-    UnityAudioEffectDefinition& definition,
-    const char* name,
-    const char* unit,
-    float minval,
-    float maxval,
-    float defaultval,
-    float displayscale,
-    float displayexponent,
-    int enumvalue,
-    const char* description
-    )
+static inline SplitVecSSE2 SplitSubSSE2(SplitVecSSE2 a, SplitVecSSE2 b)
 {
-    assert(defaultval >= minval);
-    assert(defaultval <= maxval);
-    strcpy_s(definition.paramdefs[enumvalue].name, name);
-    strcpy_s(definition.paramdefs[enumvalue].unit, unit);
-    definition.paramdefs[enumvalue].description = (description != NULL) ? strnew(description) : (name != NULL) ? strnew(name) : NULL;
-    definition.paramdefs[enumvalue].defaultval = defaultval;
-    definition.paramdefs[enumvalue].displayscale = displayscale;
-    definition.paramdefs[enumvalue].displayexponent = displayexponent;
-    definition.paramdefs[enumvalue].min = minval;
-    definition.paramdefs[enumvalue].max = maxval;
-    if (enumvalue >= (int)definition.numparameters)
-        definition.numparameters = enumvalue + 1;
+    SplitVecSSE2 r = { _mm_sub_ps(a.re, b.re), _mm_sub_ps(a.im, b.im) };
+    return r;
 }
 
-// Helper function to fill default values from the effect definition into the params array -- called by Create callbacks
-void InitParametersFromDefinitions(
-    InternalEffectDefinitionRegistrationCallback registereffectdefcallback,
-    float* params
-    )
+static inline SplitVecSSE2 LoadSplitTwiddlesSSE2(const float* w, int numsamples, __m128 conj)
 {
-    UnityAudioEffectDefinition definition;
-    memset(&definition, 0, sizeof(definition));
-    registereffectdefcallback(definition);
-    for (UInt32 n = 0; n < definition.numparameters; n++)
-    {
-        params[n] = definition.paramdefs[n].defaultval;
-        delete[] definition.paramdefs[n].description;
-    }
-    delete[] definition.paramdefs; // assumes that definition.paramdefs was allocated by registereffectdefcallback or is NULL
+    SplitVecSSE2 r = { _mm_loadu_ps(w), _mm_xor_ps(_mm_loadu_ps(w + numsamples - 1), conj) };
+    return r;
 }
 
-void DeclareEffect(
-    UnityAudioEffectDefinition& definition,
-    const char* name,
-    UnityAudioEffect_CreateCallback createcallback,
-    UnityAudioEffect_ReleaseCallback releasecallback,
-    UnityAudioEffect_ProcessCallback processcallback,
-    UnityAudioEffect_SetFloatParameterCallback setfloatparametercallback,
-    UnityAudioEffect_GetFloatParameterCallback getfloatparametercallback,
-    UnityAudioEffect_GetFloatBufferCallback getfloatbuffercallback,
-    InternalEffectDefinitionRegistrationCallback registereffectdefcallback
-    )
+static void FFTRadix4PassSplitSSE2(const SplitComplex* data, int numsignals, int numsamples, int j, const float* twiddles, bool forward)
 {
-    memset(&definition, 0, sizeof(definition));
-    strcpy_s(definition.name, name);
-    definition.structsize = sizeof(UnityAudioEffectDefinition);
-    definition.paramstructsize = sizeof(UnityAudioParameterDefinition);
-    definition.apiversion = UNITY_AUDIO_PLUGIN_API_VERSION;
-    definition.pluginversion = 0x010000;
-    definition.create = createcallback;
-    definition.release = releasecallback;
-    definition.process = processcallback;
-    definition.setfloatparameter = setfloatparametercallback;
-    definition.getfloatparameter = getfloatparametercallback;
-    definition.getfloatbuffer = getfloatbuffercallback;
-    registereffectdefcallback(definition);
+    const float* w1 = twiddles + j - 1;
+    const float* w2 = twiddles + j + j - 1;
+    __m128 conj = _mm_set1_ps((forward) ? 0.0f : -0.0f);
+    __m128 rotre = _mm_set1_ps((forward) ? 0.0f : -0.0f), rotim = _mm_set1_ps((forward) ? -0.0f : 0.0f);
+    for (int i = 0; i < numsamples; i += 4 * j)
+    {
+        for (int m = 0; m < j; m += 4)
+        {
+            SplitVecSSE2 wa = LoadSplitTwiddlesSSE2(w1 + m, numsamples, conj);
+            SplitVecSSE2 wb = LoadSplitTwiddlesSSE2(w2 + m, numsamples, conj);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* re = data[c].re + i + m;
+                float* im = data[c].im + i + m;
+                SplitVecSSE2 a0 = LoadSplitSSE2(re, im), t1 = SplitMulSSE2(LoadSplitSSE2(re + j, im + j), wa);
+                SplitVecSSE2 a2 = LoadSplitSSE2(re + 2 * j, im + 2 * j), t3 = SplitMulSSE2(LoadSplitSSE2(re + 3 * j, im + 3 * j), wa);
+                SplitVecSSE2 b0 = SplitAddSSE2(a0, t1), b1 = SplitSubSSE2(a0, t1);
+                SplitVecSSE2 u2 = SplitMulSSE2(SplitAddSSE2(a2, t3), wb);
+                SplitVecSSE2 v3 = SplitMulSSE2(SplitSubSSE2(a2, t3), wb);
+                SplitVecSSE2 u3 = { _mm_xor_ps(v3.im, rotre), _mm_xor_ps(v3.re, rotim) };
+                StoreSplitSSE2(re, im, SplitAddSSE2(b0, u2));
+                StoreSplitSSE2(re + j, im + j, SplitAddSSE2(b1, u3));
+                StoreSplitSSE2(re + 2 * j, im + 2 * j, SplitSubSSE2(b0, u2));
+                StoreSplitSSE2(re + 3 * j, im + 3 * j, SplitSubSSE2(b1, u3));
+            }
+        }
+    }
+}
+
+static void FFTRadix2PassSplitSSE2(const SplitComplex* data, int numsignals, int numsamples, int j, const float* twiddles, bool forward)
+{
+    const float* w = twiddles + j - 1;
+    __m128 conj = _mm_set1_ps((forward) ? 0.0f : -0.0f);
+    for (int i = 0; i < numsamples; i += 2 * j)
+    {
+        for (int m = 0; m < j; m += 4)
+        {
+            SplitVecSSE2 wm = LoadSplitTwiddlesSSE2(w + m, numsamples, conj);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* re = data[c].re + i + m;
+                float* im = data[c].im + i + m;
+                SplitVecSSE2 x = LoadSplitSSE2(re, im);
+                SplitVecSSE2 t = SplitMulSSE2(LoadSplitSSE2(re + j, im + j), wm);
+                StoreSplitSSE2(re, im, SplitAddSSE2(x, t));
+                StoreSplitSSE2(re + j, im + j, SplitSubSSE2(x, t));
+            }
+        }
+    }
+}
+
+static void FFTProcessSplitSSE2(const SplitComplex* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, const float* splittwiddles, bool forward)
+{
+    FFTProcessSplitSIMD<FFTRadix4PassSplitSSE2, FFTRadix2PassSplitSSE2>(data, numsignals, numsamples, swaps, numswaps, twiddles, splittwiddles, forward);
+}
+
+static void SplitComplexMulSSE2(const SplitComplex& a, const SplitComplex& b, const SplitComplex& result, int numelements)
+{
+    int n = 0;
+    for (; n + 4 <= numelements; n += 4)
+        StoreSplitSSE2(result.re + n, result.im + n, SplitMulSSE2(LoadSplitSSE2(a.re + n, a.im + n), LoadSplitSSE2(b.re + n, b.im + n)));
+    SplitComplexMulRange(a, b, result, n, numelements);
+}
+
+static void SplitComplexMulAddSSE2(const SplitComplex& a, const SplitComplex& b, const SplitComplex& acc, int numelements)
+{
+    int n = 0;
+    for (; n + 4 <= numelements; n += 4)
+    {
+        SplitVecSSE2 t = SplitMulSSE2(LoadSplitSSE2(a.re + n, a.im + n), LoadSplitSSE2(b.re + n, b.im + n));
+        StoreSplitSSE2(acc.re + n, acc.im + n, SplitAddSSE2(LoadSplitSSE2(acc.re + n, acc.im + n), t));
+    }
+    SplitComplexMulAddRange(a, b, acc, n, numelements);
+}
+
+// Widens four bfloat16 values to floats by moving them into the upper halves of the lanes
+static inline __m128 LoadBF16SSE2(const UInt16* p)
+{
+    return _mm_castsi128_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), _mm_loadl_epi64((const __m128i*)p)));
+}
+
+static void SplitComplexMulAddBF16SSE2(const SplitComplexBF16& a, const SplitComplex& b, const SplitComplex& acc, int numelements)
+{
+    int n = 0;
+    for (; n + 4 <= numelements; n += 4)
+    {
+        SplitVecSSE2 ak = { LoadBF16SSE2(a.re + n), LoadBF16SSE2(a.im + n) };
+        SplitVecSSE2 t = SplitMulSSE2(ak, LoadSplitSSE2(b.re + n, b.im + n));
+        StoreSplitSSE2(acc.re + n, acc.im + n, SplitAddSSE2(LoadSplitSSE2(acc.re + n, acc.im + n), t));
+    }
+    SplitComplexMulAddBF16Range(a, b, acc, n, numelements);
+}
+
+// Computes several consecutive outputs per register, so every tap is a broadcast and an unaligned load of the input shifted by one
+static void FIRMulAddSSE2(const float* h, int numtaps, const float* x, float* y, int numsamples)
+{
+    int n = 0;
+    for (; n + 8 <= numsamples; n += 8)
+    {
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+        const float* src = x + n;
+        for (int k = 0; k < numtaps; k++, src--)
+        {
+            __m128 t = _mm_set1_ps(h[k]);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(t, _mm_loadu_ps(src)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(t, _mm_loadu_ps(src + 4)));
+        }
+        _mm_storeu_ps(y + n, _mm_add_ps(_mm_loadu_ps(y + n), acc0));
+        _mm_storeu_ps(y + n + 4, _mm_add_ps(_mm_loadu_ps(y + n + 4), acc1));
+    }
+    FIRMulAddRange(h, numtaps, x, y, n, numsamples);
+}
+
+static float DotProductSSE2(const float* a, const float* b, int numelements)
+{
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    int n = 0;
+    for (; n + 8 <= numelements; n += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + n), _mm_loadu_ps(b + n)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + n + 4), _mm_loadu_ps(b + n + 4)));
+    }
+    __m128 acc = _mm_add_ps(acc0, acc1);
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(acc) + DotProductRange(a, b, n, numelements);
+}
+
+#endif
+
+#if NAP_SIMD_AVX2
+
+// Four interleaved complex numbers per register
+static NAP_TARGET_AVX2 inline __m256 ComplexMulAVX2(__m256 a, __m256 w)
+{
+    __m256 aswap = _mm256_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm256_fmaddsub_ps(a, _mm256_moveldup_ps(w), _mm256_mul_ps(aswap, _mm256_movehdup_ps(w)));
+}
+
+static NAP_TARGET_AVX2 inline __m256 RotateAVX2(__m256 a, __m256 sign)
+{
+    return _mm256_xor_ps(_mm256_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1)), sign);
+}
+
+static NAP_TARGET_AVX2 inline __m256 SignMaskAVX2(bool even, bool odd)
+{
+    return _mm256_castsi256_ps(_mm256_set1_epi64x((long long)((odd) ? 0x8000000000000000ULL : 0) | ((even) ? 0x80000000ULL : 0)));
+}
+
+static NAP_TARGET_AVX2 void FFTRadix4PassAVX2(UnityComplexNumber* const* data, int numsignals, int numsamples, int j, const UnityComplexNumberT<float>* twiddles, bool forward)
+{
+    const float* w1 = &twiddles[j - 1].re;
+    const float* w2 = &twiddles[j + j - 1].re;
+    __m256 conj = SignMaskAVX2(false, !forward);
+    __m256 rot = SignMaskAVX2(!forward, forward);
+    for (int i = 0; i < numsamples; i += 4 * j)
+    {
+        for (int m = 0; m < 2 * j; m += 8)
+        {
+            __m256 wa = _mm256_xor_ps(_mm256_loadu_ps(w1 + m), conj);
+            __m256 wb = _mm256_xor_ps(_mm256_loadu_ps(w2 + m), conj);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* x0 = &data[c][i].re + m;
+                float* x1 = x0 + 2 * j;
+                float* x2 = x0 + 4 * j;
+                float* x3 = x0 + 6 * j;
+                __m256 a0 = _mm256_loadu_ps(x0), t1 = ComplexMulAVX2(_mm256_loadu_ps(x1), wa);
+                __m256 a2 = _mm256_loadu_ps(x2), t3 = ComplexMulAVX2(_mm256_loadu_ps(x3), wa);
+                __m256 b0 = _mm256_add_ps(a0, t1), b1 = _mm256_sub_ps(a0, t1);
+                __m256 u2 = ComplexMulAVX2(_mm256_add_ps(a2, t3), wb);
+                __m256 u3 = RotateAVX2(ComplexMulAVX2(_mm256_sub_ps(a2, t3), wb), rot);
+                _mm256_storeu_ps(x0, _mm256_add_ps(b0, u2));
+                _mm256_storeu_ps(x1, _mm256_add_ps(b1, u3));
+                _mm256_storeu_ps(x2, _mm256_sub_ps(b0, u2));
+                _mm256_storeu_ps(x3, _mm256_sub_ps(b1, u3));
+            }
+        }
+    }
+}
+
+static NAP_TARGET_AVX2 void FFTRadix2PassAVX2(UnityComplexNumber* const* data, int numsignals, int numsamples, int j, const UnityComplexNumberT<float>* twiddles, bool forward)
+{
+    const float* w = &twiddles[j - 1].re;
+    __m256 conj = SignMaskAVX2(false, !forward);
+    for (int i = 0; i < numsamples; i += 2 * j)
+    {
+        for (int m = 0; m < 2 * j; m += 8)
+        {
+            __m256 wm = _mm256_xor_ps(_mm256_loadu_ps(w + m), conj);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* a = &data[c][i].re + m;
+                float* b = a + 2 * j;
+                __m256 x = _mm256_loadu_ps(a);
+                __m256 t = ComplexMulAVX2(_mm256_loadu_ps(b), wm);
+                _mm256_storeu_ps(a, _mm256_add_ps(x, t));
+                _mm256_storeu_ps(b, _mm256_sub_ps(x, t));
+            }
+        }
+    }
+}
+
+static void FFTProcessAVX2(UnityComplexNumber* const* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, bool forward)
+{
+    FFTProcessSIMD<FFTRadix4PassAVX2, FFTRadix2PassAVX2>(data, numsignals, numsamples, swaps, numswaps, twiddles, forward);
+}
+
+struct SplitVecAVX2
+{
+    __m256 re, im;
+};
+
+static NAP_TARGET_AVX2 inline SplitVecAVX2 LoadSplitAVX2(const float* re, const float* im)
+{
+    SplitVecAVX2 r = { _mm256_loadu_ps(re), _mm256_loadu_ps(im) };
+    return r;
+}
+
+static NAP_TARGET_AVX2 inline void StoreSplitAVX2(float* re, float* im, SplitVecAVX2 a)
+{
+    _mm256_storeu_ps(re, a.re);
+    _mm256_storeu_ps(im, a.im);
+}
+
+static NAP_TARGET_AVX2 inline SplitVecAVX2 SplitMulAVX2(SplitVecAVX2 a, SplitVecAVX2 w)
+{
+    SplitVecAVX2 r = {
+        _mm256_fmsub_ps(a.re, w.re, _mm256_mul_ps(a.im, w.im)),
+        _mm256_fmadd_ps(a.re, w.im, _mm256_mul_ps(a.im, w.re))
+    };
+    return r;
+}
+
+static NAP_TARGET_AVX2 inline SplitVecAVX2 SplitAddAVX2(SplitVecAVX2 a, SplitVecAVX2 b)
+{
+    SplitVecAVX2 r = { _mm256_add_ps(a.re, b.re), _mm256_add_ps(a.im, b.im) };
+    return r;
+}
+
+static NAP_TARGET_AVX2 inline SplitVecAVX2 SplitSubAVX2(SplitVecAVX2 a, SplitVecAVX2 b)
+{
+    SplitVecAVX2 r = { _mm256_sub_ps(a.re, b.re), _mm256_sub_ps(a.im, b.im) };
+    return r;
+}
+
+static NAP_TARGET_AVX2 inline SplitVecAVX2 LoadSplitTwiddlesAVX2(const float* w, int numsamples, __m256 conj)
+{
+    SplitVecAVX2 r = { _mm256_loadu_ps(w), _mm256_xor_ps(_mm256_loadu_ps(w + numsamples - 1), conj) };
+    return r;
+}
+
+// The span 4 stage is narrower than a register and is left to the SSE2 passes
+static NAP_TARGET_AVX2 void FFTRadix4PassSplitAVX2(const SplitComplex* data, int numsignals, int numsamples, int j, const float* twiddles, bool forward)
+{
+    if (j < 8)
+    {
+        FFTRadix4PassSplitSSE2(data, numsignals, numsamples, j, twiddles, forward);
+        return;
+    }
+
+    const float* w1 = twiddles + j - 1;
+    const float* w2 = twiddles + j + j - 1;
+    __m256 conj = _mm256_set1_ps((forward) ? 0.0f : -0.0f);
+    __m256 rotre = _mm256_set1_ps((forward) ? 0.0f : -0.0f), rotim = _mm256_set1_ps((forward) ? -0.0f : 0.0f);
+    for (int i = 0; i < numsamples; i += 4 * j)
+    {
+        for (int m = 0; m < j; m += 8)
+        {
+            SplitVecAVX2 wa = LoadSplitTwiddlesAVX2(w1 + m, numsamples, conj);
+            SplitVecAVX2 wb = LoadSplitTwiddlesAVX2(w2 + m, numsamples, conj);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* re = data[c].re + i + m;
+                float* im = data[c].im + i + m;
+                SplitVecAVX2 a0 = LoadSplitAVX2(re, im), t1 = SplitMulAVX2(LoadSplitAVX2(re + j, im + j), wa);
+                SplitVecAVX2 a2 = LoadSplitAVX2(re + 2 * j, im + 2 * j), t3 = SplitMulAVX2(LoadSplitAVX2(re + 3 * j, im + 3 * j), wa);
+                SplitVecAVX2 b0 = SplitAddAVX2(a0, t1), b1 = SplitSubAVX2(a0, t1);
+                SplitVecAVX2 u2 = SplitMulAVX2(SplitAddAVX2(a2, t3), wb);
+                SplitVecAVX2 v3 = SplitMulAVX2(SplitSubAVX2(a2, t3), wb);
+                SplitVecAVX2 u3 = { _mm256_xor_ps(v3.im, rotre), _mm256_xor_ps(v3.re, rotim) };
+                StoreSplitAVX2(re, im, SplitAddAVX2(b0, u2));
+                StoreSplitAVX2(re + j, im + j, SplitAddAVX2(b1, u3));
+                StoreSplitAVX2(re + 2 * j, im + 2 * j, SplitSubAVX2(b0, u2));
+                StoreSplitAVX2(re + 3 * j, im + 3 * j, SplitSubAVX2(b1, u3));
+            }
+        }
+    }
+}
+
+static NAP_TARGET_AVX2 void FFTRadix2PassSplitAVX2(const SplitComplex* data, int numsignals, int numsamples, int j, const float* twiddles, bool forward)
+{
+    if (j < 8)
+    {
+        FFTRadix2PassSplitSSE2(data, numsignals, numsamples, j, twiddles, forward);
+        return;
+    }
+
+    const float* w = twiddles + j - 1;
+    __m256 conj = _mm256_set1_ps((forward) ? 0.0f : -0.0f);
+    for (int i = 0; i < numsamples; i += 2 * j)
+    {
+        for (int m = 0; m < j; m += 8)
+        {
+            SplitVecAVX2 wm = LoadSplitTwiddlesAVX2(w + m, numsamples, conj);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* re = data[c].re + i + m;
+                float* im = data[c].im + i + m;
+                SplitVecAVX2 x = LoadSplitAVX2(re, im);
+                SplitVecAVX2 t = SplitMulAVX2(LoadSplitAVX2(re + j, im + j), wm);
+                StoreSplitAVX2(re, im, SplitAddAVX2(x, t));
+                StoreSplitAVX2(re + j, im + j, SplitSubAVX2(x, t));
+            }
+        }
+    }
+}
+
+static void FFTProcessSplitAVX2(const SplitComplex* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, const float* splittwiddles, bool forward)
+{
+    FFTProcessSplitSIMD<FFTRadix4PassSplitAVX2, FFTRadix2PassSplitAVX2>(data, numsignals, numsamples, swaps, numswaps, twiddles, splittwiddles, forward);
+}
+
+static NAP_TARGET_AVX2 void SplitComplexMulAVX2(const SplitComplex& a, const SplitComplex& b, const SplitComplex& result, int numelements)
+{
+    int n = 0;
+    for (; n + 8 <= numelements; n += 8)
+        StoreSplitAVX2(result.re + n, result.im + n, SplitMulAVX2(LoadSplitAVX2(a.re + n, a.im + n), LoadSplitAVX2(b.re + n, b.im + n)));
+    SplitComplexMulRange(a, b, result, n, numelements);
+}
+
+// The products are accumulated with four fused multiply-adds per eight bins, two of them unrolled so that consecutive FMAs are independent
+static NAP_TARGET_AVX2 void SplitComplexMulAddAVX2(const SplitComplex& a, const SplitComplex& b, const SplitComplex& acc, int numelements)
+{
+    int n = 0;
+    for (; n + 16 <= numelements; n += 16)
+    {
+        __m256 are0 = _mm256_loadu_ps(a.re + n), aim0 = _mm256_loadu_ps(a.im + n);
+        __m256 bre0 = _mm256_loadu_ps(b.re + n), bim0 = _mm256_loadu_ps(b.im + n);
+        __m256 are1 = _mm256_loadu_ps(a.re + n + 8), aim1 = _mm256_loadu_ps(a.im + n + 8);
+        __m256 bre1 = _mm256_loadu_ps(b.re + n + 8), bim1 = _mm256_loadu_ps(b.im + n + 8);
+        __m256 re0 = _mm256_fmadd_ps(are0, bre0, _mm256_loadu_ps(acc.re + n));
+        __m256 im0 = _mm256_fmadd_ps(are0, bim0, _mm256_loadu_ps(acc.im + n));
+        __m256 re1 = _mm256_fmadd_ps(are1, bre1, _mm256_loadu_ps(acc.re + n + 8));
+        __m256 im1 = _mm256_fmadd_ps(are1, bim1, _mm256_loadu_ps(acc.im + n + 8));
+        _mm256_storeu_ps(acc.re + n, _mm256_fnmadd_ps(aim0, bim0, re0));
+        _mm256_storeu_ps(acc.im + n, _mm256_fmadd_ps(aim0, bre0, im0));
+        _mm256_storeu_ps(acc.re + n + 8, _mm256_fnmadd_ps(aim1, bim1, re1));
+        _mm256_storeu_ps(acc.im + n + 8, _mm256_fmadd_ps(aim1, bre1, im1));
+    }
+    for (; n + 8 <= numelements; n += 8)
+    {
+        __m256 are = _mm256_loadu_ps(a.re + n), aim = _mm256_loadu_ps(a.im + n);
+        __m256 bre = _mm256_loadu_ps(b.re + n), bim = _mm256_loadu_ps(b.im + n);
+        __m256 re = _mm256_fmadd_ps(are, bre, _mm256_loadu_ps(acc.re + n));
+        __m256 im = _mm256_fmadd_ps(are, bim, _mm256_loadu_ps(acc.im + n));
+        _mm256_storeu_ps(acc.re + n, _mm256_fnmadd_ps(aim, bim, re));
+        _mm256_storeu_ps(acc.im + n, _mm256_fmadd_ps(aim, bre, im));
+    }
+    SplitComplexMulAddRange(a, b, acc, n, numelements);
+}
+
+static NAP_TARGET_AVX2 inline __m256 LoadBF16AVX2(const UInt16* p)
+{
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p)), 16));
+}
+
+// Same as SplitComplexMulAddAVX2 with the conversion of a added to the loads
+static NAP_TARGET_AVX2 void SplitComplexMulAddBF16AVX2(const SplitComplexBF16& a, const SplitComplex& b, const SplitComplex& acc, int numelements)
+{
+    int n = 0;
+    for (; n + 16 <= numelements; n += 16)
+    {
+        __m256 are0 = LoadBF16AVX2(a.re + n), aim0 = LoadBF16AVX2(a.im + n);
+        __m256 bre0 = _mm256_loadu_ps(b.re + n), bim0 = _mm256_loadu_ps(b.im + n);
+        __m256 are1 = LoadBF16AVX2(a.re + n + 8), aim1 = LoadBF16AVX2(a.im + n + 8);
+        __m256 bre1 = _mm256_loadu_ps(b.re + n + 8), bim1 = _mm256_loadu_ps(b.im + n + 8);
+        __m256 re0 = _mm256_fmadd_ps(are0, bre0, _mm256_loadu_ps(acc.re + n));
+        __m256 im0 = _mm256_fmadd_ps(are0, bim0, _mm256_loadu_ps(acc.im + n));
+        __m256 re1 = _mm256_fmadd_ps(are1, bre1, _mm256_loadu_ps(acc.re + n + 8));
+        __m256 im1 = _mm256_fmadd_ps(are1, bim1, _mm256_loadu_ps(acc.im + n + 8));
+        _mm256_storeu_ps(acc.re + n, _mm256_fnmadd_ps(aim0, bim0, re0));
+        _mm256_storeu_ps(acc.im + n, _mm256_fmadd_ps(aim0, bre0, im0));
+        _mm256_storeu_ps(acc.re + n + 8, _mm256_fnmadd_ps(aim1, bim1, re1));
+        _mm256_storeu_ps(acc.im + n + 8, _mm256_fmadd_ps(aim1, bre1, im1));
+    }
+    for (; n + 8 <= numelements; n += 8)
+    {
+        __m256 are = LoadBF16AVX2(a.re + n), aim = LoadBF16AVX2(a.im + n);
+        __m256 bre = _mm256_loadu_ps(b.re + n), bim = _mm256_loadu_ps(b.im + n);
+        __m256 re = _mm256_fmadd_ps(are, bre, _mm256_loadu_ps(acc.re + n));
+        __m256 im = _mm256_fmadd_ps(are, bim, _mm256_loadu_ps(acc.im + n));
+        _mm256_storeu_ps(acc.re + n, _mm256_fnmadd_ps(aim, bim, re));
+        _mm256_storeu_ps(acc.im + n, _mm256_fmadd_ps(aim, bre, im));
+    }
+    SplitComplexMulAddBF16Range(a, b, acc, n, numelements);
+}
+
+static NAP_TARGET_AVX2 void FIRMulAddAVX2(const float* h, int numtaps, const float* x, float* y, int numsamples)
+{
+    int n = 0;
+    for (; n + 16 <= numsamples; n += 16)
+    {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        const float* src = x + n;
+        for (int k = 0; k < numtaps; k++, src--)
+        {
+            __m256 t = _mm256_broadcast_ss(h + k);
+            acc0 = _mm256_fmadd_ps(t, _mm256_loadu_ps(src), acc0);
+            acc1 = _mm256_fmadd_ps(t, _mm256_loadu_ps(src + 8), acc1);
+        }
+        _mm256_storeu_ps(y + n, _mm256_add_ps(_mm256_loadu_ps(y + n), acc0));
+        _mm256_storeu_ps(y + n + 8, _mm256_add_ps(_mm256_loadu_ps(y + n + 8), acc1));
+    }
+    for (; n + 8 <= numsamples; n += 8)
+    {
+        __m256 acc = _mm256_setzero_ps();
+        const float* src = x + n;
+        for (int k = 0; k < numtaps; k++, src--)
+            acc = _mm256_fmadd_ps(_mm256_broadcast_ss(h + k), _mm256_loadu_ps(src), acc);
+        _mm256_storeu_ps(y + n, _mm256_add_ps(_mm256_loadu_ps(y + n), acc));
+    }
+    FIRMulAddRange(h, numtaps, x, y, n, numsamples);
+}
+
+static NAP_TARGET_AVX2 float DotProductAVX2(const float* a, const float* b, int numelements)
+{
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    int n = 0;
+    for (; n + 16 <= numelements; n += 16)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + n), _mm256_loadu_ps(b + n), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + n + 8), _mm256_loadu_ps(b + n + 8), acc1);
+    }
+    if (n + 8 <= numelements)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + n), _mm256_loadu_ps(b + n), acc0);
+        n += 8;
+    }
+    __m256 acc8 = _mm256_add_ps(acc0, acc1);
+    __m128 acc = _mm_add_ps(_mm256_castps256_ps128(acc8), _mm256_extractf128_ps(acc8, 1));
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(acc) + DotProductRange(a, b, n, numelements);
+}
+
+static bool CPUSupportsAVX2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const int fma = 1 << 12, osxsave = 1 << 27, avx = 1 << 28;
+    if ((info[2] & (fma | osxsave | avx)) != (fma | osxsave | avx))
+        return false;
+    if ((_xgetbv(0) & 6) != 6) // OS saves the XMM and YMM registers
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+#endif
+
+#if NAP_SIMD_NEON
+
+// NEON loads deinterleave four complex numbers into separate real and imaginary registers
+static inline float32x4x2_t ComplexMulNEON(float32x4x2_t a, float32x4x2_t w)
+{
+    float32x4x2_t r;
+    r.val[0] = vmlsq_f32(vmulq_f32(a.val[0], w.val[0]), a.val[1], w.val[1]);
+    r.val[1] = vmlaq_f32(vmulq_f32(a.val[0], w.val[1]), a.val[1], w.val[0]);
+    return r;
+}
+
+static inline float32x4x2_t ComplexAddNEON(float32x4x2_t a, float32x4x2_t b)
+{
+    float32x4x2_t r;
+    r.val[0] = vaddq_f32(a.val[0], b.val[0]);
+    r.val[1] = vaddq_f32(a.val[1], b.val[1]);
+    return r;
+}
+
+static inline float32x4x2_t ComplexSubNEON(float32x4x2_t a, float32x4x2_t b)
+{
+    float32x4x2_t r;
+    r.val[0] = vsubq_f32(a.val[0], b.val[0]);
+    r.val[1] = vsubq_f32(a.val[1], b.val[1]);
+    return r;
+}
+
+static inline float32x4x2_t LoadTwiddlesNEON(const float* w, bool forward)
+{
+    float32x4x2_t r = vld2q_f32(w);
+    if (!forward)
+        r.val[1] = vnegq_f32(r.val[1]);
+    return r;
+}
+
+static void FFTRadix4PassNEON(UnityComplexNumber* const* data, int numsignals, int numsamples, int j, const UnityComplexNumberT<float>* twiddles, bool forward)
+{
+    const float* w1 = &twiddles[j - 1].re;
+    const float* w2 = &twiddles[j + j - 1].re;
+    for (int i = 0; i < numsamples; i += 4 * j)
+    {
+        for (int m = 0; m < 2 * j; m += 8)
+        {
+            float32x4x2_t wa = LoadTwiddlesNEON(w1 + m, forward);
+            float32x4x2_t wb = LoadTwiddlesNEON(w2 + m, forward);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* x0 = &data[c][i].re + m;
+                float* x1 = x0 + 2 * j;
+                float* x2 = x0 + 4 * j;
+                float* x3 = x0 + 6 * j;
+                float32x4x2_t a0 = vld2q_f32(x0), t1 = ComplexMulNEON(vld2q_f32(x1), wa);
+                float32x4x2_t a2 = vld2q_f32(x2), t3 = ComplexMulNEON(vld2q_f32(x3), wa);
+                float32x4x2_t b0 = ComplexAddNEON(a0, t1), b1 = ComplexSubNEON(a0, t1);
+                float32x4x2_t u2 = ComplexMulNEON(ComplexAddNEON(a2, t3), wb);
+                float32x4x2_t v3 = ComplexMulNEON(ComplexSubNEON(a2, t3), wb), u3;
+                u3.val[0] = (forward) ? v3.val[1] : vnegq_f32(v3.val[1]);
+                u3.val[1] = (forward) ? vnegq_f32(v3.val[0]) : v3.val[0];
+                vst2q_f32(x0, ComplexAddNEON(b0, u2));
+                vst2q_f32(x1, ComplexAddNEON(b1, u3));
+                vst2q_f32(x2, ComplexSubNEON(b0, u2));
+                vst2q_f32(x3, ComplexSubNEON(b1, u3));
+            }
+        }
+    }
+}
+
+static void FFTRadix2PassNEON(UnityComplexNumber* const* data, int numsignals, int numsamples, int j, const UnityComplexNumberT<float>* twiddles, bool forward)
+{
+    const float* w = &twiddles[j - 1].re;
+    for (int i = 0; i < numsamples; i += 2 * j)
+    {
+        for (int m = 0; m < 2 * j; m += 8)
+        {
+            float32x4x2_t wm = LoadTwiddlesNEON(w + m, forward);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* a = &data[c][i].re + m;
+                float* b = a + 2 * j;
+                float32x4x2_t x = vld2q_f32(a);
+                float32x4x2_t t = ComplexMulNEON(vld2q_f32(b), wm);
+                vst2q_f32(a, ComplexAddNEON(x, t));
+                vst2q_f32(b, ComplexSubNEON(x, t));
+            }
+        }
+    }
+}
+
+static void FFTProcessNEON(UnityComplexNumber* const* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, bool forward)
+{
+    FFTProcessSIMD<FFTRadix4PassNEON, FFTRadix2PassNEON>(data, numsignals, numsamples, swaps, numswaps, twiddles, forward);
+}
+
+// With split data the same helpers apply, only the loads and stores no longer need to deinterleave
+static inline float32x4x2_t LoadSplitNEON(const float* re, const float* im)
+{
+    float32x4x2_t r;
+    r.val[0] = vld1q_f32(re);
+    r.val[1] = vld1q_f32(im);
+    return r;
+}
+
+static inline void StoreSplitNEON(float* re, float* im, float32x4x2_t a)
+{
+    vst1q_f32(re, a.val[0]);
+    vst1q_f32(im, a.val[1]);
+}
+
+static inline float32x4x2_t LoadSplitTwiddlesNEON(const float* w, int numsamples, bool forward)
+{
+    float32x4x2_t r = LoadSplitNEON(w, w + numsamples - 1);
+    if (!forward)
+        r.val[1] = vnegq_f32(r.val[1]);
+    return r;
+}
+
+static void FFTRadix4PassSplitNEON(const SplitComplex* data, int numsignals, int numsamples, int j, const float* twiddles, bool forward)
+{
+    const float* w1 = twiddles + j - 1;
+    const float* w2 = twiddles + j + j - 1;
+    for (int i = 0; i < numsamples; i += 4 * j)
+    {
+        for (int m = 0; m < j; m += 4)
+        {
+            float32x4x2_t wa = LoadSplitTwiddlesNEON(w1 + m, numsamples, forward);
+            float32x4x2_t wb = LoadSplitTwiddlesNEON(w2 + m, numsamples, forward);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* re = data[c].re + i + m;
+                float* im = data[c].im + i + m;
+                float32x4x2_t a0 = LoadSplitNEON(re, im), t1 = ComplexMulNEON(LoadSplitNEON(re + j, im + j), wa);
+                float32x4x2_t a2 = LoadSplitNEON(re + 2 * j, im + 2 * j), t3 = ComplexMulNEON(LoadSplitNEON(re + 3 * j, im + 3 * j), wa);
+                float32x4x2_t b0 = ComplexAddNEON(a0, t1), b1 = ComplexSubNEON(a0, t1);
+                float32x4x2_t u2 = ComplexMulNEON(ComplexAddNEON(a2, t3), wb);
+                float32x4x2_t v3 = ComplexMulNEON(ComplexSubNEON(a2, t3), wb), u3;
+                u3.val[0] = (forward) ? v3.val[1] : vnegq_f32(v3.val[1]);
+                u3.val[1] = (forward) ? vnegq_f32(v3.val[0]) : v3.val[0];
+                StoreSplitNEON(re, im, ComplexAddNEON(b0, u2));
+                StoreSplitNEON(re + j, im + j, ComplexAddNEON(b1, u3));
+                StoreSplitNEON(re + 2 * j, im + 2 * j, ComplexSubNEON(b0, u2));
+                StoreSplitNEON(re + 3 * j, im + 3 * j, ComplexSubNEON(b1, u3));
+            }
+        }
+    }
+}
+
+static void FFTRadix2PassSplitNEON(const SplitComplex* data, int numsignals, int numsamples, int j, const float* twiddles, bool forward)
+{
+    const float* w = twiddles + j - 1;
+    for (int i = 0; i < numsamples; i += 2 * j)
+    {
+        for (int m = 0; m < j; m += 4)
+        {
+            float32x4x2_t wm = LoadSplitTwiddlesNEON(w + m, numsamples, forward);
+            for (int c = 0; c < numsignals; c++)
+            {
+                float* re = data[c].re + i + m;
+                float* im = data[c].im + i + m;
+                float32x4x2_t x = LoadSplitNEON(re, im);
+                float32x4x2_t t = ComplexMulNEON(LoadSplitNEON(re + j, im + j), wm);
+                StoreSplitNEON(re, im, ComplexAddNEON(x, t));
+                StoreSplitNEON(re + j, im + j, ComplexSubNEON(x, t));
+            }
+        }
+    }
+}
+
+static void FFTProcessSplitNEON(const SplitComplex* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, const float* splittwiddles, bool forward)
+{
+    FFTProcessSplitSIMD<FFTRadix4PassSplitNEON, FFTRadix2PassSplitNEON>(data, numsignals, numsamples, swaps, numswaps, twiddles, splittwiddles, forward);
+}
+
+static void SplitComplexMulNEON(const SplitComplex& a, const SplitComplex& b, const SplitComplex& result, int numelements)
+{
+    int n = 0;
+    for (; n + 4 <= numelements; n += 4)
+        StoreSplitNEON(result.re + n, result.im + n, ComplexMulNEON(LoadSplitNEON(a.re + n, a.im + n), LoadSplitNEON(b.re + n, b.im + n)));
+    SplitComplexMulRange(a, b, result, n, numelements);
+}
+
+static void SplitComplexMulAddNEON(const SplitComplex& a, const SplitComplex& b, const SplitComplex& acc, int numelements)
+{
+    int n = 0;
+    for (; n + 4 <= numelements; n += 4)
+    {
+        float32x4_t are = vld1q_f32(a.re + n), aim = vld1q_f32(a.im + n);
+        float32x4_t bre = vld1q_f32(b.re + n), bim = vld1q_f32(b.im + n);
+        float32x4_t re = vmlaq_f32(vld1q_f32(acc.re + n), are, bre);
+        float32x4_t im = vmlaq_f32(vld1q_f32(acc.im + n), are, bim);
+        vst1q_f32(acc.re + n, vmlsq_f32(re, aim, bim));
+        vst1q_f32(acc.im + n, vmlaq_f32(im, aim, bre));
+    }
+    SplitComplexMulAddRange(a, b, acc, n, numelements);
+}
+
+static void SplitComplexMulAddBF16NEON(const SplitComplexBF16& a, const SplitComplex& b, const SplitComplex& acc, int numelements)
+{
+    int n = 0;
+    for (; n + 4 <= numelements; n += 4)
+    {
+        float32x4_t are = vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(a.re + n), 16)), aim = vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(a.im + n), 16));
+        float32x4_t bre = vld1q_f32(b.re + n), bim = vld1q_f32(b.im + n);
+        float32x4_t re = vmlaq_f32(vld1q_f32(acc.re + n), are, bre);
+        float32x4_t im = vmlaq_f32(vld1q_f32(acc.im + n), are, bim);
+        vst1q_f32(acc.re + n, vmlsq_f32(re, aim, bim));
+        vst1q_f32(acc.im + n, vmlaq_f32(im, aim, bre));
+    }
+    SplitComplexMulAddBF16Range(a, b, acc, n, numelements);
+}
+
+static void FIRMulAddNEON(const float* h, int numtaps, const float* x, float* y, int numsamples)
+{
+    int n = 0;
+    for (; n + 8 <= numsamples; n += 8)
+    {
+        float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+        const float* src = x + n;
+        for (int k = 0; k < numtaps; k++, src--)
+        {
+            acc0 = vmlaq_n_f32(acc0, vld1q_f32(src), h[k]);
+            acc1 = vmlaq_n_f32(acc1, vld1q_f32(src + 4), h[k]);
+        }
+        vst1q_f32(y + n, vaddq_f32(vld1q_f32(y + n), acc0));
+        vst1q_f32(y + n + 4, vaddq_f32(vld1q_f32(y + n + 4), acc1));
+    }
+    FIRMulAddRange(h, numtaps, x, y, n, numsamples);
+}
+
+static float DotProductNEON(const float* a, const float* b, int numelements)
+{
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+    int n = 0;
+    for (; n + 8 <= numelements; n += 8)
+    {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + n), vld1q_f32(b + n));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + n + 4), vld1q_f32(b + n + 4));
+    }
+    float sum[4];
+    vst1q_f32(sum, vaddq_f32(acc0, acc1)); // no horizontal add on 32-bit ARM
+    return (sum[0] + sum[1]) + (sum[2] + sum[3]) + DotProductRange(a, b, n, numelements);
+}
+
+#endif
+
+typedef void (*FFTKernelFunc)(UnityComplexNumber* const* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, bool forward);
+typedef void (*FFTSplitKernelFunc)(const SplitComplex* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const UnityComplexNumberT<float>* twiddles, const float* splittwiddles, bool forward);
+typedef void (*SplitComplexMulFunc)(const SplitComplex& a, const SplitComplex& b, const SplitComplex& result, int numelements);
+typedef void (*SplitComplexMulAddBF16Func)(const SplitComplexBF16& a, const SplitComplex& b, const SplitComplex& acc, int numelements);
+typedef void (*FIRMulAddFunc)(const float* h, int numtaps, const float* x, float* y, int numsamples);
+typedef float (*DotProductFunc)(const float* a, const float* b, int numelements);
+
+// Everything that is implemented once per instruction set, so that all of it is selected together
+struct FFTKernel
+{
+    const char* name;
+    FFTKernelFunc process;
+    FFTSplitKernelFunc processsplit;
+    SplitComplexMulFunc complexmul;
+    SplitComplexMulFunc complexmuladd;
+    SplitComplexMulAddBF16Func complexmuladdbf16;
+    FIRMulAddFunc firmuladd;
+    DotProductFunc dotproduct;
+};
+
+// All kernels that can run on this machine, best one last
+static int GetFFTKernels(FFTKernel* kernels)
+{
+    int num = 0;
+    kernels[num].name = "Scalar";
+    kernels[num].process = FFTProcessScalar;
+    kernels[num].processsplit = FFTProcessSplitScalar;
+    kernels[num].complexmul = SplitComplexMulScalar;
+    kernels[num].complexmuladd = SplitComplexMulAddScalar;
+    kernels[num].complexmuladdbf16 = SplitComplexMulAddBF16Scalar;
+    kernels[num].firmuladd = FIRMulAddScalar;
+    kernels[num++].dotproduct = DotProductScalar;
+#if NAP_SIMD_SSE2
+    kernels[num].name = "SSE2";
+    kernels[num].process = FFTProcessSSE2;
+    kernels[num].processsplit = FFTProcessSplitSSE2;
+    kernels[num].complexmul = SplitComplexMulSSE2;
+    kernels[num].complexmuladd = SplitComplexMulAddSSE2;
+    kernels[num].complexmuladdbf16 = SplitComplexMulAddBF16SSE2;
+    kernels[num].firmuladd = FIRMulAddSSE2;
+    kernels[num++].dotproduct = DotProductSSE2;
+#endif
+#if NAP_SIMD_AVX2
+    if (CPUSupportsAVX2())
+    {
+        kernels[num].name = "AVX2";
+        kernels[num].process = FFTProcessAVX2;
+        kernels[num].processsplit = FFTProcessSplitAVX2;
+        kernels[num].complexmul = SplitComplexMulAVX2;
+        kernels[num].complexmuladd = SplitComplexMulAddAVX2;
+        kernels[num].complexmuladdbf16 = SplitComplexMulAddBF16AVX2;
+        kernels[num].firmuladd = FIRMulAddAVX2;
+        kernels[num++].dotproduct = DotProductAVX2;
+    }
+#endif
+#if NAP_SIMD_NEON
+    kernels[num].name = "NEON";
+    kernels[num].process = FFTProcessNEON;
+    kernels[num].processsplit = FFTProcessSplitNEON;
+    kernels[num].complexmul = SplitComplexMulNEON;
+    kernels[num].complexmuladd = SplitComplexMulAddNEON;
+    kernels[num].complexmuladdbf16 = SplitComplexMulAddBF16NEON;
+    kernels[num].firmuladd = FIRMulAddNEON;
+    kernels[num++].dotproduct = DotProductNEON;
+#endif
+    return num;
+}
+
+static const int kMaxFFTKernels = 4;
+
+static const FFTKernel* g_FFTKernelOverride = NULL; // Lets the unit tests and benchmarks run every kernel through the normal plan code path
+
+static const FFTKernel& GetFFTKernel()
+{
+    if (g_FFTKernelOverride != NULL)
+        return *g_FFTKernelOverride;
+
+    // The CPU is only queried once, subsequent calls just load the selected kernel
+    static FFTKernel kernels[kMaxFFTKernels];
+    static const int best = GetFFTKernels(kernels) - 1;
+    return kernels[best];
+}
+
+// Largest prime factor supported in transform lengths that are not a power of two
+static const int kMaxFFTRadix = 64;
+
+// Iterative decimation-in-time transform for lengths that are not a power of two. Each stage (radix, span, twiddle offset)
+// combines radix sub-transforms of length span into transforms of length radix * span. After the digit-reversal permutation
+// all stages operate in place, just like the radix-2 stages in FFTProcess.
+template<typename T, bool forward, class L>
+static void FFTProcessMixedRadix(const typename L::Signal* data, int numsignals, int numsamples, const unsigned int* swaps, int numswaps, const int* stages, int numstages, const UnityComplexNumberT<T>* twiddles)
+{
+    FFTPermute<L>(data, numsignals, swaps, numswaps);
+
+    const T sign = (forward) ? T(-1) : T(1);
+    const T sin60 = T(0.86602540378443865), cos72 = T(0.30901699437494742), cos144 = T(-0.80901699437494742);
+    const T sin72 = T(0.95105651629515357), sin144 = T(0.58778525229247313);
+
+    for (int s = 0; s < numstages; s++)
+    {
+        const int radix = stages[s * 3], span = stages[s * 3 + 1];
+        const UnityComplexNumberT<T>* w = twiddles + stages[s * 3 + 2];
+        const UnityComplexNumberT<T>* roots = w + span * (radix - 1);
+        for (int i = 0; i < numsamples; i += radix * span)
+        {
+            for (int k = 0; k < span; k++)
+            {
+                UnityComplexNumberT<T> wk[kMaxFFTRadix];
+                for (int r = 1; r < radix; r++)
+                    wk[r].Set(w[k * (radix - 1) + r - 1].re, sign * -w[k * (radix - 1) + r - 1].im);
+
+                for (int c = 0; c < numsignals; c++)
+                {
+                    // Gather the inputs of this butterfly and apply the twiddles
+                    const typename L::Signal& x = data[c];
+                    const int o = i + k;
+                    UnityComplexNumberT<T> a[kMaxFFTRadix];
+                    a[0].Set(L::Re(x, o), L::Im(x, o));
+                    for (int r = 1; r < radix; r++)
+                    {
+                        T bre = L::Re(x, o + r * span), bim = L::Im(x, o + r * span);
+                        a[r].Set(wk[r].re * bre - wk[r].im * bim, wk[r].re * bim + wk[r].im * bre);
+                    }
+
+                    switch (radix)
+                    {
+                        case 2:
+                        {
+                            L::Set(x, o, float(a[0].re + a[1].re), float(a[0].im + a[1].im));
+                            L::Set(x, o + span, float(a[0].re - a[1].re), float(a[0].im - a[1].im));
+                            break;
+                        }
+                        case 3:
+                        {
+                            T sre = a[1].re + a[2].re, sim = a[1].im + a[2].im;
+                            T mre = a[0].re - T(0.5) * sre, mim = a[0].im - T(0.5) * sim;
+                            T dre = sign * sin60 * (a[1].im - a[2].im), dim = sign * sin60 * (a[2].re - a[1].re);
+                            L::Set(x, o, float(a[0].re + sre), float(a[0].im + sim));
+                            L::Set(x, o + span, float(mre - dre), float(mim - dim));
+                            L::Set(x, o + 2 * span, float(mre + dre), float(mim + dim));
+                            break;
+                        }
+                        case 4:
+                        {
+                            T s0re = a[0].re + a[2].re, s0im = a[0].im + a[2].im;
+                            T d0re = a[0].re - a[2].re, d0im = a[0].im - a[2].im;
+                            T s1re = a[1].re + a[3].re, s1im = a[1].im + a[3].im;
+                            T d1re = -sign * (a[1].im - a[3].im), d1im = sign * (a[1].re - a[3].re);
+                            L::Set(x, o, float(s0re + s1re), float(s0im + s1im));
+                            L::Set(x, o + span, float(d0re + d1re), float(d0im + d1im));
+                            L::Set(x, o + 2 * span, float(s0re - s1re), float(s0im - s1im));
+                            L::Set(x, o + 3 * span, float(d0re - d1re), float(d0im - d1im));
+                            break;
+                        }
+                        case 5:
+                        {
+                            T b1re = a[1].re + a[4].re, b1im = a[1].im + a[4].im;
+                            T b2re = a[2].re + a[3].re, b2im = a[2].im + a[3].im;
+                            T d1re = a[1].re - a[4].re, d1im = a[1].im - a[4].im;
+                            T d2re = a[2].re - a[3].re, d2im = a[2].im - a[3].im;
+                            T r1re = a[0].re + cos72 * b1re + cos144 * b2re, r1im = a[0].im + cos72 * b1im + cos144 * b2im;
+                            T r2re = a[0].re + cos144 * b1re + cos72 * b2re, r2im = a[0].im + cos144 * b1im + cos72 * b2im;
+                            // i * sign * (sin72 * d1 + sin144 * d2) and i * sign * (sin144 * d1 - sin72 * d2)
+                            T i1re = -sign * (sin72 * d1im + sin144 * d2im), i1im = sign * (sin72 * d1re + sin144 * d2re);
+                            T i2re = -sign * (sin144 * d1im - sin72 * d2im), i2im = sign * (sin144 * d1re - sin72 * d2re);
+                            L::Set(x, o, float(a[0].re + b1re + b2re), float(a[0].im + b1im + b2im));
+                            L::Set(x, o + span, float(r1re + i1re), float(r1im + i1im));
+                            L::Set(x, o + 2 * span, float(r2re + i2re), float(r2im + i2im));
+                            L::Set(x, o + 3 * span, float(r2re - i2re), float(r2im - i2im));
+                            L::Set(x, o + 4 * span, float(r1re - i1re), float(r1im - i1im));
+                            break;
+                        }
+                        default:
+                        {
+                            // Plain DFT for the remaining prime factors
+                            for (int q = 0; q < radix; q++)
+                            {
+                                T yre = a[0].re, yim = a[0].im;
+                                for (int r = 1, rq = q; r < radix; r++, rq += q)
+                                {
+                                    if (rq >= radix)
+                                        rq -= radix;
+                                    T wre = roots[rq].re, wim = sign * -roots[rq].im;
+                                    yre += wre * a[r].re - wim * a[r].im;
+                                    yim += wre * a[r].im + wim * a[r].re;
+                                }
+                                L::Set(x, o + q * span, float(yre), float(yim));
+                            }
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// A real signal x of length N is transformed as the complex signal z[n] = x[2n] + i * x[2n+1] of length N/2.
+// The spectra of the even and odd samples are then separated from Z and recombined via X[k] = E[k] + W^k * O[k].
+template<typename T, class L>
+static void RealFFTUnpack(const typename L::Signal* data, int numsignals, int half, const UnityComplexNumberT<T>* twiddles)
+{
+    for (int c = 0; c < numsignals; c++)
+    {
+        const typename L::Signal& x = data[c];
+        T z0re = L::Re(x, 0), z0im = L::Im(x, 0);
+        L::Set(x, 0, float(z0re + z0im), 0.0f);
+        L::Set(x, half, float(z0re - z0im), 0.0f);
+    }
+
+    for (int k = 1; k <= half / 2; k++)
+    {
+        const UnityComplexNumberT<T> w = twiddles[k];
+        for (int c = 0; c < numsignals; c++)
+        {
+            const typename L::Signal& x = data[c];
+            T are = L::Re(x, k), aim = L::Im(x, k), bre = L::Re(x, half - k), bim = L::Im(x, half - k);
+            T ere = T(0.5) * (are + bre), eim = T(0.5) * (aim - bim);
+            T ore = T(0.5) * (aim + bim), oim = T(0.5) * (bre - are);
+            T tre = w.re * ore - w.im * oim, tim = w.re * oim + w.im * ore;
+            L::Set(x, half - k, float(ere - tre), float(tim - eim));
+            L::Set(x, k, float(ere + tre), float(eim + tim));
+        }
+    }
+}
+
+// Inverse of RealFFTUnpack, i.e. Z[k] = E[k] + i * W^-k * O[k] with the factor 1/2 included.
+template<typename T, class L>
+static void RealFFTPack(const typename L::Signal* data, int numsignals, int half, const UnityComplexNumberT<T>* twiddles)
+{
+    for (int c = 0; c < numsignals; c++)
+    {
+        const typename L::Signal& x = data[c];
+        T x0 = L::Re(x, 0), xh = L::Re(x, half);
+        L::Set(x, 0, float(T(0.5) * (x0 + xh)), float(T(0.5) * (x0 - xh)));
+    }
+
+    for (int k = 1; k <= half / 2; k++)
+    {
+        const UnityComplexNumberT<T> w = twiddles[k];
+        for (int c = 0; c < numsignals; c++)
+        {
+            const typename L::Signal& x = data[c];
+            T are = L::Re(x, k), aim = L::Im(x, k), bre = L::Re(x, half - k), bim = L::Im(x, half - k);
+            T ere = T(0.5) * (are + bre), eim = T(0.5) * (aim - bim);
+            T dre = T(0.5) * (are - bre), dim = T(0.5) * (aim + bim);
+            T ore = w.re * dre + w.im * dim, oim = w.re * dim - w.im * dre;
+            L::Set(x, half - k, float(ere + oim), float(ore - eim));
+            L::Set(x, k, float(ere - oim), float(eim + ore));
+        }
+    }
+}
+
+template<typename T>
+static UnityComplexNumberT<T>* CreateTwiddleTable(int numentries, double anglestep, bool stages)
+{
+    UnityComplexNumberT<T>* tbl = new UnityComplexNumberT<T>[numentries];
+    for (int n = 0; n < numentries; n++)
+    {
+        // With stages set the table is made up of consecutive stages of sizes 1, 2, 4, ..., each covering half a turn
+        int j = 1, m = n;
+        if (stages)
+        {
+            while (m >= j)
+            {
+                m -= j;
+                j += j;
+            }
+        }
+        double w = anglestep * m / j;
+        tbl[n].Set(T(cos(w)), T(sin(w)));
+    }
+    return tbl;
+}
+
+class FFTPlanRegistry
+{
+public:
+    ~FFTPlanRegistry()
+    {
+        FFTPlan* plan = head;
+        while (plan != NULL)
+        {
+            FFTPlan* next = plan->next;
+            delete plan;
+            plan = next;
+        }
+    }
+
+    const FFTPlan* Find(int numsamples, bool highprecision)
+    {
+        for (const FFTPlan* plan = AtomicLoadPointer(&head); plan != NULL; plan = plan->next)
+            if (plan->numsamples == numsamples && plan->highprecision == highprecision)
+                return plan;
+        return NULL;
+    }
+
+    const FFTPlan* Get(int numsamples, bool highprecision)
+    {
+        // Plans are never removed while the library is loaded, so lookups can traverse the list without locking
+        const FFTPlan* plan = Find(numsamples, highprecision);
+        if (plan != NULL)
+            return plan;
+
+        MutexScopeLock lock(mutex);
+        plan = Find(numsamples, highprecision);
+        if (plan == NULL)
+        {
+            FFTPlan* newplan = new FFTPlan(numsamples, highprecision);
+            newplan->next = head;
+            AtomicStorePointer(&head, newplan);
+            plan = newplan;
+        }
+        return plan;
+    }
+
+    static FFTPlanRegistry& Instance()
+    {
+        // Function-local so that plans can already be requested from constructors of other static objects
+        static FFTPlanRegistry registry;
+        return registry;
+    }
+
+protected:
+    FFTPlanRegistry() : head(NULL) {}
+
+protected:
+    Mutex mutex;
+    FFTPlan* volatile head;
+};
+
+const FFTPlan* FFTPlan::Get(int numsamples, bool highprecision)
+{
+    return FFTPlanRegistry::Instance().Get(numsamples, highprecision);
+}
+
+FFTPlan::FFTPlan(int numsamples, bool highprecision)
+    : numsamples(numsamples)
+    , highprecision(highprecision)
+    , numswaps(0)
+    , swaps(NULL)
+    , numstages(0)
+    , stages(NULL)
+    , twiddlesf(NULL)
+    , twiddlesd(NULL)
+    , splittwiddlesf(NULL)
+    , realtwiddlesf(NULL)
+    , realtwiddlesd(NULL)
+    , half(NULL)
+    , next(NULL)
+{
+    assert(IsSupportedSize(numsamples));
+
+    if ((numsamples & (numsamples - 1)) != 0)
+        InitMixedRadix();
+    else
+        InitRadix2();
+
+    if (numsamples >= 2 && (numsamples & 1) == 0)
+        half = Get(numsamples / 2, highprecision);
+}
+
+bool FFTPlan::IsSupportedSize(int numsamples)
+{
+    if (numsamples < 1)
+        return false;
+    int n = numsamples;
+    for (int p = 2; p <= kMaxFFTRadix; p++)
+        while (n % p == 0)
+            n /= p;
+    return n == 1;
+}
+
+void FFTPlan::InitRadix2()
+{
+    unsigned int* tbl = new unsigned int[numsamples];
+    for (unsigned int n = 0; n < (unsigned)numsamples; n++)
+    {
+        unsigned int j = 1, k = 0, m = numsamples >> 1;
+        while (m > 0)
+        {
+            if (n & m)
+                k |= j;
+            j += j;
+            m >>= 1;
+        }
+        tbl[n] = k;
+        if (n < k)
+            numswaps++;
+    }
+#if ENABLE_TESTS
+    for (unsigned int n = 0; n < (unsigned)numsamples; n++)
+    {
+        assert(tbl[tbl[n]] == n);
+    }
+#endif
+    swaps = new unsigned int[numswaps * 2];
+    unsigned int* dst = swaps;
+    for (unsigned int n = 0; n < (unsigned)numsamples; n++)
+    {
+        if (n < tbl[n])
+        {
+            *dst++ = n;
+            *dst++ = tbl[n];
+        }
+    }
+    delete[] tbl;
+
+    int numtwiddles = (numsamples > 1) ? (numsamples - 1) : 1;
+    int numrealtwiddles = numsamples / 4 + 1;
+    if (highprecision)
+    {
+        twiddlesd = CreateTwiddleTable<double>(numtwiddles, -kPI_double, true);
+        realtwiddlesd = CreateTwiddleTable<double>(numrealtwiddles, -2.0 * kPI_double / numsamples, false);
+    }
+    else
+    {
+        twiddlesf = CreateTwiddleTable<float>(numtwiddles, -kPI_double, true);
+        realtwiddlesf = CreateTwiddleTable<float>(numrealtwiddles, -2.0 * kPI_double / numsamples, false);
+        splittwiddlesf = new float[numtwiddles * 2];
+        for (int n = 0; n < numtwiddles; n++)
+        {
+            splittwiddlesf[n] = twiddlesf[n].re;
+            splittwiddlesf[numtwiddles + n] = twiddlesf[n].im;
+        }
+    }
+}
+
+void FFTPlan::InitMixedRadix()
+{
+    // Factorize with radix 4 first since it needs the fewest operations per point, then the remaining primes in increasing order
+    int factors[32];
+    int n = numsamples;
+    while (n % 4 == 0)
+    {
+        factors[numstages++] = 4;
+        n /= 4;
+    }
+    for (int p = 2; n > 1; p++)
+    {
+        while (n % p == 0)
+        {
+            factors[numstages++] = p;
+            n /= p;
+        }
+    }
+
+    // Digit-reversal permutation: the stage of span m combines the sub-transforms of the interleaved sequences x[r + radix * j],
+    // each of which sits in a contiguous block of length m, so the input order is built up from the first stage to the last.
+    unsigned int* perm = new unsigned int[numsamples];
+    unsigned int* prev = new unsigned int[numsamples];
+    int numtwiddles = 0, span = 1;
+    perm[0] = 0;
+    stages = new int[numstages * 3];
+    for (int s = 0; s < numstages; s++)
+    {
+        int radix = factors[s];
+        memcpy(prev, perm, sizeof(unsigned int) * span);
+        for (int r = 0; r < radix; r++)
+            for (int j = 0; j < span; j++)
+                perm[r * span + j] = r + radix * prev[j];
+        stages[s * 3] = radix;
+        stages[s * 3 + 1] = span;
+        stages[s * 3 + 2] = numtwiddles;
+        numtwiddles += span * (radix - 1) + ((radix > 5) ? radix : 0);
+        span *= radix;
+    }
+
+    // Apply the permutation in place by following its cycles, where each step is a swap with the next element of the cycle
+    unsigned int* tmpswaps = new unsigned int[numsamples * 2];
+    bool* visited = new bool[numsamples];
+    memset(visited, 0, sizeof(bool) * numsamples);
+    for (unsigned int i = 0; i < (unsigned)numsamples; i++)
+    {
+        unsigned int j = i;
+        while (!visited[j] && perm[j] != i)
+        {
+            visited[j] = true;
+            tmpswaps[numswaps * 2] = j;
+            tmpswaps[numswaps * 2 + 1] = perm[j];
+            numswaps++;
+            j = perm[j];
+        }
+        visited[j] = true;
+    }
+    swaps = new unsigned int[numswaps * 2];
+    memcpy(swaps, tmpswaps, sizeof(unsigned int) * numswaps * 2);
+    delete[] tmpswaps;
+    delete[] visited;
+    delete[] perm;
+    delete[] prev;
+
+    // Per stage the twiddles exp(-2*i*pi*r*k/(radix*span)) are stored at k * (radix - 1) + r - 1, followed by the radix roots of unity for the generic butterfly
+    if (highprecision)
+        twiddlesd = new UnityComplexNumberT<double>[numtwiddles];
+    else
+        twiddlesf = new UnityComplexNumberT<float>[numtwiddles];
+    for (int s = 0; s < numstages; s++)
+    {
+        int radix = stages[s * 3], span = stages[s * 3 + 1], offset = stages[s * 3 + 2], num = 0;
+        double* angles = new double[span * (radix - 1) + radix];
+        for (int k = 0; k < span; k++)
+            for (int r = 1; r < radix; r++)
+                angles[num++] = -2.0 * kPI_double * r * k / (radix * span);
+        if (radix > 5)
+            for (int q = 0; q < radix; q++)
+                angles[num++] = -2.0 * kPI_double * q / radix;
+        for (int n = 0; n < num; n++)
+        {
+            if (highprecision)
+                twiddlesd[offset + n].Set(cos(angles[n]), sin(angles[n]));
+            else
+                twiddlesf[offset + n].Set((float)cos(angles[n]), (float)sin(angles[n]));
+        }
+        delete[] angles;
+    }
+
+    int numrealtwiddles = numsamples / 4 + 1;
+    if (highprecision)
+        realtwiddlesd = CreateTwiddleTable<double>(numrealtwiddles, -2.0 * kPI_double / numsamples, false);
+    else
+        realtwiddlesf = CreateTwiddleTable<float>(numrealtwiddles, -2.0 * kPI_double / numsamples, false);
+}
+
+FFTPlan::~FFTPlan()
+{
+    delete[] swaps;
+    delete[] stages;
+    delete[] twiddlesf;
+    delete[] twiddlesd;
+    delete[] splittwiddlesf;
+    delete[] realtwiddlesf;
+    delete[] realtwiddlesd;
+}
+
+void FFTPlan::Forward(UnityComplexNumber* data) const
+{
+    ForwardBatch(&data, 1);
+}
+
+void FFTPlan::Backward(UnityComplexNumber* data) const
+{
+    BackwardBatch(&data, 1);
+}
+
+void FFTPlan::ForwardReal(const float* input, UnityComplexNumber* spectrum) const
+{
+    ForwardRealBatch(&input, &spectrum, 1);
+}
+
+void FFTPlan::BackwardReal(UnityComplexNumber* spectrum, float* output) const
+{
+    BackwardRealBatch(&spectrum, &output, 1);
+}
+
+// Batches are split into groups that fit into the L2 cache together, since interleaving the passes of larger
+// working sets costs more in cache misses than is saved on twiddle loads.
+static const int kFFTBatchCacheSize = 128 * 1024;
+
+int FFTPlan::GetBatchGroupSize() const
+{
+    int groupsize = kFFTBatchCacheSize / (numsamples * (int)sizeof(UnityComplexNumber));
+    return (groupsize < 1) ? 1 : groupsize;
+}
+
+void FFTPlan::ForwardBatch(UnityComplexNumber* const* data, int numsignals) const
+{
+    int groupsize = GetBatchGroupSize();
+    for (int c = 0; c < numsignals; c += groupsize)
+        ProcessGroup(data + c, (numsignals - c < groupsize) ? (numsignals - c) : groupsize, true);
+}
+
+void FFTPlan::BackwardBatch(UnityComplexNumber* const* data, int numsignals) const
+{
+    int groupsize = GetBatchGroupSize();
+    for (int c = 0; c < numsignals; c += groupsize)
+        ProcessGroup(data + c, (numsignals - c < groupsize) ? (numsignals - c) : groupsize, false);
+
+    const float scale = 1.0f / (float)numsamples;
+    for (int c = 0; c < numsignals; c++)
+    {
+        UnityComplexNumber* x = data[c];
+        for (int n = 0; n < numsamples; n++)
+        {
+            x[n].re *= scale;
+            x[n].im *= scale;
+        }
+    }
+}
+
+void FFTPlan::ProcessGroup(UnityComplexNumber* const* data, int numsignals, bool forward) const
+{
+    if (stages != NULL)
+    {
+        if (highprecision)
+        {
+            if (forward)
+                FFTProcessMixedRadix<double, true, InterleavedLayout>(data, numsignals, numsamples, swaps, numswaps, stages, numstages, twiddlesd);
+            else
+                FFTProcessMixedRadix<double, false, InterleavedLayout>(data, numsignals, numsamples, swaps, numswaps, stages, numstages, twiddlesd);
+        }
+        else
+        {
+            if (forward)
+                FFTProcessMixedRadix<float, true, InterleavedLayout>(data, numsignals, numsamples, swaps, numswaps, stages, numstages, twiddlesf);
+            else
+                FFTProcessMixedRadix<float, false, InterleavedLayout>(data, numsignals, numsamples, swaps, numswaps, stages, numstages, twiddlesf);
+        }
+    }
+    else if (highprecision)
+    {
+        if (forward)
+            FFTProcess<double, true, InterleavedLayout>(data, numsignals, numsamples, swaps, numswaps, twiddlesd);
+        else
+            FFTProcess<double, false, InterleavedLayout>(data, numsignals, numsamples, swaps, numswaps, twiddlesd);
+    }
+    else
+        GetFFTKernel().process(data, numsignals, numsamples, swaps, numswaps, twiddlesf, forward);
+}
+
+void FFTPlan::ForwardRealBatch(const float* const* input, UnityComplexNumber* const* spectrum, int numsignals) const
+{
+    assert(half != NULL);
+    int halfsize = numsamples >> 1;
+    for (int c = 0; c < numsignals; c++)
+        if (input[c] != (const float*)spectrum[c])
+            memmove(spectrum[c], input[c], sizeof(float) * numsamples);
+    half->ForwardBatch(spectrum, numsignals);
+    if (highprecision)
+        RealFFTUnpack<double, InterleavedLayout>(spectrum, numsignals, halfsize, realtwiddlesd);
+    else
+        RealFFTUnpack<float, InterleavedLayout>(spectrum, numsignals, halfsize, realtwiddlesf);
+}
+
+void FFTPlan::BackwardRealBatch(UnityComplexNumber* const* spectrum, float* const* output, int numsignals) const
+{
+    assert(half != NULL);
+    int halfsize = numsamples >> 1;
+    if (highprecision)
+        RealFFTPack<double, InterleavedLayout>(spectrum, numsignals, halfsize, realtwiddlesd);
+    else
+        RealFFTPack<float, InterleavedLayout>(spectrum, numsignals, halfsize, realtwiddlesf);
+    half->BackwardBatch(spectrum, numsignals);
+    for (int c = 0; c < numsignals; c++)
+        if (output[c] != (float*)spectrum[c])
+            memmove(output[c], spectrum[c], sizeof(float) * numsamples);
+}
+
+void FFTPlan::Forward(const SplitComplex& data) const
+{
+    ForwardBatch(&data, 1);
+}
+
+void FFTPlan::Backward(const SplitComplex& data) const
+{
+    BackwardBatch(&data, 1);
+}
+
+void FFTPlan::ForwardReal(const float* input, const SplitComplex& spectrum) const
+{
+    ForwardRealBatch(&input, &spectrum, 1);
+}
+
+void FFTPlan::BackwardReal(const SplitComplex& spectrum, float* output) const
+{
+    BackwardRealBatch(&spectrum, &output, 1);
+}
+
+void FFTPlan::ForwardBatch(const SplitComplex* data, int numsignals) const
+{
+    int groupsize = GetBatchGroupSize();
+    for (int c = 0; c < numsignals; c += groupsize)
+        ProcessGroup(data + c, (numsignals - c < groupsize) ? (numsignals - c) : groupsize, true);
+}
+
+void FFTPlan::BackwardBatch(const SplitComplex* data, int numsignals) const
+{
+    int groupsize = GetBatchGroupSize();
+    for (int c = 0; c < numsignals; c += groupsize)
+        ProcessGroup(data + c, (numsignals - c < groupsize) ? (numsignals - c) : groupsize, false);
+
+    const float scale = 1.0f / (float)numsamples;
+    for (int c = 0; c < numsignals; c++)
+    {
+        float* re = data[c].re;
+        float* im = data[c].im;
+        for (int n = 0; n < numsamples; n++)
+        {
+            re[n] *= scale;
+            im[n] *= scale;
+        }
+    }
+}
+
+void FFTPlan::ProcessGroup(const SplitComplex* data, int numsignals, bool forward) const
+{
+    if (stages != NULL)
+    {
+        if (highprecision)
+        {
+            if (forward)
+                FFTProcessMixedRadix<double, true, SplitLayout>(data, numsignals, numsamples, swaps, numswaps, stages, numstages, twiddlesd);
+            else
+                FFTProcessMixedRadix<double, false, SplitLayout>(data, numsignals, numsamples, swaps, numswaps, stages, numstages, twiddlesd);
+        }
+        else
+        {
+            if (forward)
+                FFTProcessMixedRadix<float, true, SplitLayout>(data, numsignals, numsamples, swaps, numswaps, stages, numstages, twiddlesf);
+            else
+                FFTProcessMixedRadix<float, false, SplitLayout>(data, numsignals, numsamples, swaps, numswaps, stages, numstages, twiddlesf);
+        }
+    }
+    else if (highprecision)
+    {
+        if (forward)
+            FFTProcess<double, true, SplitLayout>(data, numsignals, numsamples, swaps, numswaps, twiddlesd);
+        else
+            FFTProcess<double, false, SplitLayout>(data, numsignals, numsamples, swaps, numswaps, twiddlesd);
+    }
+    else
+        GetFFTKernel().processsplit(data, numsignals, numsamples, swaps, numswaps, twiddlesf, splittwiddlesf, forward);
+}
+
+// The even samples go to the real parts and the odd samples to the imaginary parts of the half-length complex signal
+void FFTPlan::ForwardRealBatch(const float* const* input, const SplitComplex* spectrum, int numsignals) const
+{
+    assert(half != NULL);
+    int halfsize = numsamples >> 1;
+    for (int c = 0; c < numsignals; c++)
+    {
+        const float* src = input[c];
+        float* re = spectrum[c].re;
+        float* im = spectrum[c].im;
+        for (int n = 0; n < halfsize; n++)
+        {
+            re[n] = src[2 * n];
+            im[n] = src[2 * n + 1];
+        }
+    }
+    half->ForwardBatch(spectrum, numsignals);
+    if (highprecision)
+        RealFFTUnpack<double, SplitLayout>(spectrum, numsignals, halfsize, realtwiddlesd);
+    else
+        RealFFTUnpack<float, SplitLayout>(spectrum, numsignals, halfsize, realtwiddlesf);
+}
+
+void FFTPlan::BackwardRealBatch(const SplitComplex* spectrum, float* const* output, int numsignals) const
+{
+    assert(half != NULL);
+    int halfsize = numsamples >> 1;
+    if (highprecision)
+        RealFFTPack<double, SplitLayout>(spectrum, numsignals, halfsize, realtwiddlesd);
+    else
+        RealFFTPack<float, SplitLayout>(spectrum, numsignals, halfsize, realtwiddlesf);
+    half->BackwardBatch(spectrum, numsignals);
+    for (int c = 0; c < numsignals; c++)
+    {
+        const float* re = spectrum[c].re;
+        const float* im = spectrum[c].im;
+        float* dst = output[c];
+        for (int n = 0; n < halfsize; n++)
+        {
+            dst[2 * n] = re[n];
+            dst[2 * n + 1] = im[n];
+        }
+    }
+}
+
+// With z = x1 + i * x2 the spectra follow from the symmetry of real signals as X1[k] = (Z[k] + Z*[N - k]) / 2 and X2[k] = (Z[k] - Z*[N - k]) / 2i
+void FFTPlan::ForwardRealPair(const float* input1, const float* input2, const SplitComplex& spectrum1, const SplitComplex& spectrum2, const SplitComplex& scratch) const
+{
+    memcpy(scratch.re, input1, sizeof(float) * numsamples);
+    memcpy(scratch.im, input2, sizeof(float) * numsamples);
+    Forward(scratch);
+
+    const float* zre = scratch.re;
+    const float* zim = scratch.im;
+    const int numbins = GetNumBins();
+    for (int k = 0; k < numbins; k++)
+    {
+        int m = (k == 0) ? 0 : (numsamples - k);
+        float re1 = zre[k], im1 = zim[k], re2 = zre[m], im2 = zim[m];
+        spectrum1.re[k] = 0.5f * (re1 + re2);
+        spectrum1.im[k] = 0.5f * (im1 - im2);
+        spectrum2.re[k] = 0.5f * (im1 + im2);
+        spectrum2.im[k] = 0.5f * (re2 - re1);
+    }
+}
+
+// The inverse builds Z = X1 + i * X2 over all bins, using X[N - k] = X*[k] for the upper half
+void FFTPlan::BackwardRealPair(const SplitComplex& spectrum1, const SplitComplex& spectrum2, float* output1, float* output2) const
+{
+    const int numbins = GetNumBins();
+    for (int k = 0; k < numbins; k++)
+    {
+        output1[k] = spectrum1.re[k] - spectrum2.im[k];
+        output2[k] = spectrum1.im[k] + spectrum2.re[k];
+    }
+    for (int k = numbins; k < numsamples; k++)
+    {
+        int m = numsamples - k;
+        output1[k] = spectrum1.re[m] + spectrum2.im[m];
+        output2[k] = spectrum2.re[m] - spectrum1.im[m];
+    }
+
+    SplitComplex z = { output1, output2 };
+    Backward(z);
+}
+
+const char* FFTPlan::GetKernelName()
+{
+    return GetFFTKernel().name;
+}
+
+void FFT::Forward(UnityComplexNumber* data, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->Forward(data);
+}
+
+void FFT::Backward(UnityComplexNumber* data, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->Backward(data);
+}
+
+void FFT::ForwardReal(const float* input, UnityComplexNumber* spectrum, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->ForwardReal(input, spectrum);
+}
+
+void FFT::BackwardReal(UnityComplexNumber* spectrum, float* output, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->BackwardReal(spectrum, output);
+}
+
+void FFT::ForwardBatch(UnityComplexNumber* const* data, int numsignals, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->ForwardBatch(data, numsignals);
+}
+
+void FFT::BackwardBatch(UnityComplexNumber* const* data, int numsignals, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->BackwardBatch(data, numsignals);
+}
+
+void FFT::ForwardRealBatch(const float* const* input, UnityComplexNumber* const* spectrum, int numsignals, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->ForwardRealBatch(input, spectrum, numsignals);
+}
+
+void FFT::BackwardRealBatch(UnityComplexNumber* const* spectrum, float* const* output, int numsignals, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->BackwardRealBatch(spectrum, output, numsignals);
+}
+
+void FFT::Forward(const SplitComplex& data, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->Forward(data);
+}
+
+void FFT::Backward(const SplitComplex& data, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->Backward(data);
+}
+
+void FFT::ForwardReal(const float* input, const SplitComplex& spectrum, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->ForwardReal(input, spectrum);
+}
+
+void FFT::BackwardReal(const SplitComplex& spectrum, float* output, int numsamples, bool highprecision)
+{
+    FFTPlan::Get(numsamples, highprecision)->BackwardReal(spectrum, output);
+}
+
+void* AlignedAlloc(size_t size, size_t alignment)
+{
+#if PLATFORM_WIN
+    return _aligned_malloc(size, alignment);
+#else
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, (alignment < sizeof(void*)) ? sizeof(void*) : alignment, size) != 0)
+        return NULL;
+    return ptr;
+#endif
+}
+
+void AlignedFree(void* ptr)
+{
+#if PLATFORM_WIN
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+SplitComplexBuffer::SplitComplexBuffer()
+    : numelements(0)
+    , memory(NULL)
+{
+    re = NULL;
+    im = NULL;
+}
+
+SplitComplexBuffer::~SplitComplexBuffer()
+{
+    AlignedFree(memory);
+}
+
+void SplitComplexBuffer::Init(int _numelements)
+{
+    AlignedFree(memory);
+    numelements = _numelements;
+    int stride = GetSplitComplexStride(numelements);
+    memory = (float*)AlignedAlloc(sizeof(float) * stride * 2, 64);
+    re = memory;
+    im = memory + stride;
+    Clear();
+}
+
+void SplitComplexBuffer::Clear()
+{
+    if (memory != NULL)
+    {
+        memset(re, 0, sizeof(float) * numelements);
+        memset(im, 0, sizeof(float) * numelements);
+    }
+}
+
+void SplitComplexMul(const SplitComplex& a, const SplitComplex& b, const SplitComplex& result, int numelements)
+{
+    GetFFTKernel().complexmul(a, b, result, numelements);
+}
+
+void SplitComplexMulAdd(const SplitComplex& a, const SplitComplex& b, const SplitComplex& acc, int numelements)
+{
+    GetFFTKernel().complexmuladd(a, b, acc, numelements);
+}
+
+void SplitComplexMulAddBF16(const SplitComplexBF16& a, const SplitComplex& b, const SplitComplex& acc, int numelements)
+{
+    GetFFTKernel().complexmuladdbf16(a, b, acc, numelements);
+}
+
+void FloatToBF16(const float* src, UInt16* dst, int numelements)
+{
+    for (int n = 0; n < numelements; n++)
+    {
+        union { float f; UInt32 i; } u;
+        u.f = src[n];
+        dst[n] = (UInt16)((u.i + 0x7FFF + ((u.i >> 16) & 1)) >> 16);
+    }
+}
+
+void FIRMulAdd(const float* h, int numtaps, const float* x, float* y, int numsamples)
+{
+    GetFFTKernel().firmuladd(h, numtaps, x, y, numsamples);
+}
+
+float DotProduct(const float* a, const float* b, int numelements)
+{
+    return GetFFTKernel().dotproduct(a, b, numelements);
+}
+
+void FFTAnalyzer::Cleanup()
+{
+    delete[] window;
+    delete[] ibuffer;
+    delete[] obuffer;
+    delete[] ispec1;
+    delete[] ispec2;
+    delete[] ospec1;
+    delete[] ospec2;
+    delete[] cspec;
+}
+
+void FFTAnalyzer::AnalyzeInput(float* data, int numchannels, int numsamples, float decaySpeed)
+{
+    CheckInitialized();
+
+    for (int n = 0; n < spectrumSize - numsamples; n++)
+        ibuffer[n] = ibuffer[n + numsamples];
+    for (int n = 0; n < numsamples; n++)
+        ibuffer[n + spectrumSize - numsamples] = data[n * numchannels];
+    float* x = (float*)cspec;
+    for (int n = 0; n < spectrumSize; n++)
+        x[n] = ibuffer[n] * window[n];
+    plan->ForwardReal(x, cspec);
+    for (int n = 0; n < spectrumSize / 2; n++)
+    {
+        float a = cspec[n].Magnitude();
+        ispec1[n] = (a > ispec2[n]) ? a : ispec2[n] * decaySpeed;
+    }
+}
+
+void FFTAnalyzer::AnalyzeOutput(float* data, int numchannels, int numsamples, float decaySpeed)
+{
+    CheckInitialized();
+
+    for (int n = 0; n < spectrumSize - numsamples; n++)
+        obuffer[n] = obuffer[n + numsamples];
+    for (int n = 0; n < numsamples; n++)
+        obuffer[n + spectrumSize - numsamples] = data[n * numchannels];
+    float* x = (float*)cspec;
+    for (int n = 0; n < spectrumSize; n++)
+        x[n] = obuffer[n] * window[n];
+    plan->ForwardReal(x, cspec);
+    for (int n = 0; n < spectrumSize / 2; n++)
+    {
+        float a = cspec[n].Magnitude();
+        ospec1[n] = (a > ospec2[n]) ? a : ospec2[n] * decaySpeed;
+    }
+
+    float* tmp;
+    tmp = ispec1; ispec1 = ispec2; ispec2 = tmp;
+    tmp = ospec1; ospec1 = ospec2; ospec2 = tmp;
+
+    if (numSpectraReady < 2)
+        numSpectraReady++;
+}
+
+void FFTAnalyzer::CheckInitialized()
+{
+    if (window == NULL)
+    {
+        plan = FFTPlan::Get(spectrumSize, false);
+        window = new float[spectrumSize];
+        ibuffer = new float[spectrumSize];
+        obuffer = new float[spectrumSize];
+        ispec1 = new float[spectrumSize / 2];
+        ispec2 = new float[spectrumSize / 2];
+        ospec1 = new float[spectrumSize / 2];
+        ospec2 = new float[spectrumSize / 2];
+        cspec = new UnityComplexNumber[spectrumSize / 2 + 1];
+        for (int n = 0; n < spectrumSize; n++)
+            window[n] = 0.54f - 0.46f * cosf(n * (kPI / (float)spectrumSize));
+        memset(ibuffer, 0, sizeof(float) * spectrumSize);
+        memset(obuffer, 0, sizeof(float) * spectrumSize);
+        memset(ispec1, 0, sizeof(float) * (spectrumSize / 2));
+        memset(ispec2, 0, sizeof(float) * (spectrumSize / 2));
+        memset(ospec1, 0, sizeof(float) * (spectrumSize / 2));
+        memset(ospec2, 0, sizeof(float) * (spectrumSize / 2));
+        memset(cspec, 0, sizeof(UnityComplexNumber) * (spectrumSize / 2 + 1));
+    }
+}
+
+bool FFTAnalyzer::CanBeRead() const
+{
+    return numSpectraReady >= 2;
+}
+
+void FFTAnalyzer::ReadBuffer(float* buffer, int numsamples, bool readInputBuffer)
+{
+    if (!CanBeRead())
+    {
+        memset(buffer, 0, sizeof(float) * numsamples);
+        return;
+    }
+    if (numsamples > spectrumSize)
+        numsamples = spectrumSize;
+    float* buf = (readInputBuffer) ? ispec2 : ospec2;
+    float scale = (float)((spectrumSize / 2) - 2) / (float)(numsamples - 1);
+    for (int n = 0; n < numsamples; n++)
+    {
+        float f = n * scale;
+        int i = FastFloor(f);
+        buffer[n] = buf[i] + (buf[i + 1] - buf[i]) * (f - i);
+    }
+}
+
+PartitionedIR::PartitionedIR()
+    : numchannels(0)
+    , blocksize(0)
+    , length(0)
+    , numsegments(0)
+    , headlength(0)
+    , slabsize(0)
+    , segments(NULL)
+    , spectra(NULL)
+    , head(NULL)
+    , mapped(false)
+{
+}
+
+PartitionedIR::~PartitionedIR()
+{
+    Cleanup();
+}
+
+void PartitionedIR::Cleanup()
+{
+    for (int c = 0; c < numchannels && spectra != NULL && !mapped; c++)
+        AlignedFree(spectra[c]);
+    for (int c = 0; c < numchannels && head != NULL && !mapped; c++)
+        AlignedFree(head[c]);
+    delete[] spectra;
+    delete[] head;
+    delete[] segments;
+    spectra = NULL;
+    head = NULL;
+    segments = NULL;
+    numsegments = 0;
+    headlength = 0;
+    slabsize = 0;
+    mapped = false;
+}
+
+// Sets up the segments from the partition layout and the size of the slab of each channel
+void PartitionedIR::InitSegments(const Segment* layout)
+{
+    segments = new Segment[numsegments];
+    slabsize = 0;
+    for (int i = 0; i < numsegments; i++)
+    {
+        Segment& seg = segments[i];
+        seg = layout[i];
+        seg.stride = GetSplitComplexStride(seg.partitionsize + 1);
+        seg.spectraoffset = slabsize;
+        seg.plan = FFTPlan::Get(seg.partitionsize * 2, false);
+        slabsize += GetSegmentSize(seg);
+    }
+}
+
+void PartitionedIR::Init(const float* const* impulse, int _numchannels, int numsamples, int _blocksize, int maxpartitionsize, int _headlength, SpectrumFormat tailformat)
+{
+    Cleanup();
+
+    numchannels = _numchannels;
+    blocksize = _blocksize;
+    if (maxpartitionsize < blocksize)
+        maxpartitionsize = blocksize;
+    headlength = (_headlength < numsamples) ? _headlength : numsamples - 1;
+    if (headlength < 0)
+        headlength = 0;
+
+    // The output of a segment is due partitionsize - blocksize samples after its first partition of input has arrived, so each
+    // segment has to start at least that far into the response. kPartitionsPerSegment >= 2 guarantees this when the partition
+    // size is doubled, and the head allows the first segment to start with a partition size of up to headlength + blocksize.
+    Segment layout[32];
+    int offset = headlength, partitionsize = blocksize;
+    while (partitionsize * 2 <= headlength + blocksize && partitionsize * 2 <= maxpartitionsize)
+        partitionsize *= 2;
+    do
+    {
+        int remaining = numsamples - offset;
+        int numpartitions = (remaining + partitionsize - 1) / partitionsize;
+        bool last = (numpartitions <= kPartitionsPerSegment) || (partitionsize * 2 > maxpartitionsize) || (numsegments == 31);
+        Segment& seg = layout[numsegments++];
+        seg.partitionsize = partitionsize;
+        seg.numpartitions = (numpartitions < 1) ? 1 : (last ? numpartitions : kPartitionsPerSegment);
+        seg.offset = offset;
+        seg.format = (numsegments == 1) ? kFloat32 : tailformat;
+        offset += seg.numpartitions * partitionsize;
+        if (!last)
+            partitionsize *= 2;
+    }
+    while (offset < numsamples);
+    length = offset;
+    InitSegments(layout);
+
+    if (headlength > 0)
+    {
+        head = new float*[numchannels];
+        for (int c = 0; c < numchannels; c++)
+        {
+            head[c] = (float*)AlignedAlloc(sizeof(float) * headlength, 64);
+            memcpy(head[c], impulse[c], sizeof(float) * headlength);
+        }
+    }
+
+    spectra = new float*[numchannels];
+    float* block = new float[maxpartitionsize * 2];
+    SplitComplexBuffer spectrum;
+    if (tailformat != kFloat32)
+        spectrum.Init(maxpartitionsize + 1);
+    for (int c = 0; c < numchannels; c++)
+    {
+        spectra[c] = (float*)AlignedAlloc(sizeof(float) * slabsize, 64);
+        memset(spectra[c], 0, sizeof(float) * slabsize);
+        for (int i = 0; i < numsegments; i++)
+        {
+            const Segment& seg = segments[i];
+            for (int k = 0; k < seg.numpartitions; k++)
+            {
+                int start = seg.offset + k * seg.partitionsize, num = numsamples - start;
+                if (num > seg.partitionsize)
+                    num = seg.partitionsize;
+                if (num < 0)
+                    num = 0;
+                memcpy(block, impulse[c] + start, sizeof(float) * num);
+                memset(block + num, 0, sizeof(float) * (seg.partitionsize * 2 - num));
+                if (seg.format == kFloat32)
+                    seg.plan->ForwardReal(block, GetSpectrum(c, i, k));
+                else
+                {
+                    SplitComplexBF16 h = GetSpectrumBF16(c, i, k);
+                    seg.plan->ForwardReal(block, spectrum);
+                    FloatToBF16(spectrum.re, h.re, seg.partitionsize + 1);
+                    FloatToBF16(spectrum.im, h.im, seg.partitionsize + 1);
+                }
+            }
+        }
+    }
+    delete[] block;
+}
+
+PartitionedConvolver::PartitionedConvolver()
+    : ir(NULL)
+    , pool(NULL)
+    , nextinpool(NULL)
+    , numinputs(0)
+    , numoutputs(0)
+    , matrix(false)
+    , blockcount(0)
+    , historylength(0)
+    , historypos(0)
+    , outputlength(0)
+    , outputpos(0)
+    , spectralength(0)
+    , history(NULL)
+    , headinput(NULL)
+    , outputs(NULL)
+    , states(NULL)
+    , spectra(NULL)
+{
+}
+
+PartitionedConvolver::~PartitionedConvolver()
+{
+    Cleanup();
+}
+
+void PartitionedConvolver::Cleanup()
+{
+    if (pool != NULL)
+        pool->Unregister(this);
+    for (int i = 0; states != NULL && i < ir->GetNumSegments(); i++)
+    {
+        SegmentState& state = states[i];
+        for (int c = 0; c < numinputs || c < numoutputs; c++)
+            delete[] state.blocks[c];
+        delete[] state.blocks;
+        delete[] state.sums;
+        delete[] state.xviews;
+        delete[] state.yviews;
+    }
+    for (int c = 0; c < numinputs; c++)
+    {
+        delete[] history[c];
+        AlignedFree(spectra[c]);
+    }
+    for (int c = 0; c < numoutputs; c++)
+        delete[] outputs[c];
+    for (int c = 0; c < numinputs && headinput != NULL; c++)
+        delete[] headinput[c];
+    delete[] history;
+    delete[] headinput;
+    delete[] outputs;
+    delete[] states;
+    delete[] spectra;
+    history = NULL;
+    headinput = NULL;
+    outputs = NULL;
+    states = NULL;
+    spectra = NULL;
+    ir = NULL;
+    pool = NULL;
+    numinputs = 0;
+    numoutputs = 0;
+    matrix = false;
+}
+
+void PartitionedConvolver::Init(const PartitionedIR* _ir, ConvolutionThreadPool* _pool, int _numinputs)
+{
+    Cleanup();
+
+    ir = _ir;
+    matrix = (_numinputs > 0 && _numinputs != ir->GetNumChannels());
+    numinputs = matrix ? _numinputs : ir->GetNumChannels();
+    numoutputs = ir->GetNumChannels() / numinputs;
+    if (!matrix)
+        numoutputs = numinputs;
+    assert(numinputs * (matrix ? numoutputs : 1) == ir->GetNumChannels());
+    const int numblocks = (numinputs > numoutputs) ? numinputs : numoutputs;
+    int numsegments = ir->GetNumSegments();
+    const PartitionedIR::Segment& last = ir->GetSegment(numsegments - 1);
+    int maxpartitionsize = last.partitionsize;
+
+    // The output of the last segment reaches furthest ahead, see TransformSegment. Segments processed by the thread pool keep
+    // reading their input from history for up to one more partition, during which it must not be overwritten.
+    historylength = maxpartitionsize * ((_pool != NULL) ? 4 : 2);
+    // Rounded up to whole blocks, since a head can move the segments off the block grid
+    outputlength = ((last.offset + ir->GetBlockSize() - 1) / ir->GetBlockSize() + 1) * ir->GetBlockSize();
+
+    history = new float*[numinputs];
+    outputs = new float*[numoutputs];
+    for (int c = 0; c < numinputs; c++)
+        history[c] = new float[historylength];
+    for (int c = 0; c < numoutputs; c++)
+        outputs[c] = new float[outputlength];
+    if (ir->GetHeadLength() > 0)
+    {
+        headinput = new float*[numinputs];
+        for (int c = 0; c < numinputs; c++)
+            headinput[c] = new float[ir->GetHeadLength() - 1 + ir->GetBlockSize()];
+    }
+
+    states = new SegmentState[numsegments];
+    spectralength = 0;
+    for (int i = 0; i < numsegments; i++)
+    {
+        const PartitionedIR::Segment& seg = ir->GetSegment(i);
+        SegmentState& state = states[i];
+        state.spectraoffset = spectralength;
+        spectralength += 2 * seg.numpartitions * 2 * seg.stride;
+
+        // every segment has its own scratch buffers, so that segments can be processed concurrently
+        state.blocks = new float*[numblocks];
+        state.sums = new SplitComplexBuffer[numoutputs];
+        state.xviews = new SplitComplex[numinputs];
+        state.yviews = new SplitComplex[numoutputs];
+        for (int c = 0; c < numblocks; c++)
+            state.blocks[c] = new float[seg.partitionsize * 2];
+        for (int c = 0; c < numoutputs; c++)
+        {
+            state.sums[c].Init(seg.partitionsize + 1);
+            state.yviews[c] = state.sums[c];
+        }
+    }
+    spectra = new float*[numinputs];
+    for (int c = 0; c < numinputs; c++)
+        spectra[c] = (float*)AlignedAlloc(sizeof(float) * spectralength, 64);
+
+    Reset();
+
+    if (_pool != NULL && numsegments > 1)
+    {
+        pool = _pool;
+        pool->Register(this);
+    }
+}
+
+void PartitionedConvolver::Reset()
+{
+    // withdraw queued segments and wait for those the workers already picked up, so nothing writes to the buffers below
+    for (int i = 1; pool != NULL && i < ir->GetNumSegments(); i++)
+    {
+        AtomicCompareExchangeInt(&states[i].job, kQueued, kIdle);
+        while (AtomicLoadInt(&states[i].job) == kRunning)
+            Thread::YieldTimeSlice();
+    }
+
+    blockcount = 0;
+    historypos = 0;
+    outputpos = 0;
+    for (int c = 0; c < numinputs; c++)
+    {
+        memset(history[c], 0, sizeof(float) * historylength);
+        memset(spectra[c], 0, sizeof(float) * spectralength);
+        if (headinput != NULL)
+            memset(headinput[c], 0, sizeof(float) * (ir->GetHeadLength() - 1 + ir->GetBlockSize()));
+    }
+    for (int c = 0; c < numoutputs; c++)
+        memset(outputs[c], 0, sizeof(float) * outputlength);
+    for (int i = 0; i < ir->GetNumSegments(); i++)
+    {
+        states[i].index = 0;
+        states[i].countdown = 0;
+        states[i].job = kIdle;
+    }
+}
+
+void PartitionedConvolver::Process(const float* const* input, float* const* output)
+{
+    const int blocksize = ir->GetBlockSize(), headlength = ir->GetHeadLength();
+
+    // The history length is a multiple of the block size, so blocks never wrap around
+    for (int c = 0; c < numinputs; c++)
+        memcpy(history[c] + historypos, input[c], sizeof(float) * blocksize);
+    for (int c = 0; c < numinputs && headinput != NULL; c++)
+        memcpy(headinput[c] + headlength - 1, input[c], sizeof(float) * blocksize);
+    historypos += blocksize;
+    if (historypos == historylength)
+        historypos = 0;
+
+    ++blockcount;
+    bool queued = false;
+    for (int i = 0; i < ir->GetNumSegments(); i++)
+    {
+        const PartitionedIR::Segment& seg = ir->GetSegment(i);
+        SegmentState& state = states[i];
+
+        // a result of the thread pool is due, at the latest when the segment is processed again
+        if (state.countdown > 0 && --state.countdown == 0)
+            FinishSegment(i);
+
+        int blocksperpartition = seg.partitionsize / blocksize;
+        if (blockcount % blocksperpartition != 0)
+            continue;
+
+        // The last partitionsize samples of the overlap-save result are the output of the segment for the partition of input that
+        // just completed. Delayed by the offset of the segment, their position relative to the start of the current output block is
+        // blocksize + offset - partitionsize, which is never negative given the layout of PartitionedIR.
+        state.historyend = historypos;
+        state.outputoffset = outputpos + blocksize + seg.offset - seg.partitionsize;
+        if (state.outputoffset >= outputlength)
+            state.outputoffset -= outputlength;
+
+        if (pool != NULL && i > 0)
+        {
+            // The result is needed (offset - partitionsize) / blocksize + 1 blocks from now, which is at least 3 for all but the first
+            // segment, but has to be collected before the segment is processed again
+            int deadline = (seg.offset - seg.partitionsize) / blocksize + 1;
+            state.countdown = (deadline < blocksperpartition) ? deadline : blocksperpartition;
+            AtomicStoreInt(&state.job, kQueued);
+            queued = true;
+        }
+        else
+        {
+            TransformSegment(i);
+            AccumulateSegment(i);
+        }
+    }
+    if (blockcount == historylength / blocksize)
+        blockcount = 0;
+
+    if (queued)
+        pool->Wake();
+
+    for (int c = 0; c < numoutputs; c++)
+    {
+        memcpy(output[c], outputs[c] + outputpos, sizeof(float) * blocksize);
+        memset(outputs[c] + outputpos, 0, sizeof(float) * blocksize);
+    }
+    for (int c = 0; c < numoutputs && headinput != NULL; c++)
+    {
+        for (int i = matrix ? 0 : c; i < (matrix ? numinputs : (c + 1)); i++)
+            FIRMulAdd(ir->GetHead(GetPath(i, c)), headlength, headinput[i] + headlength - 1, output[c], blocksize);
+    }
+    for (int c = 0; c < numinputs && headinput != NULL; c++)
+        memmove(headinput[c], headinput[c] + blocksize, sizeof(float) * (headlength - 1));
+    outputpos += blocksize;
+    if (outputpos == outputlength)
+        outputpos = 0;
+}
+
+// Overlap-save with the 2 * partitionsize input samples before historyend. Leaves the output of the segment in the second half of blocks.
+void PartitionedConvolver::TransformSegment(int index)
+{
+    const PartitionedIR::Segment& seg = ir->GetSegment(index);
+    SegmentState& state = states[index];
+    const int partitionsize = seg.partitionsize, fftsize = partitionsize * 2, numbins = partitionsize + 1;
+    const int spectrumsize = 2 * seg.stride, mirror = seg.numpartitions * spectrumsize;
+
+    int start = state.historyend - fftsize;
+    if (start < 0)
+        start += historylength;
+    int tail = historylength - start;
+    if (tail > fftsize)
+        tail = fftsize;
+    for (int c = 0; c < numinputs; c++)
+    {
+        memcpy(state.blocks[c], history[c] + start, sizeof(float) * tail);
+        memcpy(state.blocks[c] + tail, history[c], sizeof(float) * (fftsize - tail));
+        float* x = spectra[c] + state.spectraoffset + state.index * spectrumsize;
+        state.xviews[c].re = x;
+        state.xviews[c].im = x + seg.stride;
+    }
+
+    seg.plan->ForwardRealBatch(state.blocks, state.xviews, numinputs);
+
+    for (int c = 0; c < numinputs; c++)
+    {
+        float* x = spectra[c] + state.spectraoffset + state.index * spectrumsize;
+        memcpy(x + mirror, x, sizeof(float) * spectrumsize);
+    }
+
+    // In matrix mode every output sums the paths from all inputs, which reuse the spectra of the inputs transformed above
+    for (int c = 0; c < numoutputs; c++)
+    {
+        SplitComplexBuffer& y = state.sums[c];
+        memset(y.re, 0, sizeof(float) * numbins);
+        memset(y.im, 0, sizeof(float) * numbins);
+        for (int i = matrix ? 0 : c; i < (matrix ? numinputs : (c + 1)); i++)
+        {
+            const int path = GetPath(i, c);
+            float* x = spectra[i] + state.spectraoffset + state.index * spectrumsize;
+            for (int k = 0; k < seg.numpartitions; k++)
+            {
+                const SplitComplex xk = { x, x + seg.stride };
+                if (seg.format == PartitionedIR::kBFloat16)
+                    SplitComplexMulAddBF16(ir->GetSpectrumBF16(path, index, k), xk, y, numbins);
+                else
+                    SplitComplexMulAdd(ir->GetSpectrum(path, index, k), xk, y, numbins);
+                x += spectrumsize;
+            }
+        }
+    }
+
+    seg.plan->BackwardRealBatch(state.yviews, state.blocks, numoutputs);
+
+    if (--state.index < 0)
+        state.index = seg.numpartitions - 1;
+}
+
+void PartitionedConvolver::AccumulateSegment(int index)
+{
+    const int partitionsize = ir->GetSegment(index).partitionsize;
+    const SegmentState& state = states[index];
+    for (int c = 0; c < numoutputs; c++)
+    {
+        const float* src = state.blocks[c] + partitionsize;
+        float* dst = outputs[c];
+        int p = state.outputoffset;
+        for (int n = 0; n < partitionsize; n++)
+        {
+            dst[p] += src[n];
+            if (++p == outputlength)
+                p = 0;
+        }
+    }
+}
+
+// Collects a segment queued for the thread pool. If no worker has picked it up yet, it is processed right here instead.
+void PartitionedConvolver::FinishSegment(int index)
+{
+    SegmentState& state = states[index];
+    if (AtomicCompareExchangeInt(&state.job, kQueued, kRunning))
+        TransformSegment(index);
+    else
+        while (AtomicLoadInt(&state.job) != kDone)
+            Thread::YieldTimeSlice();
+    AccumulateSegment(index);
+    AtomicStoreInt(&state.job, kIdle);
+}
+
+// Called by the thread pool with its lock held. Returns the index of a queued segment which is now owned by the caller, or -1.
+int PartitionedConvolver::ClaimQueuedSegment()
+{
+    for (int i = 1; i < ir->GetNumSegments(); i++)
+        if (AtomicCompareExchangeInt(&states[i].job, kQueued, kRunning))
+            return i;
+    return -1;
+}
+
+ConvolutionThreadPool::ConvolutionThreadPool()
+    : convolvers(NULL)
+    , numthreads(0)
+    , workers(NULL)
+    , quit(false)
+{
+}
+
+ConvolutionThreadPool::~ConvolutionThreadPool()
+{
+    Cleanup();
+}
+
+void ConvolutionThreadPool::Cleanup()
+{
+    quit = true;
+    for (int i = 0; i < numthreads; i++)
+    {
+        workers[i].wakeup.Signal();
+        workers[i].thread.Join();
+    }
+    delete[] workers;
+    workers = NULL;
+    numthreads = 0;
+    quit = false;
+}
+
+void ConvolutionThreadPool::Init(int _numthreads)
+{
+    Cleanup();
+    numthreads = _numthreads;
+    workers = new Worker[numthreads];
+    for (int i = 0; i < numthreads; i++)
+    {
+        workers[i].pool = this;
+        workers[i].thread.Start(WorkerThread, &workers[i]);
+    }
+}
+
+void ConvolutionThreadPool::WorkerThread(void* arg)
+{
+    Worker* worker = (Worker*)arg;
+    ConvolutionThreadPool* pool = worker->pool;
+    while (true)
+    {
+        worker->wakeup.Wait();
+        if (pool->quit)
+            break;
+        while (pool->RunQueuedSegment())
+            ;
+    }
+}
+
+bool ConvolutionThreadPool::RunQueuedSegment()
+{
+    PartitionedConvolver* convolver = NULL;
+    int index = -1;
+    {
+        MutexScopeLock mutexScope(mutex);
+        for (convolver = convolvers; convolver != NULL; convolver = convolver->nextinpool)
+        {
+            index = convolver->ClaimQueuedSegment();
+            if (index >= 0)
+                break;
+        }
+    }
+    if (convolver == NULL)
+        return false;
+
+    // The convolver cannot be unregistered until the segment is marked as done, see Unregister
+    convolver->TransformSegment(index);
+    AtomicStoreInt(&convolver->states[index].job, PartitionedConvolver::kDone);
+    return true;
+}
+
+void ConvolutionThreadPool::Register(PartitionedConvolver* convolver)
+{
+    MutexScopeLock mutexScope(mutex);
+    convolver->nextinpool = convolvers;
+    convolvers = convolver;
+}
+
+void ConvolutionThreadPool::Unregister(PartitionedConvolver* convolver)
+{
+    {
+        MutexScopeLock mutexScope(mutex);
+        PartitionedConvolver** link = &convolvers;
+        while (*link != NULL && *link != convolver)
+            link = &(*link)->nextinpool;
+        if (*link != NULL)
+            *link = convolver->nextinpool;
+        convolver->nextinpool = NULL;
+    }
+
+    // wait for workers that claimed a segment before the convolver was removed
+    for (int i = 1; i < convolver->ir->GetNumSegments(); i++)
+        while (AtomicLoadInt(&convolver->states[i].job) == PartitionedConvolver::kRunning)
+            Thread::YieldTimeSlice();
+}
+
+void ConvolutionThreadPool::Wake()
+{
+    for (int i = 0; i < numthreads; i++)
+        workers[i].wakeup.Signal();
+}
+
+MappedFile::MappedFile()
+    : data(NULL)
+    , size(0)
+{
+#if PLATFORM_WIN
+    file = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const char* filename)
+{
+    Close();
+#if PLATFORM_WIN
+#if PLATFORM_WINRT
+    wchar_t widename[1024];
+    if (MultiByteToWideChar(CP_UTF8, 0, filename, -1, widename, 1024) == 0)
+        return false;
+    file = CreateFile2(widename, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, NULL);
+#else
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+#endif
+    LARGE_INTEGER filesize;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &filesize) || filesize.QuadPart <= 0 || (UInt64)filesize.QuadPart > (size_t)-1)
+    {
+        Close();
+        return false;
+    }
+#if PLATFORM_WINRT
+    mapping = CreateFileMappingFromApp(file, NULL, PAGE_READONLY, 0, NULL);
+    data = (mapping != NULL) ? MapViewOfFileFromApp(mapping, FILE_MAP_READ, 0, 0) : NULL;
+#else
+    mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    data = (mapping != NULL) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+#endif
+    if (data == NULL)
+    {
+        Close();
+        return false;
+    }
+    size = (size_t)filesize.QuadPart;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+    if (p == MAP_FAILED)
+        return false;
+    data = p;
+    size = (size_t)info.st_size;
+#endif
+    return true;
+}
+
+void MappedFile::Close()
+{
+#if PLATFORM_WIN
+    if (data != NULL)
+        UnmapViewOfFile(data);
+    if (mapping != NULL)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+#else
+    if (data != NULL)
+        munmap((void*)data, size);
+#endif
+    data = NULL;
+    size = 0;
+}
+
+IRLibrary::IRLibrary()
+    : entries(NULL)
+    , numentries(0)
+{
+}
+
+IRLibrary::~IRLibrary()
+{
+    Close();
+}
+
+void IRLibrary::Close()
+{
+    file.Close();
+    entries = NULL;
+    numentries = 0;
+}
+
+// Converts the segment table of an entry, returning false if it does not describe a layout that PartitionedIR could have made
+bool IRLibrary::ReadSegments(const FileEntry& entry, const FileSegment* filesegments, PartitionedIR::Segment* layout)
+{
+    UInt64 offset = entry.headlength;
+    for (UInt32 i = 0; i < entry.numsegments; i++)
+    {
+        // the partitions of a segment can't reach past the end of the response, which also keeps the sums below from wrapping around
+        const FileSegment& fs = filesegments[i];
+        if (fs.partitionsize < entry.blocksize || fs.partitionsize % entry.blocksize != 0 || fs.partitionsize > (1 << 24) || fs.numpartitions == 0 ||
+            fs.offset != offset || fs.offset >= entry.length || fs.numpartitions > (entry.length - fs.offset) / fs.partitionsize ||
+            (UInt64)fs.offset + entry.blocksize < fs.partitionsize || (int)fs.stride != GetSplitComplexStride(fs.partitionsize + 1) ||
+            !FFTPlan::IsSupportedSize(fs.partitionsize * 2) || fs.format > PartitionedIR::kBFloat16)
+            return false;
+        layout[i].partitionsize = fs.partitionsize;
+        layout[i].numpartitions = fs.numpartitions;
+        layout[i].offset = fs.offset;
+        layout[i].format = (PartitionedIR::SpectrumFormat)fs.format;
+        layout[i].stride = fs.stride;
+        offset += (UInt64)fs.numpartitions * fs.partitionsize;
+    }
+    return offset == entry.length;
+}
+
+bool IRLibrary::Open(const char* filename)
+{
+    Close();
+    if (!file.Open(filename))
+        return false;
+
+    // Everything is checked up front, so that GetEntry can't fail later on
+    const char* base = (const char*)file.GetData();
+    const size_t filesize = file.GetSize();
+    const FileHeader* header = (const FileHeader*)base;
+    bool valid =
+        filesize >= sizeof(FileHeader) &&
+        memcmp(header->magic, "NAPIRLIB", 8) == 0 &&
+        header->version == kVersion &&
+        header->numentries <= (filesize - sizeof(FileHeader)) / sizeof(FileEntry);
+    const FileEntry* fileentries = (const FileEntry*)(base + sizeof(FileHeader));
+    for (UInt32 i = 0; valid && i < header->numentries; i++)
+    {
+        const FileEntry& entry = fileentries[i];
+        valid =
+            entry.name[kMaxNameLength] == 0 &&
+            entry.numchannels > 0 && entry.numchannels <= 64 &&
+            entry.blocksize > 0 && entry.numsegments > 0 && entry.numsegments <= 32 &&
+            entry.headlength < entry.length &&
+            entry.offset % 64 == 0 && entry.offset <= filesize &&
+            GetSegmentTableSize(entry.numsegments) <= filesize - entry.offset;
+        PartitionedIR::Segment layout[32];
+        if (!valid || !ReadSegments(entry, (const FileSegment*)(base + entry.offset), layout))
+        {
+            valid = false;
+            break;
+        }
+        UInt64 slabsize = 0;
+        for (UInt32 k = 0; k < entry.numsegments; k++)
+            slabsize += (UInt64)layout[k].numpartitions * ((layout[k].format == PartitionedIR::kBFloat16) ? 1 : 2) * layout[k].stride; // see PartitionedIR::GetSegmentSize
+        UInt64 datasize = GetSegmentTableSize(entry.numsegments) + entry.numchannels * sizeof(float) * (slabsize + GetHeadSize(entry.headlength));
+        valid = (datasize <= filesize - entry.offset);
+    }
+    if (!valid)
+    {
+        Close();
+        return false;
+    }
+
+    entries = fileentries;
+    numentries = header->numentries;
+    return true;
+}
+
+const char* IRLibrary::GetName(int index) const
+{
+    return entries[index].name;
+}
+
+int IRLibrary::Find(const char* name, int blocksize, int samplerate, int numchannels) const
+{
+    for (int i = 0; i < numentries; i++)
+    {
+        const FileEntry& entry = entries[i];
+        if ((int)entry.blocksize == blocksize && (int)entry.samplerate == samplerate && (int)entry.numchannels == numchannels && strcmp(entry.name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void IRLibrary::GetEntry(int index, PartitionedIR& ir) const
+{
+    const FileEntry& entry = entries[index];
+    const char* data = (const char*)file.GetData() + entry.offset;
+    PartitionedIR::Segment layout[32];
+    ReadSegments(entry, (const FileSegment*)data, layout);
+
+    ir.Cleanup();
+    ir.numchannels = entry.numchannels;
+    ir.blocksize = entry.blocksize;
+    ir.length = entry.length;
+    ir.headlength = entry.headlength;
+    ir.numsegments = entry.numsegments;
+    ir.mapped = true;
+    ir.InitSegments(layout);
+    const int slabsize = ir.GetSlabSize();
+
+    float* spectra = (float*)(data + GetSegmentTableSize(entry.numsegments));
+    ir.spectra = new float*[ir.numchannels];
+    ir.head = (ir.headlength > 0) ? new float*[ir.numchannels] : NULL;
+    for (int c = 0; c < ir.numchannels; c++)
+    {
+        ir.spectra[c] = spectra;
+        if (ir.head != NULL)
+            ir.head[c] = spectra + slabsize;
+        spectra += slabsize + GetHeadSize(ir.headlength);
+    }
+}
+
+bool IRLibrary::Write(const char* filename, const Entry* entries, int numentries)
+{
+    FILE* f = fopen(filename, "wb");
+    if (f == NULL)
+        return false;
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "NAPIRLIB", 8);
+    header.version = kVersion;
+    header.numentries = numentries;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+    UInt64 offset = (sizeof(FileHeader) + numentries * sizeof(FileEntry) + 63) & ~(UInt64)63;
+    for (int i = 0; i < numentries; i++)
+    {
+        const PartitionedIR& ir = *entries[i].ir;
+        FileEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.name, entries[i].name, kMaxNameLength);
+        entry.samplerate = entries[i].samplerate;
+        entry.blocksize = ir.GetBlockSize();
+        entry.numchannels = ir.GetNumChannels();
+        entry.length = ir.GetLength();
+        entry.headlength = ir.GetHeadLength();
+        entry.numsegments = ir.GetNumSegments();
+        entry.offset = offset;
+        ok = ok && fwrite(&entry, sizeof(entry), 1, f) == 1;
+        offset += GetSegmentTableSize(entry.numsegments) + entry.numchannels * sizeof(float) * (ir.GetSlabSize() + GetHeadSize(entry.headlength));
+    }
+
+    static const char padding[64] = { 0 };
+    for (int i = 0; ok && i < numentries; i++)
+    {
+        const PartitionedIR& ir = *entries[i].ir;
+        ok = fseek(f, 0, SEEK_END) == 0;
+        long pos = ftell(f);
+        ok = ok && fwrite(padding, (size_t)((64 - pos % 64) % 64), 1, f) <= 1;
+        for (int k = 0; ok && k < ir.GetNumSegments(); k++)
+        {
+            const PartitionedIR::Segment& seg = ir.GetSegment(k);
+            FileSegment fs;
+            fs.partitionsize = seg.partitionsize;
+            fs.numpartitions = seg.numpartitions;
+            fs.offset = seg.offset;
+            fs.stride = seg.stride;
+            fs.format = seg.format;
+            ok = fwrite(&fs, sizeof(fs), 1, f) == 1;
+        }
+        size_t tablepadding = GetSegmentTableSize(ir.GetNumSegments()) - ir.GetNumSegments() * sizeof(FileSegment);
+        ok = ok && (tablepadding == 0 || fwrite(padding, tablepadding, 1, f) == 1);
+        int slabsize = ir.GetSlabSize(), headsize = GetHeadSize(ir.GetHeadLength());
+        for (int c = 0; ok && c < ir.GetNumChannels(); c++)
+        {
+            ok = fwrite(ir.GetSpectra(c, 0), sizeof(float) * slabsize, 1, f) == 1;
+            if (ok && headsize > 0)
+            {
+                ok = fwrite(ir.GetHead(c), sizeof(float) * ir.GetHeadLength(), 1, f) == 1;
+                ok = ok && (headsize == ir.GetHeadLength() || fwrite(padding, sizeof(float) * (headsize - ir.GetHeadLength()), 1, f) == 1);
+            }
+        }
+    }
+
+    return (fclose(f) == 0) && ok;
+}
+
+class ResamplerRegistry
+{
+public:
+    ~ResamplerRegistry()
+    {
+        Resampler* resampler = head;
+        while (resampler != NULL)
+        {
+            Resampler* next = resampler->next;
+            delete resampler;
+            resampler = next;
+        }
+    }
+
+    const Resampler* Find(int inrate, int outrate)
+    {
+        for (const Resampler* resampler = AtomicLoadPointer(&head); resampler != NULL; resampler = resampler->next)
+            if (resampler->inrate == inrate && resampler->outrate == outrate)
+                return resampler;
+        return NULL;
+    }
+
+    const Resampler* Get(int inrate, int outrate)
+    {
+        // Same as FFTPlanRegistry, converters are never removed while the library is loaded
+        const Resampler* resampler = Find(inrate, outrate);
+        if (resampler != NULL)
+            return resampler;
+
+        MutexScopeLock lock(mutex);
+        resampler = Find(inrate, outrate);
+        if (resampler == NULL)
+        {
+            Resampler* newresampler = new Resampler(inrate, outrate);
+            newresampler->next = head;
+            AtomicStorePointer(&head, newresampler);
+            resampler = newresampler;
+        }
+        return resampler;
+    }
+
+    static ResamplerRegistry& Instance()
+    {
+        static ResamplerRegistry registry;
+        return registry;
+    }
+
+protected:
+    ResamplerRegistry() : head(NULL) {}
+
+protected:
+    Mutex mutex;
+    Resampler* volatile head;
+};
+
+const Resampler* Resampler::Get(int inrate, int outrate)
+{
+    return ResamplerRegistry::Instance().Get(inrate, outrate);
+}
+
+// Zeroth order modified Bessel function of the first kind for the Kaiser window
+static double BesselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 50 && term > sum * 1.0e-12; k++)
+    {
+        term *= (0.5 * x / k) * (0.5 * x / k);
+        sum += term;
+    }
+    return sum;
+}
+
+Resampler::Resampler(int inrate, int outrate)
+    : inrate(inrate)
+    , outrate(outrate)
+    , next(NULL)
+{
+    assert(inrate > 0 && outrate > 0);
+
+    int a = inrate, b = outrate;
+    while (b != 0)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    upfactor = outrate / a;
+    downfactor = inrate / a;
+    numphases = (upfactor <= kMaxPhases) ? upfactor : kMaxPhases;
+
+    // When the rate goes down, the filter has to cut off relative to the output rate, so it gets proportionally longer in input samples.
+    // The cutoff is placed such that the transition band of the window ends at the Nyquist frequency of the lower rate.
+    const double beta = 8.0, attenuation = 80.0;
+    const double scale = (outrate < inrate) ? (double)outrate / (double)inrate : 1.0;
+    numtaps = ((int)ceil(kNumTaps / scale) + 7) & ~7;
+    const double transition = (attenuation - 7.95) / (14.36 * numtaps * scale);
+    const double cutoff = (0.5 - 0.5 * transition) * scale; // In cycles per input sample
+    const double halflength = 0.5 * numtaps, norm = 1.0 / BesselI0(beta);
+
+    filters = (float*)AlignedAlloc(sizeof(float) * numtaps * (numphases + 1), 64);
+    for (int p = 0; p <= numphases; p++)
+    {
+        // Tap j is applied to the input sample at j - (numtaps / 2 - 1) relative to the one before the output position
+        float* h = filters + p * numtaps;
+        double sum = 0.0;
+        for (int j = 0; j < numtaps; j++)
+        {
+            double d = (j - (halflength - 1.0)) - (double)p / numphases;
+            double x = 2.0 * kPI * cutoff * d, r = d / halflength;
+            double sinc = (fabs(x) < 1.0e-9) ? 1.0 : (sin(x) / x);
+            double window = (fabs(r) < 1.0) ? BesselI0(beta * sqrt(1.0 - r * r)) * norm : 0.0;
+            double c = 2.0 * cutoff * sinc * window;
+            h[j] = (float)c;
+            sum += c;
+        }
+
+        // Unity gain at DC for every phase, otherwise the fractional position modulates a DC offset
+        for (int j = 0; j < numtaps; j++)
+            h[j] = (float)(h[j] / sum);
+    }
+}
+
+Resampler::~Resampler()
+{
+    AlignedFree(filters);
+}
+
+int Resampler::GetOutputLength(int numinput) const
+{
+    return (int)(((UInt64)numinput * upfactor + downfactor - 1) / downfactor);
+}
+
+void Resampler::Process(const float* input, int numinput, int inputstride, float* output, int numoutput, int outputstride) const
+{
+    // The input is copied with numtaps zeros before and after it, so the filter never needs to check the bounds
+    float* padded = new float[numinput + 2 * numtaps];
+    memset(padded, 0, sizeof(float) * numtaps);
+    for (int n = 0; n < numinput; n++)
+        padded[numtaps + n] = input[n * inputstride];
+    memset(padded + numtaps + numinput, 0, sizeof(float) * numtaps);
+
+    const int start = numtaps - (numtaps / 2 - 1);
+    const double phasescale = (double)numphases / (double)upfactor;
+    UInt64 pos = 0; // Output position times downfactor
+    for (int n = 0; n < numoutput; n++, pos += downfactor)
+    {
+        UInt64 ipos = pos / upfactor;
+        int frac = (int)(pos - ipos * upfactor);
+        float y = 0.0f;
+        if (ipos < (UInt64)numinput + numtaps / 2)
+        {
+            const float* x = padded + start + ipos;
+            if (numphases == upfactor)
+                y = DotProduct(filters + frac * numtaps, x, numtaps);
+            else
+            {
+                double f = frac * phasescale;
+                int p = (int)f;
+                float w = (float)(f - p);
+                float y0 = DotProduct(filters + p * numtaps, x, numtaps);
+                y = (w > 0.0f) ? (y0 + (DotProduct(filters + (p + 1) * numtaps, x, numtaps) - y0) * w) : y0;
+            }
+        }
+        output[n * outputstride] = y;
+    }
+
+    delete[] padded;
+}
+
+SampleUpload::SampleUpload()
+    : data(NULL)
+    , numsamples(0)
+    , numchannels(0)
+    , samplerate(0)
+    , filled(0)
+    , active(false)
+{
+    name[0] = 0;
+}
+
+SampleUpload::~SampleUpload()
+{
+    delete[] data;
+}
+
+bool SampleUpload::Begin(int _numsamples, int _numchannels, int _samplerate, const char* _name)
+{
+    delete[] data;
+    data = NULL;
+    active = false;
+    if (_numsamples < 0 || _numchannels <= 0 || _numchannels > 8)
+        return false;
+
+    numsamples = _numsamples;
+    numchannels = _numchannels;
+    samplerate = _samplerate;
+    filled = 0;
+    strncpy(name, (_name != NULL) ? _name : "", sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    if (numsamples > 0)
+        data = new float[(size_t)numsamples * numchannels];
+    active = true;
+    return true;
+}
+
+bool SampleUpload::Append(const float* src, int num)
+{
+    if (!active || num < 0 || num > numsamples - filled)
+        return false;
+    if (num > 0)
+        memcpy(data + (size_t)filled * numchannels, src, sizeof(float) * num * numchannels);
+    filled += num;
+    return true;
+}
+
+float* SampleUpload::Detach()
+{
+    float* result = data;
+    data = NULL;
+    active = false;
+    return result;
+}
+
+HistoryBuffer::HistoryBuffer()
+    : length(0)
+    , writeindex(0)
+    , data(NULL)
+{
+}
+
+HistoryBuffer::~HistoryBuffer()
+{
+    delete[] data;
+}
+
+void HistoryBuffer::Init(int _length)
+{
+    length = _length;
+    data = new float[length];
+    memset(data, 0, sizeof(float) * length);
+}
+
+void HistoryBuffer::ReadBuffer(float* buffer, int numsamplesTarget, int numsamplesSource, float offset)
+{
+    numsamplesTarget--; // reserve last sample for count of how much we were able to read
+    float speed = (float)numsamplesSource / (float)numsamplesTarget;
+    int n, w = writeindex; // since ReadBuffer is called from the GUI thread, writeindex may be modified by the DSP thread simultaneously
+    float p = offset;
+    for (n = 0; n < numsamplesTarget; n++)
+    {
+        float f = w - p;
+        if (f < 0.0f)
+            f += length;
+        int i = FastFloor(f);
+        float s1 = data[(i == 0) ? (length - 1) : (i - 1)];
+        float s2 = data[i];
+        buffer[numsamplesTarget - 1 - n] = s1 + (s2 - s1) * (f - i);
+        p += speed;
+        if (p >= length)
+            break;
+    }
+    buffer[numsamplesTarget] = (float)n; // how many samples were written
+}
+
+Mutex::Mutex()
+{
+#if PLATFORM_WIN
+#if PLATFORM_WINRT
+    BOOL const result = InitializeCriticalSectionEx(&crit_sec, 0, CRITICAL_SECTION_NO_DEBUG_INFO);
+    assert(FALSE != result);
+#else
+    InitializeCriticalSection(&crit_sec);
+#endif
+#else
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+#endif
+}
+
+Mutex::~Mutex()
+{
+#if PLATFORM_WIN
+    DeleteCriticalSection(&crit_sec);
+#else
+    pthread_mutex_destroy(&mutex);
+#endif
+}
+
+bool Mutex::TryLock()
+{
+#if PLATFORM_WIN
+    return TryEnterCriticalSection(&crit_sec) != 0;
+#else
+    return pthread_mutex_trylock(&mutex) == 0;
+#endif
+}
+
+void Mutex::Lock()
+{
+#if PLATFORM_WIN
+    EnterCriticalSection(&crit_sec);
+#else
+    pthread_mutex_lock(&mutex);
+#endif
+}
+
+void Mutex::Unlock()
+{
+#if PLATFORM_WIN
+    LeaveCriticalSection(&crit_sec);
+#else
+    pthread_mutex_unlock(&mutex);
+#endif
+}
+
+Event::Event()
+{
+#if PLATFORM_WIN
+#if PLATFORM_WINRT
+    handle = CreateEventEx(NULL, NULL, 0, EVENT_ALL_ACCESS);
+#else
+    handle = CreateEvent(NULL, FALSE, FALSE, NULL);
+#endif
+    assert(handle != NULL);
+#else
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+    signaled = false;
+#endif
+}
+
+Event::~Event()
+{
+#if PLATFORM_WIN
+    CloseHandle(handle);
+#else
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+#endif
+}
+
+void Event::Signal()
+{
+#if PLATFORM_WIN
+    SetEvent(handle);
+#else
+    pthread_mutex_lock(&mutex);
+    signaled = true;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+#endif
+}
+
+void Event::Wait()
+{
+#if PLATFORM_WIN
+    WaitForSingleObjectEx(handle, INFINITE, FALSE);
+#else
+    pthread_mutex_lock(&mutex);
+    while (!signaled)
+        pthread_cond_wait(&cond, &mutex);
+    signaled = false;
+    pthread_mutex_unlock(&mutex);
+#endif
+}
+
+Thread::Thread()
+    : func(NULL)
+    , arg(NULL)
+    , running(false)
+{
+}
+
+Thread::~Thread()
+{
+    Join();
+}
+
+#if PLATFORM_WIN
+DWORD WINAPI Thread::Run(LPVOID arg)
+{
+    Thread* thread = (Thread*)arg;
+    thread->func(thread->arg);
+    return 0;
+}
+#else
+void* Thread::Run(void* arg)
+{
+    Thread* thread = (Thread*)arg;
+    thread->func(thread->arg);
+    return NULL;
+}
+#endif
+
+void Thread::Start(ThreadFunc _func, void* _arg)
+{
+    Join();
+    func = _func;
+    arg = _arg;
+#if PLATFORM_WIN
+    handle = CreateThread(NULL, 0, Run, this, 0, NULL);
+    running = (handle != NULL);
+#else
+    running = (pthread_create(&thread, NULL, Run, this) == 0);
+#endif
+}
+
+void Thread::Join()
+{
+    if (!running)
+        return;
+#if PLATFORM_WIN
+    WaitForSingleObjectEx(handle, INFINITE, FALSE);
+    CloseHandle(handle);
+#else
+    pthread_join(thread, NULL);
+#endif
+    running = false;
+}
+
+void Thread::YieldTimeSlice()
+{
+#if PLATFORM_WIN
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+void RegisterParameter(
+    UnityAudioEffectDefinition& definition,
+    const char* name,
+    const char* unit,
+    float minval,
+    float maxval,
+    float defaultval,
+    float displayscale,
+    float displayexponent,
+    int enumvalue,
+    const char* description
+    )
+{
+    assert(defaultval >= minval);
+    assert(defaultval <= maxval);
+    strcpy_s(definition.paramdefs[enumvalue].name, name);
+    strcpy_s(definition.paramdefs[enumvalue].unit, unit);
+    definition.paramdefs[enumvalue].description = (description != NULL) ? strnew(description) : (name != NULL) ? strnew(name) : NULL;
+    definition.paramdefs[enumvalue].defaultval = defaultval;
+    definition.paramdefs[enumvalue].displayscale = displayscale;
+    definition.paramdefs[enumvalue].displayexponent = displayexponent;
+    definition.paramdefs[enumvalue].min = minval;
+    definition.paramdefs[enumvalue].max = maxval;
+    if (enumvalue >= (int)definition.numparameters)
+        definition.numparameters = enumvalue + 1;
+}
+
+// Helper function to fill default values from the effect definition into the params array -- called by Create callbacks
+void InitParametersFromDefinitions(
+    InternalEffectDefinitionRegistrationCallback registereffectdefcallback,
+    float* params
+    )
+{
+    UnityAudioEffectDefinition definition;
+    memset(&definition, 0, sizeof(definition));
+    registereffectdefcallback(definition);
+    for (UInt32 n = 0; n < definition.numparameters; n++)
+    {
+        params[n] = definition.paramdefs[n].defaultval;
+        delete[] definition.paramdefs[n].description;
+    }
+    delete[] definition.paramdefs; // assumes that definition.paramdefs was allocated by registereffectdefcallback or is NULL
+}
+
+void DeclareEffect(
+    UnityAudioEffectDefinition& definition,
+    const char* name,
+    UnityAudioEffect_CreateCallback createcallback,
+    UnityAudioEffect_ReleaseCallback releasecallback,
+    UnityAudioEffect_ProcessCallback processcallback,
+    UnityAudioEffect_SetFloatParameterCallback setfloatparametercallback,
+    UnityAudioEffect_GetFloatParameterCallback getfloatparametercallback,
+    UnityAudioEffect_GetFloatBufferCallback getfloatbuffercallback,
+    InternalEffectDefinitionRegistrationCallback registereffectdefcallback
+    )
+{
+    memset(&definition, 0, sizeof(definition));
+    strcpy_s(definition.name, name);
+    definition.structsize = sizeof(UnityAudioEffectDefinition);
+    definition.paramstructsize = sizeof(UnityAudioParameterDefinition);
+    definition.apiversion = UNITY_AUDIO_PLUGIN_API_VERSION;
+    definition.pluginversion = 0x010000;
+    definition.create = createcallback;
+    definition.release = releasecallback;
+    definition.process = processcallback;
+    definition.setfloatparameter = setfloatparametercallback;
+    definition.getfloatparameter = getfloatparametercallback;
+    definition.getfloatbuffer = getfloatbuffercallback;
+    registereffectdefcallback(definition);
+}
+
+} // namespace AudioPluginUtil
+
+#define DECLARE_EFFECT(namestr, ns) \
+    namespace ns \
+    { \
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback            (UnityAudioEffectState* state); \
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback           (UnityAudioEffectState* state); \
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback           (UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels); \
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback (UnityAudioEffectState* state, int index, float value); \
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback (UnityAudioEffectState* state, int index, float* value, char *valuestr); \
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback    (UnityAudioEffectState* state, const char* name, float* buffer, int numsamples); \
+    int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition); \
+    }
+#include "PluginList.h"
+#undef DECLARE_EFFECT
+
+#define DECLARE_EFFECT(namestr, ns) \
+AudioPluginUtil::DeclareEffect( \
+definition[numeffects++], \
+namestr, \
+ns::CreateCallback, \
+ns::ReleaseCallback, \
+ns::ProcessCallback, \
+ns::SetFloatParameterCallback, \
+ns::GetFloatParameterCallback, \
+ns::GetFloatBufferCallback, \
+ns::InternalRegisterEffectDefinition);
+
+extern "C" UNITY_AUDIODSP_EXPORT_API int AUDIO_CALLING_CONVENTION UnityGetAudioEffectDefinitions(UnityAudioEffectDefinition*** definitionptr)
+{
+    static UnityAudioEffectDefinition definition[256];
+    static UnityAudioEffectDefinition* definitionp[256];
+    static int numeffects = 0;
+    if (numeffects == 0)
+    {
+        #include "PluginList.h"
+    }
+    for (int n = 0; n < numeffects; n++)
+        definitionp[n] = &definition[n];
+    *definitionptr = definitionp;
+    return numeffects;
+}
+
+NAP_TESTSUITE(FFT)
+{
+    NAP_UNITTEST(Accuracy)
+    {
+        for (int test = 0; test < 2; test++)
+        {
+            bool highprecision = (test == 1);
+
+            AudioPluginUtil::Random r;
+            for (int b = 4; b <= 20; b++)
+            {
+                int num = 1 << b;
+
+                AudioPluginUtil::UnityComplexNumber* test1 = new AudioPluginUtil::UnityComplexNumber[num];
+                AudioPluginUtil::UnityComplexNumber* test2 = new AudioPluginUtil::UnityComplexNumber[num];
+
+                for (int n = 0; n < num; n++)
+                {
+                    test1[n].re = r.GetFloat(-1.0f, 1.0f);
+                    test1[n].im = r.GetFloat(-1.0f, 1.0f);
+                    test2[n].re = test1[n].re;
+                    test2[n].im = test1[n].im;
+                }
+
+                AudioPluginUtil::FFT::Forward(test2, num, highprecision);
+                AudioPluginUtil::FFT::Backward(test2, num, highprecision);
+
+                double errtol = (highprecision) ? 1.0e-6 : 1.5e-3;
+                double maxerr = 0.0f, errsum = 0.0, rms = 0.0;
+                for (int n = 0; n < num; n++)
+                {
+                    float err, diff;
+                    diff = test1[n].re - test2[n].re; err = fabsf(diff); NAP_CHECK(err < errtol); errsum += err; if (err > maxerr)
+                        maxerr = err;
+                    rms += diff * diff;
+                    diff = test1[n].im - test2[n].im; err = fabsf(diff); NAP_CHECK(err < errtol); errsum += err; if (err > maxerr)
+                        maxerr = err;
+                    rms += diff * diff;
+                }
+
+                double avgerr = errsum / (double)num;
+                rms = sqrt(rms / (double)num);
+
+                delete[] test1;
+                delete[] test2;
+
+                printf("%2d bits: MaxErr=%15.8g ErrSum=%15.8g AvgErr=%15.8g ErrRMS=%15.8g [%s precision]\n", b, maxerr, errsum, avgerr, rms, highprecision ? "high" : "low");
+                NAP_CHECK(avgerr < errtol);
+                NAP_CHECK(rms < errtol);
+            }
+        }
+    }
+
+    NAP_UNITTEST(PlanReuse)
+    {
+        for (int b = 0; b <= 16; b++)
+        {
+            const AudioPluginUtil::FFTPlan* plan1 = AudioPluginUtil::FFTPlan::Get(1 << b, false);
+            const AudioPluginUtil::FFTPlan* plan2 = AudioPluginUtil::FFTPlan::Get(1 << b, true);
+            NAP_CHECK(plan1 != plan2);
+            NAP_CHECK(plan1->GetNumSamples() == (1 << b) && !plan1->IsHighPrecision());
+            NAP_CHECK(plan2->GetNumSamples() == (1 << b) && plan2->IsHighPrecision());
+            NAP_CHECK(AudioPluginUtil::FFTPlan::Get(1 << b, false) == plan1);
+            NAP_CHECK(AudioPluginUtil::FFTPlan::Get(1 << b, true) == plan2);
+        }
+    }
+
+    NAP_UNITTEST(RealAccuracy)
+    {
+        for (int test = 0; test < 2; test++)
+        {
+            bool highprecision = (test == 1);
+
+            AudioPluginUtil::Random r;
+            for (int b = 2; b <= 20; b++)
+            {
+                int num = 1 << b, numbins = num / 2 + 1;
+
+                float* input = new float[num];
+                float* output = new float[num];
+                AudioPluginUtil::UnityComplexNumber* spec1 = new AudioPluginUtil::UnityComplexNumber[num];
+                AudioPluginUtil::UnityComplexNumber* spec2 = new AudioPluginUtil::UnityComplexNumber[numbins];
+
+                for (int n = 0; n < num; n++)
+                {
+                    input[n] = r.GetFloat(-1.0f, 1.0f);
+                    spec1[n].Set(input[n], 0.0f);
+                }
+
+                AudioPluginUtil::FFT::Forward(spec1, num, highprecision);
+                AudioPluginUtil::FFT::ForwardReal(input, spec2, num, highprecision);
+
+                // The spectrum error grows with the transform length, so compare relative to sqrt(num) which is the expected bin magnitude
+                double errtol = (highprecision) ? 1.0e-6 : 1.5e-3;
+                double specscale = 1.0 / sqrt((double)num), maxspecerr = 0.0;
+                for (int n = 0; n < numbins; n++)
+                {
+                    double err = sqrt((double)(spec1[n].re - spec2[n].re) * (spec1[n].re - spec2[n].re) + (double)(spec1[n].im - spec2[n].im) * (spec1[n].im - spec2[n].im)) * specscale;
+                    if (err > maxspecerr)
+                        maxspecerr = err;
+                }
+                NAP_CHECK(maxspecerr < errtol);
+
+                AudioPluginUtil::FFT::BackwardReal(spec2, output, num, highprecision);
+
+                double maxerr = 0.0;
+                for (int n = 0; n < num; n++)
+                {
+                    double err = fabs(input[n] - output[n]);
+                    NAP_CHECK(err < errtol);
+                    if (err > maxerr)
+                        maxerr = err;
+                }
+
+                delete[] input;
+                delete[] output;
+                delete[] spec1;
+                delete[] spec2;
+
+                printf("%2d bits: MaxSpecErr=%15.8g MaxErr=%15.8g [%s precision, real]\n", b, maxspecerr, maxerr, highprecision ? "high" : "low");
+            }
+        }
+    }
+
+    NAP_UNITTEST(MixedRadix)
+    {
+        static const int sizes[] = { 3, 5, 6, 7, 9, 10, 12, 15, 20, 25, 30, 45, 49, 60, 96, 120, 240, 441, 480, 960, 1000, 1920 };
+        for (int test = 0; test < 2; test++)
+        {
+            bool highprecision = (test == 1);
+
+            AudioPluginUtil::Random r;
+            for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+            {
+                int num = sizes[i];
+                NAP_CHECK(AudioPluginUtil::FFTPlan::IsSupportedSize(num));
+
+                AudioPluginUtil::UnityComplexNumber* input = new AudioPluginUtil::UnityComplexNumber[num];
+                AudioPluginUtil::UnityComplexNumber* output = new AudioPluginUtil::UnityComplexNumber[num];
+                for (int n = 0; n < num; n++)
+                {
+                    input[n].Set(r.GetFloat(-1.0f, 1.0f), r.GetFloat(-1.0f, 1.0f));
+                    output[n] = input[n];
+                }
+
+                AudioPluginUtil::FFT::Forward(output, num, highprecision);
+
+                // Compare against a direct evaluation of the DFT
+                double maxspecerr = 0.0;
+                for (int k = 0; k < num; k++)
+                {
+                    double re = 0.0, im = 0.0;
+                    for (int n = 0; n < num; n++)
+                    {
+                        double w = -2.0 * AudioPluginUtil::kPI_double * (double)(((long long)n * k) % num) / num;
+                        re += input[n].re * cos(w) - input[n].im * sin(w);
+                        im += input[n].re * sin(w) + input[n].im * cos(w);
+                    }
+                    double err = (fabs(re - output[k].re) + fabs(im - output[k].im)) / sqrt((double)num);
+                    if (err > maxspecerr)
+                        maxspecerr = err;
+                }
+                NAP_CHECK(maxspecerr < 1.0e-6);
+
+                AudioPluginUtil::FFT::Backward(output, num, highprecision);
+
+                double maxerr = 0.0;
+                for (int n = 0; n < num; n++)
+                {
+                    double err = fabs(input[n].re - output[n].re) + fabs(input[n].im - output[n].im);
+                    if (err > maxerr)
+                        maxerr = err;
+                }
+                NAP_CHECK(maxerr < 1.0e-6);
+
+                if ((num & 1) == 0)
+                {
+                    // Real-input transforms go through the half-length plan, which may be a power of two or not
+                    float* real = new float[num];
+                    float* realoutput = new float[num];
+                    for (int n = 0; n < num; n++)
+                    {
+                        real[n] = input[n].re;
+                        output[n].Set(input[n].re, 0.0f);
+                    }
+                    AudioPluginUtil::FFT::Forward(output, num, highprecision);
+                    AudioPluginUtil::FFT::ForwardReal(real, input, num, highprecision);
+                    for (int k = 0; k <= num / 2; k++)
+                        NAP_CHECK(fabs(input[k].re - output[k].re) + fabs(input[k].im - output[k].im) < 1.0e-6 * sqrt((double)num));
+                    AudioPluginUtil::FFT::BackwardReal(input, realoutput, num, highprecision);
+                    for (int n = 0; n < num; n++)
+                        NAP_CHECK(fabs(realoutput[n] - real[n]) < 1.0e-6);
+                    delete[] real;
+                    delete[] realoutput;
+                }
+
+                delete[] input;
+                delete[] output;
+
+                printf("%4d points: MaxSpecErr=%15.8g MaxErr=%15.8g [%s precision, mixed radix]\n", num, maxspecerr, maxerr, highprecision ? "high" : "low");
+            }
+        }
+
+        NAP_CHECK(!AudioPluginUtil::FFTPlan::IsSupportedSize(0));
+        NAP_CHECK(!AudioPluginUtil::FFTPlan::IsSupportedSize(67));
+        NAP_CHECK(!AudioPluginUtil::FFTPlan::IsSupportedSize(2 * 131));
+    }
+
+    NAP_UNITTEST(Batch)
+    {
+        static const int sizes[] = { 2, 8, 16, 480, 1024, 4096 };
+        const int numsignals = 8;
+        for (int test = 0; test < 2; test++)
+        {
+            bool highprecision = (test == 1);
+
+            AudioPluginUtil::Random r;
+            for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+            {
+                int num = sizes[i], numbins = num / 2 + 1;
+                const AudioPluginUtil::FFTPlan* plan = AudioPluginUtil::FFTPlan::Get(num, highprecision);
+
+                AudioPluginUtil::UnityComplexNumber* ref[numsignals];
+                AudioPluginUtil::UnityComplexNumber* batch[numsignals];
+                float* input[numsignals];
+                float* orig[numsignals];
+                for (int c = 0; c < numsignals; c++)
+                {
+                    ref[c] = new AudioPluginUtil::UnityComplexNumber[num];
+                    batch[c] = new AudioPluginUtil::UnityComplexNumber[num];
+                    input[c] = new float[num];
+                    orig[c] = new float[num];
+                    for (int n = 0; n < num; n++)
+                    {
+                        ref[c][n].Set(r.GetFloat(-1.0f, 1.0f), r.GetFloat(-1.0f, 1.0f));
+                        batch[c][n] = ref[c][n];
+                        input[c][n] = orig[c][n] = ref[c][n].re;
+                    }
+                }
+
+                double errtol = 1.0e-6 * sqrt((double)num), maxerr = 0.0;
+                for (int dir = 0; dir < 2; dir++)
+                {
+                    for (int c = 0; c < numsignals; c++)
+                    {
+                        if (dir == 0)
+                            plan->Forward(ref[c]);
+                        else
+                            plan->Backward(ref[c]);
+                    }
+                    if (dir == 0)
+                        plan->ForwardBatch(batch, numsignals);
+                    else
+                        plan->BackwardBatch(batch, numsignals);
+                    for (int c = 0; c < numsignals; c++)
+                    {
+                        for (int n = 0; n < num; n++)
+                        {
+                            double err = fabs(ref[c][n].re - batch[c][n].re) + fabs(ref[c][n].im - batch[c][n].im);
+                            NAP_CHECK(err < errtol);
+                            if (err > maxerr)
+                                maxerr = err;
+                        }
+                    }
+                }
+
+                // Real-input batch into separate spectra and back into the input buffers
+                for (int c = 0; c < numsignals; c++)
+                    plan->ForwardReal(input[c], ref[c]);
+                plan->ForwardRealBatch(input, batch, numsignals);
+                for (int c = 0; c < numsignals; c++)
+                    for (int n = 0; n < numbins; n++)
+                        NAP_CHECK(fabs(ref[c][n].re - batch[c][n].re) + fabs(ref[c][n].im - batch[c][n].im) < errtol);
+                plan->BackwardRealBatch(batch, input, numsignals);
+                for (int c = 0; c < numsignals; c++)
+                    for (int n = 0; n < num; n++)
+                        NAP_CHECK(fabs(input[c][n] - orig[c][n]) < 1.0e-6);
+
+                for (int c = 0; c < numsignals; c++)
+                {
+                    delete[] ref[c];
+                    delete[] batch[c];
+                    delete[] input[c];
+                    delete[] orig[c];
+                }
+
+                printf("%4d points x %d: MaxErr=%15.8g [%s precision, batch]\n", num, numsignals, maxerr, highprecision ? "high" : "low");
+            }
+        }
+    }
+
+    NAP_UNITTEST(KernelsMatchReference)
+    {
+        AudioPluginUtil::FFTKernel kernels[AudioPluginUtil::kMaxFFTKernels];
+        int numkernels = AudioPluginUtil::GetFFTKernels(kernels);
+        printf("FFT kernel: %s\n", AudioPluginUtil::FFTPlan::GetKernelName());
+
+        AudioPluginUtil::Random r;
+        for (int b = 0; b <= 16; b++)
+        {
+            int num = 1 << b;
+            const AudioPluginUtil::FFTPlan* plan = AudioPluginUtil::FFTPlan::Get(num, false);
+
+            AudioPluginUtil::UnityComplexNumber* input = new AudioPluginUtil::UnityComplexNumber[num];
+            AudioPluginUtil::UnityComplexNumber* ref = new AudioPluginUtil::UnityComplexNumber[num];
+            AudioPluginUtil::UnityComplexNumber* test = new AudioPluginUtil::UnityComplexNumber[num];
+            for (int n = 0; n < num; n++)
+                input[n].Set(r.GetFloat(-1.0f, 1.0f), r.GetFloat(-1.0f, 1.0f));
+
+            for (int dir = 0; dir < 2; dir++)
+            {
+                // kernels[0] is the scalar reference
+                memcpy(ref, input, sizeof(AudioPluginUtil::UnityComplexNumber) * num);
+                AudioPluginUtil::g_FFTKernelOverride = &kernels[0];
+                if (dir == 0)
+                    plan->Forward(ref);
+                else
+                    plan->Backward(ref);
+
+                for (int k = 1; k < numkernels; k++)
+                {
+                    memcpy(test, input, sizeof(AudioPluginUtil::UnityComplexNumber) * num);
+                    AudioPluginUtil::g_FFTKernelOverride = &kernels[k];
+                    if (dir == 0)
+                        plan->Forward(test);
+                    else
+                        plan->Backward(test);
+
+                    // Both kernels round differently, so compare relative to the expected magnitude of the outputs
+                    double errtol = 1.0e-6 * ((dir == 0) ? sqrt((double)num) : 1.0 / sqrt((double)num)), maxerr = 0.0;
+                    for (int n = 0; n < num; n++)
+                    {
+                        double err = fabs(ref[n].re - test[n].re) + fabs(ref[n].im - test[n].im);
+                        if (err > maxerr)
+                            maxerr = err;
+                    }
+                    NAP_CHECK(maxerr < errtol);
+                }
+            }
+
+            AudioPluginUtil::g_FFTKernelOverride = NULL;
+
+            delete[] input;
+            delete[] ref;
+            delete[] test;
+        }
+    }
+
+    NAP_UNITTEST(SplitComplex)
+    {
+        static const int sizes[] = { 2, 4, 8, 16, 32, 64, 1024, 4096, 480, 1920 };
+        AudioPluginUtil::FFTKernel kernels[AudioPluginUtil::kMaxFFTKernels];
+        int numkernels = AudioPluginUtil::GetFFTKernels(kernels);
+        AudioPluginUtil::Random r;
+        for (int k = 0; k <= numkernels; k++)
+        {
+            // The last round runs the high-precision plans, which do not depend on the kernel
+            bool highprecision = (k == numkernels);
+            AudioPluginUtil::g_FFTKernelOverride = (highprecision) ? NULL : &kernels[k];
+            for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+            {
+                int num = sizes[i], numbins = num / 2 + 1;
+                const AudioPluginUtil::FFTPlan* plan = AudioPluginUtil::FFTPlan::Get(num, highprecision);
+
+                AudioPluginUtil::UnityComplexNumber* ref = new AudioPluginUtil::UnityComplexNumber[num];
+                AudioPluginUtil::SplitComplexBuffer split;
+                float* input = new float[num];
+                float* output = new float[num];
+                split.Init(num);
+                for (int n = 0; n < num; n++)
+                {
+                    ref[n].Set(r.GetFloat(-1.0f, 1.0f), r.GetFloat(-1.0f, 1.0f));
+                    split.re[n] = ref[n].re;
+                    split.im[n] = ref[n].im;
+                    input[n] = r.GetFloat(-1.0f, 1.0f);
+                }
+
+                double errtol = 1.0e-6 * sqrt((double)num);
+                for (int dir = 0; dir < 2; dir++)
+                {
+                    if (dir == 0)
+                    {
+                        plan->Forward(ref);
+                        plan->Forward(split);
+                    }
+                    else
+                    {
+                        plan->Backward(ref);
+                        plan->Backward(split);
+                    }
+                    for (int n = 0; n < num; n++)
+                        NAP_CHECK(fabs(ref[n].re - split.re[n]) + fabs(ref[n].im - split.im[n]) < errtol);
+                }
+
+                plan->ForwardReal(input, ref);
+                plan->ForwardReal(input, split);
+                for (int n = 0; n < numbins; n++)
+                    NAP_CHECK(fabs(ref[n].re - split.re[n]) + fabs(ref[n].im - split.im[n]) < errtol);
+                plan->BackwardReal(split, output);
+                for (int n = 0; n < num; n++)
+                    NAP_CHECK(fabs(input[n] - output[n]) < 1.0e-6);
+
+                delete[] ref;
+                delete[] input;
+                delete[] output;
+            }
+        }
+        AudioPluginUtil::g_FFTKernelOverride = NULL;
+
+        // Multiply-accumulate against the interleaved reference, with the result aliasing an input
+        const int num = 37;
+        AudioPluginUtil::SplitComplexBuffer a, b, acc;
+        AudioPluginUtil::UnityComplexNumber ra[num], rb[num], racc[num];
+        a.Init(num);
+        b.Init(num);
+        acc.Init(num);
+        for (int n = 0; n < num; n++)
+        {
+            ra[n].Set(a.re[n] = r.GetFloat(-1.0f, 1.0f), a.im[n] = r.GetFloat(-1.0f, 1.0f));
+            rb[n].Set(b.re[n] = r.GetFloat(-1.0f, 1.0f), b.im[n] = r.GetFloat(-1.0f, 1.0f));
+            racc[n].Set(acc.re[n] = r.GetFloat(-1.0f, 1.0f), acc.im[n] = r.GetFloat(-1.0f, 1.0f));
+        }
+        AudioPluginUtil::SplitComplexMulAdd(a, b, acc, num);
+        AudioPluginUtil::SplitComplexMul(a, b, a, num);
+        for (int n = 0; n < num; n++)
+        {
+            AudioPluginUtil::UnityComplexNumber::MulAdd(ra[n], rb[n], racc[n], racc[n]);
+            AudioPluginUtil::UnityComplexNumber::Mul(ra[n], rb[n], ra[n]);
+            NAP_CHECK(fabs(racc[n].re - acc.re[n]) + fabs(racc[n].im - acc.im[n]) < 1.0e-6);
+            NAP_CHECK(fabs(ra[n].re - a.re[n]) + fabs(ra[n].im - a.im[n]) < 1.0e-6);
+        }
+        NAP_CHECK(((size_t)a.re & 63) == 0 && ((size_t)a.im & 63) == 0);
+    }
+
+    NAP_UNITTEST(RealPair)
+    {
+        // Transforming two real signals as one complex signal must match transforming them separately
+        static const int sizes[] = { 2, 4, 64, 1024, 4096, 480, 1920 };
+        AudioPluginUtil::Random r;
+        for (int test = 0; test < 2; test++)
+        {
+            bool highprecision = (test == 1);
+            for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+            {
+                int num = sizes[i], numbins = num / 2 + 1;
+                const AudioPluginUtil::FFTPlan* plan = AudioPluginUtil::FFTPlan::Get(num, highprecision);
+
+                AudioPluginUtil::SplitComplexBuffer spectra[2], pairspectra[2], scratch;
+                AudioPluginUtil::SplitComplex views[2];
+                float* input[2];
+                float* output[2];
+                float* pairoutput[2];
+                scratch.Init(num);
+                for (int c = 0; c < 2; c++)
+                {
+                    spectra[c].Init(numbins);
+                    pairspectra[c].Init(numbins);
+                    views[c] = spectra[c];
+                    input[c] = new float[num];
+                    output[c] = new float[num];
+                    pairoutput[c] = new float[num];
+                    for (int n = 0; n < num; n++)
+                        input[c][n] = r.GetFloat(-1.0f, 1.0f);
+                }
+
+                plan->ForwardRealBatch(input, views, 2);
+                plan->ForwardRealPair(input[0], input[1], pairspectra[0], pairspectra[1], scratch);
+                double maxspecerr = 0.0;
+                for (int c = 0; c < 2; c++)
+                {
+                    for (int n = 0; n < numbins; n++)
+                    {
+                        double err = fabs(spectra[c].re[n] - pairspectra[c].re[n]) + fabs(spectra[c].im[n] - pairspectra[c].im[n]);
+                        if (err > maxspecerr)
+                            maxspecerr = err;
+                    }
+                }
+                NAP_CHECK(maxspecerr < 1.0e-6 * sqrt((double)num) * 8.0);
+
+                plan->BackwardRealPair(pairspectra[0], pairspectra[1], pairoutput[0], pairoutput[1]);
+                plan->BackwardRealBatch(views, output, 2);
+                double maxerr = 0.0;
+                for (int c = 0; c < 2; c++)
+                {
+                    for (int n = 0; n < num; n++)
+                    {
+                        double err = fabs(output[c][n] - pairoutput[c][n]);
+                        if (err > maxerr)
+                            maxerr = err;
+                        NAP_CHECK(fabs(input[c][n] - pairoutput[c][n]) < 1.0e-5);
+                    }
+                }
+                NAP_CHECK(maxerr < 1.0e-5);
+
+                printf("%4d points: MaxSpecErr=%15.8g MaxErr=%15.8g [%s precision, real pair]\n", num, maxspecerr, maxerr, highprecision ? "high" : "low");
+
+                for (int c = 0; c < 2; c++)
+                {
+                    delete[] input[c];
+                    delete[] output[c];
+                    delete[] pairoutput[c];
+                }
+            }
+        }
+    }
+
+    NAP_UNITTEST(PartitionedConvolution)
+    {
+        // Small maximum partition sizes so that the responses span several segments and the last one has many partitions
+        static const int configs[][3] = { { 64, 3000, 1024 }, { 240, 5000, 1920 }, { 256, 100, 8192 }, { 32, 33, 32 }, { 64, 6000, 256 } }; // block size, response length, max partition size
+        const int numchannels = 2;
+        AudioPluginUtil::Random r;
+        // The tests run while the library is loaded, where threads must not be started, so the pool gets no workers. The deferred
+        // segments are then all picked up by the calling thread at the latest possible block.
+        AudioPluginUtil::ConvolutionThreadPool pool;
+        for (int i = 0; i < (int)(sizeof(configs) / sizeof(configs[0])); i++)
+        {
+            int blocksize = configs[i][0], irlength = configs[i][1];
+            float* impulse[numchannels];
+            float* input[numchannels];
+            float* block[numchannels];
+            float* threadedblock[numchannels];
+            for (int c = 0; c < numchannels; c++)
+            {
+                impulse[c] = new float[irlength];
+                block[c] = new float[blocksize];
+                threadedblock[c] = new float[blocksize];
+                for (int n = 0; n < irlength; n++)
+                    impulse[c][n] = r.GetFloat(-1.0f, 1.0f) * expf(-4.0f * n / irlength);
+            }
+
+            AudioPluginUtil::PartitionedIR ir;
+            AudioPluginUtil::PartitionedConvolver convolver, threadedconvolver;
+            ir.Init(impulse, numchannels, irlength, blocksize, configs[i][2]);
+            convolver.Init(&ir);
+            threadedconvolver.Init(&ir, &pool);
+            NAP_CHECK(ir.GetLength() >= irlength);
+
+            // Just long enough for the whole response to be convolved and the longest partitions to be processed once more, since the
+            // reference below is a direct convolution and the tests run while the library is loaded
+            const int numblocks = (ir.GetLength() + ir.GetSegment(ir.GetNumSegments() - 1).partitionsize) / blocksize + 2;
+            const int numsamples = blocksize * numblocks;
+            for (int c = 0; c < numchannels; c++)
+            {
+                input[c] = new float[numsamples];
+                for (int n = 0; n < numsamples; n++)
+                    input[c][n] = r.GetFloat(-1.0f, 1.0f);
+            }
+
+            double maxerr = 0.0, maxthreadederr = 0.0;
+            for (int b = 0; b < numblocks; b++)
+            {
+                for (int c = 0; c < numchannels; c++)
+                {
+                    memcpy(block[c], input[c] + b * blocksize, sizeof(float) * blocksize);
+                    memcpy(threadedblock[c], input[c] + b * blocksize, sizeof(float) * blocksize);
+                }
+                convolver.Process(block, block);
+                threadedconvolver.Process(threadedblock, threadedblock);
+                for (int c = 0; c < numchannels; c++)
+                {
+                    for (int n = 0; n < blocksize; n++)
+                    {
+                        int t = b * blocksize + n;
+                        double sum = 0.0;
+                        for (int k = 0; k < irlength && k <= t; k++)
+                            sum += (double)impulse[c][k] * input[c][t - k];
+                        double err = fabs(sum - block[c][n]);
+                        if (err > maxerr)
+                            maxerr = err;
+                        err = fabs(sum - threadedblock[c][n]);
+                        if (err > maxthreadederr)
+                            maxthreadederr = err;
+                    }
+                }
+            }
+            NAP_CHECK(maxerr < 1.0e-4);
+            NAP_CHECK(maxthreadederr < 1.0e-4);
+            printf("%3d block size, %4d samples, %d segments: MaxErr=%15.8g Threaded=%15.8g [partitioned convolution]\n", blocksize, irlength, ir.GetNumSegments(), maxerr, maxthreadederr);
+
+            for (int c = 0; c < numchannels; c++)
+            {
+                delete[] impulse[c];
+                delete[] input[c];
+                delete[] block[c];
+                delete[] threadedblock[c];
+            }
+        }
+    }
+
+    NAP_UNITTEST(ComplexMulKernels)
+    {
+        AudioPluginUtil::FFTKernel kernels[AudioPluginUtil::kMaxFFTKernels];
+        int numkernels = AudioPluginUtil::GetFFTKernels(kernels);
+
+        // All lengths up to a few registers to cover the remainder loops, and the bin count of ConvolutionReverb at 1024 samples
+        const int maxnum = 1025;
+        AudioPluginUtil::Random r;
+        AudioPluginUtil::SplitComplexBuffer a, b, ref, test, aq;
+        a.Init(maxnum);
+        b.Init(maxnum);
+        ref.Init(maxnum);
+        test.Init(maxnum);
+        aq.Init(maxnum);
+        for (int n = 0; n < maxnum; n++)
+        {
+            a.re[n] = r.GetFloat(-1.0f, 1.0f);
+            a.im[n] = r.GetFloat(-1.0f, 1.0f);
+            b.re[n] = r.GetFloat(-1.0f, 1.0f);
+            b.im[n] = r.GetFloat(-1.0f, 1.0f);
+        }
+
+        // The bfloat16 kernels must give the same result as the float ones on the rounded values
+        UInt16* abf16 = new UInt16[maxnum * 2];
+        AudioPluginUtil::SplitComplexBF16 ab = { abf16, abf16 + maxnum };
+        AudioPluginUtil::FloatToBF16(a.re, ab.re, maxnum);
+        AudioPluginUtil::FloatToBF16(a.im, ab.im, maxnum);
+        for (int n = 0; n < maxnum; n++)
+        {
+            aq.re[n] = AudioPluginUtil::BF16ToFloat(ab.re[n]);
+            aq.im[n] = AudioPluginUtil::BF16ToFloat(ab.im[n]);
+            NAP_CHECK(fabsf(aq.re[n] - a.re[n]) <= fabsf(a.re[n]) * (1.0f / 256.0f) && fabsf(aq.im[n] - a.im[n]) <= fabsf(a.im[n]) * (1.0f / 256.0f));
+        }
+
+        for (int num = 0; num <= maxnum; num = (num == 40) ? maxnum : (num + 1))
+        {
+            for (int k = 0; k < numkernels; k++)
+            {
+                for (int op = (k == 0) ? 2 : 0; op < 3; op++)
+                {
+                    for (int n = 0; n < maxnum; n++)
+                    {
+                        ref.re[n] = test.re[n] = (float)n;
+                        ref.im[n] = test.im[n] = -(float)n;
+                    }
+                    if (op == 0)
+                    {
+                        kernels[0].complexmul(a, b, ref, num);
+                        kernels[k].complexmul(a, b, test, num);
+                    }
+                    else if (op == 1)
+                    {
+                        kernels[0].complexmuladd(a, b, ref, num);
+                        kernels[k].complexmuladd(a, b, test, num);
+                    }
+                    else
+                    {
+                        kernels[0].complexmuladd(aq, b, ref, num);
+                        kernels[k].complexmuladdbf16(ab, b, test, num);
+                    }
+                    // Fused multiply-adds round differently, so compare relative to the accumulator values which grow with n
+                    for (int n = 0; n < maxnum; n++)
+                        NAP_CHECK(fabs(ref.re[n] - test.re[n]) + fabs(ref.im[n] - test.im[n]) < 1.0e-6 * (1.0 + n));
+                }
+            }
+        }
+        delete[] abf16;
+    }
+
+    NAP_UNITTEST(FIRKernels)
+    {
+        AudioPluginUtil::FFTKernel kernels[AudioPluginUtil::kMaxFFTKernels];
+        int numkernels = AudioPluginUtil::GetFFTKernels(kernels);
+
+        // Tap and sample counts around the register widths to cover the remainder loops
+        static const int taps[] = { 1, 2, 7, 16, 33, 300 };
+        const int maxsamples = 300, maxtaps = 300;
+        AudioPluginUtil::Random r;
+        float h[maxtaps], x[maxtaps - 1 + maxsamples], ref[maxsamples], test[maxsamples];
+        for (int n = 0; n < maxtaps; n++)
+            h[n] = r.GetFloat(-1.0f, 1.0f);
+        for (int n = 0; n < maxtaps - 1 + maxsamples; n++)
+            x[n] = r.GetFloat(-1.0f, 1.0f);
+        for (int t = 0; t < (int)(sizeof(taps) / sizeof(taps[0])); t++)
+        {
+            int numtaps = taps[t];
+            const float* input = x + maxtaps - 1;
+            for (int num = 0; num <= maxsamples; num = (num == 40) ? maxsamples : (num + 1))
+            {
+                for (int n = 0; n < maxsamples; n++)
+                {
+                    double sum = 0.0;
+                    for (int k = 0; k < numtaps; k++)
+                        sum += (double)h[k] * input[n - k];
+                    ref[n] = (n < num) ? (float)(n + sum) : (float)n;
+                }
+                for (int k = 0; k < numkernels; k++)
+                {
+                    for (int n = 0; n < maxsamples; n++)
+                        test[n] = (float)n;
+                    kernels[k].firmuladd(h, numtaps, input, test, num);
+                    for (int n = 0; n < maxsamples; n++)
+                        NAP_CHECK(fabs(ref[n] - test[n]) < 1.0e-6 * (1.0 + n + numtaps));
+                }
+            }
+        }
+    }
+
+    NAP_UNITTEST(DotProductKernels)
+    {
+        AudioPluginUtil::FFTKernel kernels[AudioPluginUtil::kMaxFFTKernels];
+        int numkernels = AudioPluginUtil::GetFFTKernels(kernels);
+
+        const int maxnum = 300;
+        AudioPluginUtil::Random r;
+        float a[maxnum], b[maxnum];
+        for (int n = 0; n < maxnum; n++)
+        {
+            a[n] = r.GetFloat(-1.0f, 1.0f);
+            b[n] = r.GetFloat(-1.0f, 1.0f);
+        }
+        for (int num = 0; num <= maxnum; num = (num == 40) ? maxnum : (num + 1))
+        {
+            // Odd offsets so that the loads are unaligned
+            double ref = 0.0;
+            for (int n = 0; n < num - 1; n++)
+                ref += (double)a[n + 1] * b[n];
+            for (int k = 0; k < numkernels; k++)
+                NAP_CHECK(fabs(kernels[k].dotproduct(a + 1, b, (num > 0) ? (num - 1) : 0) - ref) < 1.0e-6 * (1.0 + num));
+        }
+    }
+
+    NAP_UNITTEST(HybridConvolution)
+    {
+        // Convolving a head of the response directly must give the same output as partitioning all of it, for heads that are
+        // shorter and longer than the block size, not a multiple of it, and longer than the response itself
+        static const int configs[][4] = { { 64, 3000, 1024, 64 }, { 64, 3000, 1024, 200 }, { 240, 5000, 1920, 700 }, { 256, 100, 8192, 50 }, { 32, 33, 32, 100 }, { 64, 6000, 256, 1000 } }; // block size, response length, max partition size, head length
+        const int numchannels = 2, numblocks = 100;
+        AudioPluginUtil::Random r;
+        for (int i = 0; i < (int)(sizeof(configs) / sizeof(configs[0])); i++)
+        {
+            int blocksize = configs[i][0], irlength = configs[i][1];
+            float* impulse[numchannels];
+            float* block[numchannels];
+            float* hybridblock[numchannels];
+            for (int c = 0; c < numchannels; c++)
+            {
+                impulse[c] = new float[irlength];
+                block[c] = new float[blocksize];
+                hybridblock[c] = new float[blocksize];
+                for (int n = 0; n < irlength; n++)
+                    impulse[c][n] = r.GetFloat(-1.0f, 1.0f) * expf(-4.0f * n / irlength);
+            }
+
+            AudioPluginUtil::PartitionedIR ir, hybridir;
+            AudioPluginUtil::PartitionedConvolver convolver, hybridconvolver;
+            ir.Init(impulse, numchannels, irlength, blocksize, configs[i][2]);
+            hybridir.Init(impulse, numchannels, irlength, blocksize, configs[i][2], configs[i][3]);
+            convolver.Init(&ir);
+            hybridconvolver.Init(&hybridir);
+            NAP_CHECK(hybridir.GetHeadLength() > 0 && hybridir.GetHeadLength() < irlength);
+            NAP_CHECK(hybridir.GetLength() >= irlength);
+
+            double maxdiff = 0.0;
+            for (int b = 0; b < numblocks; b++)
+            {
+                for (int c = 0; c < numchannels; c++)
+                    for (int n = 0; n < blocksize; n++)
+                        block[c][n] = hybridblock[c][n] = r.GetFloat(-1.0f, 1.0f);
+                convolver.Process(block, block);
+                hybridconvolver.Process(hybridblock, hybridblock);
+                for (int c = 0; c < numchannels; c++)
+                {
+                    for (int n = 0; n < blocksize; n++)
+                    {
+                        double diff = fabs(block[c][n] - hybridblock[c][n]);
+                        if (diff > maxdiff)
+                            maxdiff = diff;
+                    }
+                }
+            }
+            NAP_CHECK(maxdiff < 1.0e-4);
+            printf("%3d block size, %4d samples, %4d head, %d partition size: MaxDiff=%15.8g [hybrid convolution]\n", blocksize, irlength, hybridir.GetHeadLength(), hybridir.GetSegment(0).partitionsize, maxdiff);
+
+            for (int c = 0; c < numchannels; c++)
+            {
+                delete[] impulse[c];
+                delete[] block[c];
+                delete[] hybridblock[c];
+            }
+        }
+    }
+
+    NAP_UNITTEST(TrueStereoConvolution)
+    {
+        // Convolving with all four paths of a true-stereo response must give the same output as separate mono convolutions
+        // of each path summed per output channel, both with and without a head
+        static const int configs[][4] = { { 64, 3000, 1024, 0 }, { 256, 20000, 4096, 0 }, { 240, 5000, 1920, 700 } }; // block size, response length, max partition size, head length
+        const int numinputs = 2, numoutputs = 2, numpaths = numinputs * numoutputs, numblocks = 100;
+        AudioPluginUtil::Random r;
+        for (int i = 0; i < (int)(sizeof(configs) / sizeof(configs[0])); i++)
+        {
+            int blocksize = configs[i][0], irlength = configs[i][1];
+            float* impulse[numpaths];
+            float* block[numinputs];
+            float* input[numinputs];
+            float* pathblock[1];
+            float* refblock[numoutputs];
+            for (int c = 0; c < numpaths; c++)
+            {
+                impulse[c] = new float[irlength];
+                for (int n = 0; n < irlength; n++)
+                    impulse[c][n] = r.GetFloat(-1.0f, 1.0f) * expf(-4.0f * n / irlength);
+            }
+            for (int c = 0; c < numinputs; c++)
+            {
+                block[c] = new float[blocksize];
+                input[c] = new float[blocksize];
+                refblock[c] = new float[blocksize];
+            }
+            pathblock[0] = new float[blocksize];
+
+            AudioPluginUtil::PartitionedIR ir, pathirs[numpaths];
+            AudioPluginUtil::PartitionedConvolver convolver, pathconvolvers[numpaths];
+            ir.Init(impulse, numpaths, irlength, blocksize, configs[i][2], configs[i][3]);
+            convolver.Init(&ir, NULL, numinputs);
+            NAP_CHECK(convolver.GetNumInputs() == numinputs && convolver.GetNumOutputs() == numoutputs);
+            for (int c = 0; c < numpaths; c++)
+            {
+                pathirs[c].Init(impulse + c, 1, irlength, blocksize, configs[i][2], configs[i][3]);
+                pathconvolvers[c].Init(&pathirs[c]);
+            }
+
+            double maxdiff = 0.0;
+            for (int b = 0; b < numblocks; b++)
+            {
+                for (int c = 0; c < numinputs; c++)
+                    for (int n = 0; n < blocksize; n++)
+                        block[c][n] = input[c][n] = r.GetFloat(-1.0f, 1.0f);
+                convolver.Process(block, block);
+                for (int c = 0; c < numoutputs; c++)
+                    memset(refblock[c], 0, sizeof(float) * blocksize);
+                for (int c = 0; c < numpaths; c++)
+                {
+                    pathconvolvers[c].Process(input + c / numoutputs, pathblock);
+                    for (int n = 0; n < blocksize; n++)
+                        refblock[c % numoutputs][n] += pathblock[0][n];
+                }
+                for (int c = 0; c < numoutputs; c++)
+                {
+                    for (int n = 0; n < blocksize; n++)
+                    {
+                        double diff = fabs(block[c][n] - refblock[c][n]);
+                        if (diff > maxdiff)
+                            maxdiff = diff;
+                    }
+                }
+            }
+            NAP_CHECK(maxdiff < 1.0e-4);
+            printf("%3d block size, %5d samples, %3d head: MaxDiff=%15.8g [true stereo convolution]\n", blocksize, irlength, ir.GetHeadLength(), maxdiff);
+
+            for (int c = 0; c < numpaths; c++)
+                delete[] impulse[c];
+            for (int c = 0; c < numinputs; c++)
+            {
+                delete[] block[c];
+                delete[] input[c];
+                delete[] refblock[c];
+            }
+            delete[] pathblock[0];
+        }
+    }
+
+    // Convolves random input with bfloat16 tail spectra and with float ones. Returns the RMS error relative to the RMS of the output
+    // and the maximum error relative to the same RMS in dB, and the slab sizes of both responses.
+    static void MeasureHalfPrecision(int blocksize, int irlength, int maxpartitionsize, int numblocks, double& errordb, double& maxdb, int& slabsize, int& halfslabsize)
+    {
+        const int numchannels = 2;
+        AudioPluginUtil::Random r;
+        float* impulse[numchannels];
+        float* block[numchannels];
+        float* halfblock[numchannels];
+        for (int c = 0; c < numchannels; c++)
+        {
+            impulse[c] = new float[irlength];
+            block[c] = new float[blocksize];
+            halfblock[c] = new float[blocksize];
+            for (int n = 0; n < irlength; n++)
+                impulse[c][n] = r.GetFloat(-1.0f, 1.0f) * expf(-8.0f * n / irlength);
+        }
+
+        AudioPluginUtil::PartitionedIR ir, halfir;
+        AudioPluginUtil::PartitionedConvolver convolver, halfconvolver;
+        ir.Init(impulse, numchannels, irlength, blocksize, maxpartitionsize);
+        halfir.Init(impulse, numchannels, irlength, blocksize, maxpartitionsize, 0, AudioPluginUtil::PartitionedIR::kBFloat16);
+        convolver.Init(&ir);
+        halfconvolver.Init(&halfir);
+        slabsize = ir.GetSlabSize();
+        halfslabsize = halfir.GetSlabSize();
+
+        double maxdiff = 0.0, sumdiff = 0.0, sumsignal = 0.0;
+        for (int b = 0; b < numblocks; b++)
+        {
+            for (int c = 0; c < numchannels; c++)
+                for (int n = 0; n < blocksize; n++)
+                    block[c][n] = halfblock[c][n] = r.GetFloat(-1.0f, 1.0f);
+            convolver.Process(block, block);
+            halfconvolver.Process(halfblock, halfblock);
+            for (int c = 0; c < numchannels; c++)
+            {
+                for (int n = 0; n < blocksize; n++)
+                {
+                    double diff = fabs(block[c][n] - halfblock[c][n]);
+                    if (diff > maxdiff)
+                        maxdiff = diff;
+                    sumdiff += diff * diff;
+                    sumsignal += block[c][n] * block[c][n];
+                }
+            }
+        }
+        double rms = sqrt(sumsignal / (numblocks * blocksize * numchannels));
+        errordb = 10.0 * log10(sumdiff / sumsignal);
+        maxdb = 20.0 * log10(maxdiff / rms);
+
+        for (int c = 0; c < numchannels; c++)
+        {
+            delete[] impulse[c];
+            delete[] block[c];
+            delete[] halfblock[c];
+        }
+    }
+
+    NAP_UNITTEST(HalfPrecisionConvolution)
+    {
+        // A short response spanning a few segments, the accuracy for long ones is reported by the benchmarks. The first segment keeps
+        // float spectra, which is about a third of the slab here.
+        const int blocksize = 256, irlength = 3000;
+        double errordb, maxdb;
+        int slabsize, halfslabsize;
+        MeasureHalfPrecision(blocksize, irlength, 1024, (irlength + blocksize - 1) / blocksize + 4, errordb, maxdb, slabsize, halfslabsize);
+        NAP_CHECK(errordb < -40.0);
+        NAP_CHECK(halfslabsize < slabsize * 0.7f);
+    }
+
+    NAP_UNITTEST(IRLibrary)
+    {
+        // Impulse responses read back from a library must convolve bit-exactly like the ones that were written
+        static const int configs[][5] = { { 256, 20000, 8192, 0, 1 }, { 64, 3000, 1024, 200, 0 } }; // block size, response length, max partition size, head length, bfloat16 tail
+        static const int numconfigs = (int)(sizeof(configs) / sizeof(configs[0]));
+        const int numchannels = 2, numblocks = 100;
+        char filename[1024];
+#if PLATFORM_WIN
+        GetTempPathA(sizeof(filename) - 32, filename);
+#else
+        const char* tmpdir = getenv("TMPDIR");
+        snprintf(filename, sizeof(filename) - 32, "%s/", (tmpdir != NULL) ? tmpdir : "/tmp");
+#endif
+        strcat(filename, "nap_irlibrary_test.bin");
+
+        AudioPluginUtil::Random r;
+        AudioPluginUtil::PartitionedIR ir[numconfigs];
+        AudioPluginUtil::IRLibrary::Entry entries[numconfigs];
+        for (int i = 0; i < numconfigs; i++)
+        {
+            int irlength = configs[i][1];
+            float* impulse[numchannels];
+            for (int c = 0; c < numchannels; c++)
+            {
+                impulse[c] = new float[irlength];
+                for (int n = 0; n < irlength; n++)
+                    impulse[c][n] = r.GetFloat(-1.0f, 1.0f) * expf(-4.0f * n / irlength);
+            }
+            ir[i].Init(impulse, numchannels, irlength, configs[i][0], configs[i][2], configs[i][3], configs[i][4] ? AudioPluginUtil::PartitionedIR::kBFloat16 : AudioPluginUtil::PartitionedIR::kFloat32);
+            entries[i].name = (i == 0) ? "hall" : "room";
+            entries[i].samplerate = 48000;
+            entries[i].ir = &ir[i];
+            for (int c = 0; c < numchannels; c++)
+                delete[] impulse[c];
+        }
+        NAP_CHECK(AudioPluginUtil::IRLibrary::Write(filename, entries, numconfigs));
+
+        AudioPluginUtil::IRLibrary library;
+        NAP_CHECK(library.Open(filename));
+        NAP_CHECK(library.GetNumEntries() == numconfigs);
+        NAP_CHECK(library.Find("room", 64, 48000, numchannels) == 1);
+        NAP_CHECK(library.Find("room", 256, 48000, numchannels) == -1);
+        NAP_CHECK(library.Find("hall", 256, 44100, numchannels) == -1);
+        for (int i = 0; i < numconfigs; i++)
+        {
+            int blocksize = configs[i][0];
+            AudioPluginUtil::PartitionedIR mappedir;
+            library.GetEntry(library.Find(entries[i].name, blocksize, 48000, numchannels), mappedir);
+            NAP_CHECK(mappedir.GetLength() == ir[i].GetLength() && mappedir.GetHeadLength() == ir[i].GetHeadLength() && mappedir.GetNumSegments() == ir[i].GetNumSegments());
+
+            AudioPluginUtil::PartitionedConvolver convolver, mappedconvolver;
+            convolver.Init(&ir[i]);
+            mappedconvolver.Init(&mappedir);
+            float* block[numchannels];
+            float* mappedblock[numchannels];
+            for (int c = 0; c < numchannels; c++)
+            {
+                block[c] = new float[blocksize];
+                mappedblock[c] = new float[blocksize];
+            }
+            bool identical = true;
+            for (int b = 0; b < numblocks; b++)
+            {
+                for (int c = 0; c < numchannels; c++)
+                    for (int n = 0; n < blocksize; n++)
+                        block[c][n] = mappedblock[c][n] = r.GetFloat(-1.0f, 1.0f);
+                convolver.Process(block, block);
+                mappedconvolver.Process(mappedblock, mappedblock);
+                for (int c = 0; c < numchannels; c++)
+                    identical = identical && memcmp(block[c], mappedblock[c], blocksize * sizeof(float)) == 0;
+            }
+            NAP_CHECK(identical);
+            printf("%3d block size, %5d samples, %3d head, %d segments: Identical=%d [ir library]\n", blocksize, configs[i][1], mappedir.GetHeadLength(), mappedir.GetNumSegments(), identical ? 1 : 0);
+            for (int c = 0; c < numchannels; c++)
+            {
+                delete[] block[c];
+                delete[] mappedblock[c];
+            }
+        }
+        library.Close();
+
+        // Damaged files must be rejected rather than mapped
+        FILE* f = fopen(filename, "rb");
+        NAP_CHECK(f != NULL);
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        char* contents = new char[size];
+        NAP_CHECK(fread(contents, size, 1, f) == 1);
+        fclose(f);
+        f = fopen(filename, "wb");
+        fwrite(contents, size - 64, 1, f);
+        fclose(f);
+        NAP_CHECK(!library.Open(filename));
+
+        // A segment with so many partitions that the sums of their sizes wrap around. The first FileEntry follows the 16-byte FileHeader
+        // and holds the offset of its data after the name and six other fields, and the data starts with the FileSegments.
+        UInt64 entryoffset;
+        memcpy(&entryoffset, contents + 16 + AudioPluginUtil::IRLibrary::kMaxNameLength + 1 + 6 * sizeof(UInt32), sizeof(entryoffset));
+        UInt32* numpartitions = (UInt32*)(contents + entryoffset + sizeof(UInt32));
+        *numpartitions += 1 << 27;
+        f = fopen(filename, "wb");
+        fwrite(contents, size, 1, f);
+        fclose(f);
+        NAP_CHECK(!library.Open(filename));
+        *numpartitions -= 1 << 27;
+        memcpy(contents, "NAPIRLIX", 8);
+        f = fopen(filename, "wb");
+        fwrite(contents, size, 1, f);
+        fclose(f);
+        NAP_CHECK(!library.Open(filename));
+        delete[] contents;
+        remove(filename);
+    }
 }
 
-} // namespace AudioPluginUtil
+NAP_TESTSUITE(Resampler)
+{
+    // Signal-to-noise ratio in dB of a sine converted from inrate to outrate, measured away from the ends. The linear interpolation
+    // that the plugins used before is reported for comparison.
+    static double MeasureSine(int inrate, int outrate, double frequency, bool linear)
+    {
+        const int numinput = inrate / 2;
+        float* input = new float[numinput];
+        for (int n = 0; n < numinput; n++)
+            input[n] = (float)(0.5 * sin(2.0 * AudioPluginUtil::kPI * frequency * n / inrate));
 
-#define DECLARE_EFFECT(namestr, ns) \
-    namespace ns \
-    { \
-    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback            (UnityAudioEffectState* state); \
-    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback           (UnityAudioEffectState* state); \
-    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback           (UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels); \
-    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback (UnityAudioEffectState* state, int index, float value); \
-    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback (UnityAudioEffectState* state, int index, float* value, char *valuestr); \
-    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback    (UnityAudioEffectState* state, const char* name, float* buffer, int numsamples); \
-    int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition); \
+        const AudioPluginUtil::Resampler* resampler = AudioPluginUtil::Resampler::Get(inrate, outrate);
+        int numoutput = resampler->GetOutputLength(numinput);
+        float* output = new float[numoutput];
+        if (linear)
+        {
+            for (int n = 0; n < numoutput; n++)
+            {
+                double pos = (double)n * inrate / outrate;
+                int i = (int)pos;
+                float s1 = input[i], s2 = (i + 1 < numinput) ? input[i + 1] : 0.0f;
+                output[n] = s1 + (s2 - s1) * (float)(pos - i);
+            }
+        }
+        else
+            resampler->Process(input, numinput, 1, output, numoutput, 1);
+
+        // Frequencies above the Nyquist frequency of the output must disappear rather than alias
+        bool stopband = 2.0 * frequency > outrate;
+        double signal = 0.0, noise = 0.0;
+        for (int n = 200; n < numoutput - 200; n++)
+        {
+            double ref = stopband ? 0.0 : 0.5 * sin(2.0 * AudioPluginUtil::kPI * frequency * n / outrate);
+            signal += stopband ? 0.125 : ref * ref;
+            noise += (output[n] - ref) * (output[n] - ref);
+        }
+
+        delete[] input;
+        delete[] output;
+        return 10.0 * log10(signal / (noise + 1.0e-30));
     }
-#include "PluginList.h"
-#undef DECLARE_EFFECT
 
-#define DECLARE_EFFECT(namestr, ns) \
-AudioPluginUtil::DeclareEffect( \
-definition[numeffects++], \
-namestr, \
-ns::CreateCallback, \
-ns::ReleaseCallback, \
-ns::ProcessCallback, \
-ns::SetFloatParameterCallback, \
-ns::GetFloatParameterCallback, \
-ns::GetFloatBufferCallback, \
-ns::InternalRegisterEffectDefinition);
+    NAP_UNITTEST(Quality)
+    {
+        static const int configs[][3] = { { 44100, 48000, 1000 }, { 44100, 48000, 15000 }, { 48000, 44100, 1000 }, { 48000, 44100, 23000 }, { 96000, 44100, 40000 }, { 44100, 48001, 1000 }, { 22050, 48000, 5000 } }; // input rate, output rate, frequency
+        for (int i = 0; i < (int)(sizeof(configs) / sizeof(configs[0])); i++)
+        {
+            double snr = MeasureSine(configs[i][0], configs[i][1], configs[i][2], false);
+            double linearsnr = MeasureSine(configs[i][0], configs[i][1], configs[i][2], true);
+            NAP_CHECK(snr > 70.0);
+            printf("%6d Hz -> %6d Hz, %5d Hz sine: SNR %6.1f dB (linear interpolation %6.1f dB), %d taps [resampler]\n",
+                configs[i][0], configs[i][1], configs[i][2], snr, linearsnr, AudioPluginUtil::Resampler::Get(configs[i][0], configs[i][1])->GetNumTaps());
+        }
+    }
 
-extern "C" UNITY_AUDIODSP_EXPORT_API int AUDIO_CALLING_CONVENTION UnityGetAudioEffectDefinitions(UnityAudioEffectDefinition*** definitionptr)
+    NAP_UNITTEST(Stride)
+    {
+        // Interleaved channels must be converted independently, and the same rates must give the same converter
+        const int numinput = 1000, numchannels = 3;
+        const AudioPluginUtil::Resampler* resampler = AudioPluginUtil::Resampler::Get(32000, 44100);
+        NAP_CHECK(resampler == AudioPluginUtil::Resampler::Get(32000, 44100));
+        int numoutput = resampler->GetOutputLength(numinput);
+        NAP_CHECK(numoutput == 1379);
+        AudioPluginUtil::Random r;
+        float* input = new float[numinput * numchannels];
+        float* channel = new float[numinput];
+        float* output = new float[numoutput * numchannels];
+        float* ref = new float[numoutput];
+        for (int n = 0; n < numinput * numchannels; n++)
+            input[n] = r.GetFloat(-1.0f, 1.0f);
+        for (int c = 0; c < numchannels; c++)
+            resampler->Process(input + c, numinput, numchannels, output + c, numoutput, numchannels);
+        for (int c = 0; c < numchannels; c++)
+        {
+            for (int n = 0; n < numinput; n++)
+                channel[n] = input[n * numchannels + c];
+            resampler->Process(channel, numinput, 1, ref, numoutput, 1);
+            for (int n = 0; n < numoutput; n++)
+                NAP_CHECK(output[n * numchannels + c] == ref[n]);
+        }
+        delete[] input;
+        delete[] channel;
+        delete[] output;
+        delete[] ref;
+    }
+}
+
+NAP_TESTSUITE(Threads)
 {
-    static UnityAudioEffectDefinition definition[256];
-    static UnityAudioEffectDefinition* definitionp[256];
-    static int numeffects = 0;
-    if (numeffects == 0)
+    // The tests run from static constructors while the library is being loaded, where a new thread may not be able to start until loading has
+    // finished (the loader lock on Windows). So these only cover what can be checked on the loading thread itself.
+    NAP_UNITTEST(EventLatch)
     {
-        #include "PluginList.h"
+        // A signal given before the wait must not be lost, and several signals before one wait count as one
+        AudioPluginUtil::Event event;
+        event.Signal();
+        event.Wait();
+        event.Signal();
+        event.Signal();
+        event.Wait();
+
+        AudioPluginUtil::Thread thread;
+        NAP_CHECK(!thread.IsRunning());
+        thread.Join();
+        NAP_CHECK(!thread.IsRunning());
+    }
+
+    NAP_UNITTEST(Atomics)
+    {
+        int values[2] = { 1, 2 };
+        int* volatile p = NULL;
+        AudioPluginUtil::AtomicStorePointer(&p, &values[0]);
+        NAP_CHECK(AudioPluginUtil::AtomicLoadPointer(&p) == &values[0]);
+        NAP_CHECK(AudioPluginUtil::AtomicExchangePointer(&p, &values[1]) == &values[0]);
+        NAP_CHECK(AudioPluginUtil::AtomicExchangePointer(&p, (int*)NULL) == &values[1]);
+        NAP_CHECK(AudioPluginUtil::AtomicLoadPointer(&p) == NULL);
+
+        volatile int n = 0;
+        AudioPluginUtil::AtomicStoreInt(&n, 3);
+        NAP_CHECK(AudioPluginUtil::AtomicLoadInt(&n) == 3);
+        NAP_CHECK(!AudioPluginUtil::AtomicCompareExchangeInt(&n, 4, 5));
+        NAP_CHECK(AudioPluginUtil::AtomicCompareExchangeInt(&n, 3, 5));
+        NAP_CHECK(AudioPluginUtil::AtomicLoadInt(&n) == 5);
     }
-    for (int n = 0; n < numeffects; n++)
-        definitionp[n] = &definition[n];
-    *definitionptr = definitionp;
-    return numeffects;
 }
 
-// Simplistic unit-test framework
-#if ENABLE_TESTS
-    #define NAP_TESTSUITE(name) \
-        namespace testsuite_##name { inline const char* GetSuiteName() { return #name; } }\
-        namespace testsuite_##name
-    #define NAP_UNITTEST(name) \
-        struct NAP_Test_##name { NAP_Test_##name(const char* testname); };\
-        static NAP_Test_##name test_##name(#name);\
-        NAP_Test_##name::NAP_Test_##name(const char* testname)
-    #define NAP_CHECK(...) \
-        do\
-        {\
-            if(!(__VA_ARGS__))\
-            {\
-                printf("%s(%d): Unit test '%s' failed for expression '%s'.\n", __FILE__, __LINE__, testname, #__VA_ARGS__);\
-                assert(false && "Unit test in native audio plugin framework failed!");\
-            }\
-        } while(false)
+#if ENABLE_BENCHMARKS
+
+static double GetBenchmarkTime()
+{
+#if PLATFORM_WIN
+    LARGE_INTEGER counter, freq;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&freq);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
 #else
-    #define NAP_TESTSUITE(name) namespace testsuite_##name
-    #define NAP_UNITTEST(name) static void test_##name()
-    #define NAP_CHECK(...) do {} while(false)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1.0e-9 * (double)ts.tv_nsec;
 #endif
+}
 
-NAP_TESTSUITE(FFT)
+NAP_TESTSUITE(FFTBenchmark)
 {
-    NAP_UNITTEST(Accuracy)
+    NAP_UNITTEST(Kernels)
     {
-        for (int test = 0; test < 2; test++)
+        AudioPluginUtil::FFTKernel kernels[AudioPluginUtil::kMaxFFTKernels];
+        int numkernels = AudioPluginUtil::GetFFTKernels(kernels);
+
+        for (int b = 8; b <= 16; b++)
         {
-            bool highprecision = (test == 1);
+            int num = 1 << b;
+            int numiterations = (1 << 24) / (num * b);
+            const AudioPluginUtil::FFTPlan* plan = AudioPluginUtil::FFTPlan::Get(num, false);
 
+            AudioPluginUtil::UnityComplexNumber* data = new AudioPluginUtil::UnityComplexNumber[num];
             AudioPluginUtil::Random r;
-            for (int b = 4; b <= 20; b++)
+            for (int n = 0; n < num; n++)
+                data[n].Set(r.GetFloat(-1.0f, 1.0f), r.GetFloat(-1.0f, 1.0f));
+
+            printf("%6d points:", num);
+            double reftime = 0.0;
+            for (int k = 0; k < numkernels; k++)
             {
-                int num = 1 << b;
+                AudioPluginUtil::g_FFTKernelOverride = &kernels[k];
+                double t0 = GetBenchmarkTime();
+                for (int i = 0; i < numiterations; i++)
+                {
+                    plan->Forward(data);
+                    plan->Backward(data);
+                }
+                double t = (GetBenchmarkTime() - t0) / (2.0 * numiterations);
+                if (k == 0)
+                    reftime = t;
+                printf(" %s %9.2f us (%4.2fx)", kernels[k].name, t * 1.0e6, reftime / t);
+            }
+            printf("\n");
+            AudioPluginUtil::g_FFTKernelOverride = NULL;
 
-                AudioPluginUtil::UnityComplexNumber* test1 = new AudioPluginUtil::UnityComplexNumber[num];
-                AudioPluginUtil::UnityComplexNumber* test2 = new AudioPluginUtil::UnityComplexNumber[num];
+            delete[] data;
+        }
+    }
+
+    NAP_UNITTEST(Batch)
+    {
+        const int numsignals = 8;
+        for (int b = 8; b <= 16; b++)
+        {
+            int num = 1 << b;
+            int numiterations = (1 << 22) / (num * b);
+            const AudioPluginUtil::FFTPlan* plan = AudioPluginUtil::FFTPlan::Get(num, false);
 
+            AudioPluginUtil::UnityComplexNumber* data[numsignals];
+            AudioPluginUtil::Random r;
+            for (int c = 0; c < numsignals; c++)
+            {
+                data[c] = new AudioPluginUtil::UnityComplexNumber[num];
                 for (int n = 0; n < num; n++)
+                    data[c][n].Set(r.GetFloat(-1.0f, 1.0f), r.GetFloat(-1.0f, 1.0f));
+            }
+
+            double t0 = GetBenchmarkTime();
+            for (int i = 0; i < numiterations; i++)
+            {
+                for (int c = 0; c < numsignals; c++)
                 {
-                    test1[n].re = r.GetFloat(-1.0f, 1.0f);
-                    test1[n].im = r.GetFloat(-1.0f, 1.0f);
-                    test2[n].re = test1[n].re;
-                    test2[n].im = test1[n].im;
+                    plan->Forward(data[c]);
+                    plan->Backward(data[c]);
                 }
+            }
+            double t1 = GetBenchmarkTime();
+            for (int i = 0; i < numiterations; i++)
+            {
+                plan->ForwardBatch(data, numsignals);
+                plan->BackwardBatch(data, numsignals);
+            }
+            double t2 = GetBenchmarkTime();
 
-                AudioPluginUtil::FFT::Forward(test2, num, highprecision);
-                AudioPluginUtil::FFT::Backward(test2, num, highprecision);
+            double single = (t1 - t0) / (2.0 * numiterations), batch = (t2 - t1) / (2.0 * numiterations);
+            printf("%6d points x %d signals: Separate %9.2f us Batch %9.2f us (%4.2fx) [%s]\n", num, numsignals, single * 1.0e6, batch * 1.0e6, single / batch, AudioPluginUtil::FFTPlan::GetKernelName());
 
-                double errtol = (highprecision) ? 1.0e-6 : 1.5e-3;
-                double maxerr = 0.0f, errsum = 0.0, rms = 0.0;
+            for (int c = 0; c < numsignals; c++)
+                delete[] data[c];
+        }
+    }
+
+    // Both ears of the Spatializer, transformed as two real signals or as one complex signal
+    NAP_UNITTEST(RealPair)
+    {
+        for (int b = 8; b <= 14; b++)
+        {
+            int num = 1 << b, numbins = num / 2 + 1;
+            int numiterations = (1 << 22) / (num * b);
+            const AudioPluginUtil::FFTPlan* plan = AudioPluginUtil::FFTPlan::Get(num, false);
+
+            AudioPluginUtil::SplitComplexBuffer spectra[2], scratch;
+            AudioPluginUtil::SplitComplex views[2];
+            float* input[2];
+            float* output[2];
+            AudioPluginUtil::Random r;
+            scratch.Init(num);
+            for (int c = 0; c < 2; c++)
+            {
+                spectra[c].Init(numbins);
+                views[c] = spectra[c];
+                input[c] = new float[num];
+                output[c] = new float[num];
                 for (int n = 0; n < num; n++)
+                    input[c][n] = r.GetFloat(-1.0f, 1.0f);
+            }
+
+            double t0 = GetBenchmarkTime();
+            for (int i = 0; i < numiterations; i++)
+            {
+                plan->ForwardRealBatch(input, views, 2);
+                plan->BackwardRealBatch(views, output, 2);
+            }
+            double t1 = GetBenchmarkTime();
+            for (int i = 0; i < numiterations; i++)
+            {
+                plan->ForwardRealPair(input[0], input[1], spectra[0], spectra[1], scratch);
+                plan->BackwardRealPair(spectra[0], spectra[1], output[0], output[1]);
+            }
+            double t2 = GetBenchmarkTime();
+
+            double batch = (t1 - t0) / numiterations, pair = (t2 - t1) / numiterations;
+            printf("%6d points x 2 signals: RealBatch %9.2f us RealPair %9.2f us (%4.2fx) [%s]\n", num, batch * 1.0e6, pair * 1.0e6, batch / pair, AudioPluginUtil::FFTPlan::GetKernelName());
+
+            for (int c = 0; c < 2; c++)
+            {
+                delete[] input[c];
+                delete[] output[c];
+            }
+        }
+    }
+
+    // Accuracy of bfloat16 tail spectra against float ones for long responses
+    NAP_UNITTEST(HalfPrecisionConvolution)
+    {
+        static const int configs[][3] = { { 256, 96000, 8192 }, { 1024, 720000, 8192 } }; // block size, response length, max partition size
+        for (int i = 0; i < (int)(sizeof(configs) / sizeof(configs[0])); i++)
+        {
+            int blocksize = configs[i][0], irlength = configs[i][1];
+            double errordb, maxdb;
+            int slabsize, halfslabsize;
+            testsuite_FFT::MeasureHalfPrecision(blocksize, irlength, configs[i][2], 200, errordb, maxdb, slabsize, halfslabsize);
+            printf("%4d block size, %6d samples: RMS error %6.1f dB, max error %6.1f dB, %6.2f MB instead of %6.2f MB [bfloat16 spectra]\n",
+                blocksize, irlength, errordb, maxdb, halfslabsize * 2 * 4.0 / 1048576.0, slabsize * 2 * 4.0 / 1048576.0);
+        }
+    }
+
+    // The partition sum of ConvolutionReverb for one block of 1024 samples at 48 kHz and IRs of various lengths,
+    // with the interleaved UnityComplexNumber::MulAdd loop as the baseline
+    NAP_UNITTEST(PartitionSum)
+    {
+        AudioPluginUtil::FFTKernel kernels[AudioPluginUtil::kMaxFFTKernels];
+        int numkernels = AudioPluginUtil::GetFFTKernels(kernels);
+
+        static const float irlengths[] = { 0.5f, 2.0f, 5.0f, 15.0f };
+        const int hopsize = 1024, numbins = hopsize + 1;
+        for (int i = 0; i < (int)(sizeof(irlengths) / sizeof(irlengths[0])); i++)
+        {
+            int numpartitions = (int)ceilf(irlengths[i] * 48000.0f / hopsize);
+            int numiterations = 2000 / numpartitions + 4;
+
+            AudioPluginUtil::Random r;
+            AudioPluginUtil::SplitComplexBuffer* h = new AudioPluginUtil::SplitComplexBuffer[numpartitions];
+            AudioPluginUtil::SplitComplexBuffer* x = new AudioPluginUtil::SplitComplexBuffer[numpartitions];
+            AudioPluginUtil::UnityComplexNumber* ih = new AudioPluginUtil::UnityComplexNumber[numpartitions * numbins];
+            AudioPluginUtil::UnityComplexNumber* ix = new AudioPluginUtil::UnityComplexNumber[numpartitions * numbins];
+            AudioPluginUtil::UnityComplexNumber* iy = new AudioPluginUtil::UnityComplexNumber[numbins];
+            AudioPluginUtil::SplitComplexBuffer y;
+            y.Init(numbins);
+            const int stride = AudioPluginUtil::GetSplitComplexStride(numbins);
+            UInt16* hbf16 = (UInt16*)AudioPluginUtil::AlignedAlloc(sizeof(UInt16) * 2 * stride * numpartitions, 64);
+            for (int k = 0; k < numpartitions; k++)
+            {
+                h[k].Init(numbins);
+                x[k].Init(numbins);
+                for (int n = 0; n < numbins; n++)
                 {
-                    float err, diff;
-                    diff = test1[n].re - test2[n].re; err = fabsf(diff); NAP_CHECK(err < errtol); errsum += err; if (err > maxerr)
-                        maxerr = err;
-                    rms += diff * diff;
-                    diff = test1[n].im - test2[n].im; err = fabsf(diff); NAP_CHECK(err < errtol); errsum += err; if (err > maxerr)
-                        maxerr = err;
-                    rms += diff * diff;
+                    ih[k * numbins + n].Set(h[k].re[n] = r.GetFloat(-1.0f, 1.0f), h[k].im[n] = r.GetFloat(-1.0f, 1.0f));
+                    ix[k * numbins + n].Set(x[k].re[n] = r.GetFloat(-1.0f, 1.0f), x[k].im[n] = r.GetFloat(-1.0f, 1.0f));
                 }
+                AudioPluginUtil::FloatToBF16(h[k].re, hbf16 + 2 * k * stride, numbins);
+                AudioPluginUtil::FloatToBF16(h[k].im, hbf16 + (2 * k + 1) * stride, numbins);
+            }
 
-                double avgerr = errsum / (double)num;
-                rms = sqrt(rms / (double)num);
+            double t0 = GetBenchmarkTime();
+            for (int it = 0; it < numiterations; it++)
+            {
+                memset(iy, 0, sizeof(AudioPluginUtil::UnityComplexNumber) * numbins);
+                for (int k = 0; k < numpartitions; k++)
+                    for (int n = 0; n < numbins; n++)
+                        AudioPluginUtil::UnityComplexNumber::MulAdd(ih[k * numbins + n], ix[k * numbins + n], iy[n], iy[n]);
+            }
+            double reftime = (GetBenchmarkTime() - t0) / numiterations;
+            printf("%5.1f s IR (%3d partitions): Interleaved %8.1f us", irlengths[i], numpartitions, reftime * 1.0e6);
 
-                delete[] test1;
-                delete[] test2;
+            for (int j = 0; j < numkernels; j++)
+            {
+                AudioPluginUtil::g_FFTKernelOverride = &kernels[j];
+                t0 = GetBenchmarkTime();
+                for (int it = 0; it < numiterations; it++)
+                {
+                    y.Clear();
+                    for (int k = 0; k < numpartitions; k++)
+                        AudioPluginUtil::SplitComplexMulAdd(h[k], x[k], y, numbins);
+                }
+                double t = (GetBenchmarkTime() - t0) / numiterations;
 
-                printf("%2d bits: MaxErr=%15.8g ErrSum=%15.8g AvgErr=%15.8g ErrRMS=%15.8g [%s precision]\n", b, maxerr, errsum, avgerr, rms, highprecision ? "high" : "low");
-                NAP_CHECK(avgerr < errtol);
-                NAP_CHECK(rms < errtol);
+                t0 = GetBenchmarkTime();
+                for (int it = 0; it < numiterations; it++)
+                {
+                    y.Clear();
+                    for (int k = 0; k < numpartitions; k++)
+                    {
+                        AudioPluginUtil::SplitComplexBF16 hk = { hbf16 + 2 * k * stride, hbf16 + (2 * k + 1) * stride };
+                        AudioPluginUtil::SplitComplexMulAddBF16(hk, x[k], y, numbins);
+                    }
+                }
+                double tbf16 = (GetBenchmarkTime() - t0) / numiterations;
+                printf(" %s %8.1f us (%4.2fx) BF16 %8.1f us", kernels[j].name, t * 1.0e6, reftime / t, tbf16 * 1.0e6);
             }
+            printf("\n");
+            AudioPluginUtil::g_FFTKernelOverride = NULL;
+
+            delete[] h;
+            delete[] x;
+            delete[] ih;
+            delete[] ix;
+            delete[] iy;
+            AudioPluginUtil::AlignedFree(hbf16);
+        }
+    }
+
+    NAP_UNITTEST(Resampler)
+    {
+        AudioPluginUtil::FFTKernel kernels[AudioPluginUtil::kMaxFFTKernels];
+        int numkernels = AudioPluginUtil::GetFFTKernels(kernels);
+
+        static const int rates[][2] = { { 44100, 48000 }, { 48000, 44100 }, { 44100, 48001 }, { 96000, 48000 } };
+        const int numinput = 441000;
+        AudioPluginUtil::Random r;
+        float* input = new float[numinput];
+        for (int n = 0; n < numinput; n++)
+            input[n] = r.GetFloat(-1.0f, 1.0f);
+        for (int i = 0; i < (int)(sizeof(rates) / sizeof(rates[0])); i++)
+        {
+            const AudioPluginUtil::Resampler* resampler = AudioPluginUtil::Resampler::Get(rates[i][0], rates[i][1]);
+            int numoutput = resampler->GetOutputLength(numinput);
+            float* output = new float[numoutput];
+
+            double t0 = GetBenchmarkTime();
+            for (int n = 0; n < numoutput; n++)
+            {
+                double pos = (double)n * rates[i][0] / rates[i][1];
+                int k = (int)pos;
+                float s1 = input[k], s2 = (k + 1 < numinput) ? input[k + 1] : 0.0f;
+                output[n] = s1 + (s2 - s1) * (float)(pos - k);
+            }
+            double reftime = GetBenchmarkTime() - t0;
+            printf("%6d Hz -> %6d Hz (%3d taps): Linear %6.1f Msamples/s", rates[i][0], rates[i][1], resampler->GetNumTaps(), numoutput * 1.0e-6 / reftime);
+
+            for (int k = 0; k < numkernels; k++)
+            {
+                AudioPluginUtil::g_FFTKernelOverride = &kernels[k];
+                t0 = GetBenchmarkTime();
+                resampler->Process(input, numinput, 1, output, numoutput, 1);
+                double t = GetBenchmarkTime() - t0;
+                printf(" %s %6.1f Msamples/s", kernels[k].name, numoutput * 1.0e-6 / t);
+            }
+            printf("\n");
+            AudioPluginUtil::g_FFTKernelOverride = NULL;
+
+            delete[] output;
         }
+        delete[] input;
     }
 }
+
+#endif
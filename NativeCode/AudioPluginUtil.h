@@ -12,6 +12,7 @@
 #   include <windows.h>
 #else
 #   include <pthread.h>
+#   include <sched.h>
 #   define strcpy_s strcpy
 #   define vsprintf_s vsprintf
 #endif
@@ -33,6 +34,23 @@ inline int FastFloor(float x) { return (int)floorf(x); } // TODO: Optimize
 char* strnew(const char* src);
 char* tmpstr(int index, const char* fmtstr, ...);
 
+// Pointer loads and stores with acquire/release semantics, used for publishing immutable data to other threads without locking.
+#if PLATFORM_WIN
+template<typename T> inline T* AtomicLoadPointer(T* volatile* p) { T* v = *p; MemoryBarrier(); return v; }
+template<typename T> inline void AtomicStorePointer(T* volatile* p, T* v) { MemoryBarrier(); *p = v; }
+template<typename T> inline T* AtomicExchangePointer(T* volatile* p, T* v) { return (T*)InterlockedExchangePointer((PVOID volatile*)p, (PVOID)v); }
+inline int AtomicLoadInt(volatile int* p) { int v = *p; MemoryBarrier(); return v; }
+inline void AtomicStoreInt(volatile int* p, int v) { MemoryBarrier(); *p = v; }
+inline bool AtomicCompareExchangeInt(volatile int* p, int expected, int desired) { return InterlockedCompareExchange((volatile LONG*)p, desired, expected) == expected; }
+#else
+template<typename T> inline T* AtomicLoadPointer(T* volatile* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+template<typename T> inline void AtomicStorePointer(T* volatile* p, T* v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+template<typename T> inline T* AtomicExchangePointer(T* volatile* p, T* v) { return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL); }
+inline int AtomicLoadInt(volatile int* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+inline void AtomicStoreInt(volatile int* p, int v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+inline bool AtomicCompareExchangeInt(volatile int* p, int expected, int desired) { return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); }
+#endif
+
 template<typename T>
 class UnityComplexNumberT
 {
@@ -106,11 +124,173 @@ public:
 
 typedef UnityComplexNumberT<float> UnityComplexNumber;
 
+// Heap memory aligned to a power of two, e.g. 64 bytes to start arrays on a cache line. Must be released with AlignedFree.
+void* AlignedAlloc(size_t size, size_t alignment);
+void AlignedFree(void* ptr);
+
+// Complex array in split (structure-of-arrays) layout, i.e. real and imaginary parts are stored in separate arrays.
+// Vector code can load a register full of real parts and one of imaginary parts directly without any shuffling, which
+// makes this the preferred layout for spectra that are multiplied and accumulated a lot, such as convolution partitions.
+// This is only a view on the two arrays and does not own them.
+struct SplitComplex
+{
+    float* re;
+    float* im;
+};
+
+// Split complex array of bfloat16 values, i.e. of the upper 16 bits of floats. This takes half the memory of SplitComplex
+// and keeps the range of float, but only about three significant decimal digits.
+struct SplitComplexBF16
+{
+    UInt16* re;
+    UInt16* im;
+};
+
+// Number of floats reserved for each half of a split complex array so that both halves start on a 64-byte boundary
+inline int GetSplitComplexStride(int numelements) { return (numelements + 15) & ~15; }
+
+// Owning split complex array. Both halves start on a 64-byte boundary.
+class SplitComplexBuffer : public SplitComplex
+{
+public:
+    SplitComplexBuffer();
+    ~SplitComplexBuffer();
+
+    void Init(int numelements); // Allocates and clears the buffer, any previous contents are released
+    void Clear();
+    inline int GetNumElements() const { return numelements; }
+
+protected:
+    SplitComplexBuffer(const SplitComplexBuffer&);
+    SplitComplexBuffer& operator=(const SplitComplexBuffer&);
+
+protected:
+    int numelements;
+    float* memory;
+};
+
+// Element-wise complex multiplication result = a * b and multiply-accumulate acc += a * b of split complex arrays.
+// The result may alias either input. Both use the same instruction set as the FFT kernels (see FFTPlan::GetKernelName),
+// and are fastest on 64-byte aligned arrays such as the ones of SplitComplexBuffer.
+void SplitComplexMul(const SplitComplex& a, const SplitComplex& b, const SplitComplex& result, int numelements);
+void SplitComplexMulAdd(const SplitComplex& a, const SplitComplex& b, const SplitComplex& acc, int numelements);
+
+// Multiply-accumulate acc += a * b with a stored as bfloat16, which is converted to float in the vector registers
+void SplitComplexMulAddBF16(const SplitComplexBF16& a, const SplitComplex& b, const SplitComplex& acc, int numelements);
+
+// Conversion between float and bfloat16. Floats are rounded to the nearest bfloat16, ties to even.
+void FloatToBF16(const float* src, UInt16* dst, int numelements);
+inline float BF16ToFloat(UInt16 x) { union { UInt32 i; float f; } u; u.i = (UInt32)x << 16; return u.f; }
+
+// Direct-form FIR filter y[n] += sum of h[k] * x[n - k] over the numtaps taps, for 0 <= n < numsamples.
+// The numtaps - 1 samples before x[0] must be valid input. Uses the same instruction set as the FFT kernels.
+void FIRMulAdd(const float* h, int numtaps, const float* x, float* y, int numsamples);
+
+// Sum of a[n] * b[n]. Uses the same instruction set as the FFT kernels.
+float DotProduct(const float* a, const float* b, int numelements);
+
 class FFT
 {
 public:
     static void Forward(UnityComplexNumber* data, int numsamples, bool highprecision);
     static void Backward(UnityComplexNumber* data, int numsamples, bool highprecision);
+
+    // Transforms of purely real signals. The spectrum only holds the numsamples / 2 + 1 bins from DC to Nyquist,
+    // since the remaining ones are the complex conjugates of these. Input and output may point to the same memory.
+    // BackwardReal uses the spectrum as scratch space, so its contents are destroyed.
+    static void ForwardReal(const float* input, UnityComplexNumber* spectrum, int numsamples, bool highprecision);
+    static void BackwardReal(UnityComplexNumber* spectrum, float* output, int numsamples, bool highprecision);
+
+    // Transform numsignals independent signals of the same length in one call, e.g. all channels of a bus.
+    // Each twiddle factor is loaded once and applied to every signal, which amortizes table lookups and loop overhead.
+    static void ForwardBatch(UnityComplexNumber* const* data, int numsignals, int numsamples, bool highprecision);
+    static void BackwardBatch(UnityComplexNumber* const* data, int numsignals, int numsamples, bool highprecision);
+    static void ForwardRealBatch(const float* const* input, UnityComplexNumber* const* spectrum, int numsignals, int numsamples, bool highprecision);
+    static void BackwardRealBatch(UnityComplexNumber* const* spectrum, float* const* output, int numsignals, int numsamples, bool highprecision);
+
+    // The same transforms on split complex data. Here the real-input transforms require that input or output
+    // do not overlap the spectrum, since the samples are deinterleaved into the real and imaginary arrays.
+    static void Forward(const SplitComplex& data, int numsamples, bool highprecision);
+    static void Backward(const SplitComplex& data, int numsamples, bool highprecision);
+    static void ForwardReal(const float* input, const SplitComplex& spectrum, int numsamples, bool highprecision);
+    static void BackwardReal(const SplitComplex& spectrum, float* output, int numsamples, bool highprecision);
+};
+
+// Precomputed permutation and twiddle tables for transforms of one particular length and precision.
+// Plans are created on first request and are immutable from then on, so the same plan may be used by any number of threads at once.
+// They are owned by a global registry and stay alive until the library is unloaded, so it is safe to hold on to the returned pointer.
+// Creating a plan allocates memory, so plugins should fetch their plans outside of the process callback where possible.
+class FFTPlan
+{
+public:
+    // Any length whose prime factors are at most 64 is supported, e.g. 480 = 2^5 * 3 * 5 or 441 = 3^2 * 7^2. Powers of two use the fastest code path.
+    // The real-input transforms additionally require an even length.
+    static const FFTPlan* Get(int numsamples, bool highprecision);
+    static bool IsSupportedSize(int numsamples);
+
+public:
+    void Forward(UnityComplexNumber* data) const;
+    void Backward(UnityComplexNumber* data) const;
+
+    // Real-input transforms of length numsamples with the same conventions as FFT::ForwardReal and FFT::BackwardReal.
+    void ForwardReal(const float* input, UnityComplexNumber* spectrum) const;
+    void BackwardReal(UnityComplexNumber* spectrum, float* output) const;
+
+    // Batched transforms with the same conventions as FFT::ForwardBatch etc.
+    void ForwardBatch(UnityComplexNumber* const* data, int numsignals) const;
+    void BackwardBatch(UnityComplexNumber* const* data, int numsignals) const;
+    void ForwardRealBatch(const float* const* input, UnityComplexNumber* const* spectrum, int numsignals) const;
+    void BackwardRealBatch(UnityComplexNumber* const* spectrum, float* const* output, int numsignals) const;
+
+    // Split complex versions of all of the above, see FFT::ForwardReal(const float*, const SplitComplex&, ...) for the differences.
+    void Forward(const SplitComplex& data) const;
+    void Backward(const SplitComplex& data) const;
+    void ForwardReal(const float* input, const SplitComplex& spectrum) const;
+    void BackwardReal(const SplitComplex& spectrum, float* output) const;
+    void ForwardBatch(const SplitComplex* data, int numsignals) const;
+    void BackwardBatch(const SplitComplex* data, int numsignals) const;
+    void ForwardRealBatch(const float* const* input, const SplitComplex* spectrum, int numsignals) const;
+    void BackwardRealBatch(const SplitComplex* spectrum, float* const* output, int numsignals) const;
+
+    // Real-input transforms of two signals at once, which are the real and imaginary parts of one complex transform of length numsamples.
+    // The spectra are the same as those of ForwardReal and BackwardReal. The forward transform needs a scratch buffer of numsamples
+    // complex values, the backward transform uses the outputs for it, which therefore must not overlap the spectra.
+    void ForwardRealPair(const float* input1, const float* input2, const SplitComplex& spectrum1, const SplitComplex& spectrum2, const SplitComplex& scratch) const;
+    void BackwardRealPair(const SplitComplex& spectrum1, const SplitComplex& spectrum2, float* output1, float* output2) const;
+
+    inline int GetNumSamples() const { return numsamples; }
+    inline int GetNumBins() const { return numsamples / 2 + 1; }
+    inline bool IsHighPrecision() const { return highprecision; }
+
+    // Name of the kernel used for single-precision transforms on this CPU, e.g. "Scalar", "SSE2", "AVX2" or "NEON".
+    static const char* GetKernelName();
+
+protected:
+    FFTPlan(int numsamples, bool highprecision);
+    ~FFTPlan();
+
+    void InitRadix2();
+    void InitMixedRadix();
+    int GetBatchGroupSize() const;
+    void ProcessGroup(UnityComplexNumber* const* data, int numsignals, bool forward) const;
+    void ProcessGroup(const SplitComplex* data, int numsignals, bool forward) const;
+
+    friend class FFTPlanRegistry;
+
+protected:
+    int numsamples;
+    bool highprecision;
+    int numswaps;
+    unsigned int* swaps;                        // Index pairs to exchange in order to apply the bit-reversal (or digit-reversal) permutation
+    int numstages;
+    int* stages;                                // Radix, span and twiddle offset of each stage for lengths that are not a power of two, NULL otherwise
+    UnityComplexNumberT<float>* twiddlesf;      // exp(-i*pi*m/j) for the butterfly stage of span j stored at index j - 1 + m, so each stage reads its twiddles linearly
+    UnityComplexNumberT<double>* twiddlesd;     // Same as above for high-precision plans
+    float* splittwiddlesf;                      // Real parts of twiddlesf followed by the imaginary parts for the split complex kernels, NULL for mixed-radix and high-precision plans
+    UnityComplexNumberT<float>* realtwiddlesf;  // exp(-2*i*pi*k/numsamples) for k = 0..numsamples/4, used to split the half-length transform in the real-input transforms
+    UnityComplexNumberT<double>* realtwiddlesd;
+    const FFTPlan* half;                        // Complex plan of length numsamples / 2 used by the real-input transforms
+    FFTPlan* next;
 };
 
 class FFTAnalyzer : public FFT
@@ -132,10 +312,350 @@ public:
     float* ispec2;
     float* ospec1;
     float* ospec2;
+    const FFTPlan* plan;
     int spectrumSize;
     int numSpectraReady;
 };
 
+// Impulse response cut into partitions for PartitionedConvolver. The partitions are grouped into segments: the first one
+// uses partitions of the processing block size, and each following segment doubles the partition size up to maxpartitionsize.
+// The cost per sample of the convolution thus grows with the logarithm of the length rather than with length / blocksize.
+// Each partition is stored as the spectrum of its transform zero-padded to twice the partition size. Immutable once initialized.
+//
+// Optionally the first headlength samples are kept as they are and convolved directly by PartitionedConvolver (see FIRMulAdd).
+// The segments then start after the head, and since their output is not needed until headlength samples later, the first
+// segment can use partitions of up to headlength + blocksize samples instead of the block size.
+//
+// The spectra of all segments but the first can also be stored as bfloat16, which halves the memory that long responses take
+// and stream through on every block. The error this adds is roughly 50 dB below the output of those segments.
+class PartitionedIR
+{
+public:
+    enum SpectrumFormat
+    {
+        kFloat32,
+        kBFloat16
+    };
+
+    struct Segment
+    {
+        int partitionsize;
+        int numpartitions;
+        int offset;                 // Position of the first partition in the impulse response
+        int stride;                 // Elements per half spectrum, see GetSplitComplexStride. Spectra are 2 * stride elements apart.
+        int spectraoffset;          // Position of the first spectrum of the segment in the slab of each channel, in floats
+        SpectrumFormat format;
+        const FFTPlan* plan;        // Real-input transform of length 2 * partitionsize
+    };
+
+    enum { kPartitionsPerSegment = 4 };
+
+    PartitionedIR();
+    ~PartitionedIR();
+
+    // blocksize must be a length supported by FFTPlan. Longer partitions than maxpartitionsize are never used,
+    // but the first segment always uses at least the block size. The head is shortened to leave at least one sample for the partitions.
+    // tailformat is used for all segments but the first.
+    void Init(const float* const* impulse, int numchannels, int numsamples, int blocksize, int maxpartitionsize, int headlength = 0, SpectrumFormat tailformat = kFloat32);
+
+    inline int GetNumChannels() const { return numchannels; }
+    inline int GetBlockSize() const { return blocksize; }
+    inline int GetNumSegments() const { return numsegments; }
+    inline const Segment& GetSegment(int index) const { return segments[index]; }
+    inline const float* GetSpectra(int channel, int segment) const { return spectra[channel] + segments[segment].spectraoffset; } // Real parts of the first partition, followed by its imaginary parts and then the next partitions
+    inline SplitComplex GetSpectrum(int channel, int segment, int partition) const { const Segment& s = segments[segment]; float* p = spectra[channel] + s.spectraoffset + partition * 2 * s.stride; SplitComplex c = { p, p + s.stride }; return c; } // Only for kFloat32 segments
+    inline SplitComplexBF16 GetSpectrumBF16(int channel, int segment, int partition) const { const Segment& s = segments[segment]; UInt16* p = (UInt16*)(spectra[channel] + s.spectraoffset) + partition * 2 * s.stride; SplitComplexBF16 c = { p, p + s.stride }; return c; } // Only for kBFloat16 segments
+    inline int GetSlabSize() const { return slabsize; } // Number of floats taken by the spectra of each channel
+    inline int GetLength() const { return length; } // Number of samples covered by the head and all partitions
+    inline int GetHeadLength() const { return headlength; }
+    inline const float* GetHead(int channel) const { return head[channel]; }
+
+protected:
+    PartitionedIR(const PartitionedIR&);
+    PartitionedIR& operator=(const PartitionedIR&);
+    void Cleanup();
+    void InitSegments(const Segment* layout);
+    static int GetSegmentSize(const Segment& seg) { return seg.numpartitions * ((seg.format == kBFloat16) ? 1 : 2) * seg.stride; }
+    friend class IRLibrary;
+
+protected:
+    int numchannels;
+    int blocksize;
+    int length;
+    int numsegments;
+    int headlength;
+    int slabsize;
+    Segment* segments;
+    float** spectra;                // One 64-byte aligned slab per channel with the spectra of all partitions in order
+    float** head;                   // First headlength samples of each channel, NULL without a head
+    bool mapped;                    // The spectra and head are owned by an IRLibrary
+};
+
+class ConvolutionThreadPool;
+
+// Convolution of each channel of a signal with the corresponding channel of a PartitionedIR. Every segment is processed
+// by overlap-save with its own partition size once enough input has accumulated, and its output is scheduled at the
+// delay of the segment, so the result is the same as convolving with the whole response at once with no added latency.
+// The head of the response, if any, is convolved directly with each block.
+//
+// In matrix mode the response holds one channel per pair of input and output channel instead, e.g. the four paths of a
+// true-stereo response. Each input is still only transformed once, and its spectra are shared by all the paths from it.
+//
+// With a ConvolutionThreadPool, all segments except the first one are handed to the worker threads instead. Their output
+// is not needed until at least two blocks later, and the result is collected at the latest possible block. If the workers
+// have not started on it by then, the calling thread processes the segment itself, so the output stays the same.
+class PartitionedConvolver
+{
+public:
+    PartitionedConvolver();
+    ~PartitionedConvolver();
+
+    // The response (and thread pool, if any) must stay alive while the convolver uses it. With numinputs = 0 every channel is
+    // convolved with its own channel of the response. Otherwise this selects matrix mode with ir->GetNumChannels() / numinputs
+    // outputs, and the response channels are ordered by input and then output, i.e. LL, LR, RL, RR for true stereo.
+    void Init(const PartitionedIR* ir, ConvolutionThreadPool* pool = NULL, int numinputs = 0);
+    void Reset();                       // Clears all input history and pending output. Must not be called during Process.
+
+    // Processes one block of ir->GetBlockSize() samples per channel. Input and output may point to the same memory.
+    void Process(const float* const* input, float* const* output);
+
+    inline int GetNumInputs() const { return numinputs; }
+    inline int GetNumOutputs() const { return numoutputs; }
+
+protected:
+    PartitionedConvolver(const PartitionedConvolver&);
+    PartitionedConvolver& operator=(const PartitionedConvolver&);
+    void Cleanup();
+    void TransformSegment(int index);
+    void AccumulateSegment(int index);
+    void FinishSegment(int index);
+    int ClaimQueuedSegment();
+    inline int GetPath(int input, int output) const { return matrix ? (input * numoutputs + output) : output; } // Channel of the response
+    friend class ConvolutionThreadPool;
+
+    enum { kIdle, kQueued, kRunning, kDone };
+
+    // The frequency-domain delay line of a segment has 2 * numpartitions slots and every input spectrum is stored twice,
+    // numpartitions slots apart, so that the numpartitions most recent spectra always follow each other in memory
+    // starting at the newest one and the partition sum streams through both the response and the delay line linearly.
+    struct SegmentState
+    {
+        int index;                  // Slot that receives the next input spectrum, counting down
+        int spectraoffset;          // Position of the delay line of the segment in the slab of each channel
+        int historyend;             // End of the input that the current transform reads from history
+        int outputoffset;           // Position in outputs where the current result is added
+        int countdown;              // Blocks left until a result computed by the thread pool has to be added to outputs
+        volatile int job;           // kIdle, kQueued, kRunning or kDone, see ConvolutionThreadPool
+        float** blocks;             // Scratch buffers for the transforms of each input, holding the result of each output afterwards
+        SplitComplexBuffer* sums;   // Scratch spectra for the partition sums of each output
+        SplitComplex* xviews;       // Per-channel arguments of the batched transforms
+        SplitComplex* yviews;
+    };
+
+protected:
+    const PartitionedIR* ir;
+    ConvolutionThreadPool* pool;
+    PartitionedConvolver* nextinpool;
+    int numinputs;
+    int numoutputs;
+    bool matrix;
+    int blockcount;
+    int historylength;
+    int historypos;
+    int outputlength;
+    int outputpos;
+    int spectralength;
+    float** history;                // Most recent input of each input channel, enough for the transform of the longest partition
+    float** headinput;              // Last headlength - 1 input samples of each input channel followed by the current block, for the head of the response
+    float** outputs;                // Output of each output channel accumulated ahead of time by the segments with larger partitions
+    SegmentState* states;
+    float** spectra;                // One 64-byte aligned slab per input channel with the delay lines of all segments
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool Open(const char* filename);
+    void Close();
+    inline const void* GetData() const { return data; }
+    inline size_t GetSize() const { return size; }
+
+protected:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+protected:
+#if PLATFORM_WIN
+    HANDLE file;
+    HANDLE mapping;
+#endif
+    const void* data;
+    size_t size;
+};
+
+// File of impulse responses that have already been partitioned and transformed by PartitionedIR, each one stored for a particular
+// block size, sample rate and channel count. The file is memory-mapped, and the PartitionedIRs of its entries point straight at the
+// mapped spectra, so that opening even a large library costs neither transforms nor copies.
+//
+// The file is written in the byte order of the machine, which is checked when it is opened. It starts with a FileHeader, followed
+// by the FileEntry of each impulse response. The data of an entry starts 64-byte aligned at its offset, with a FileSegment for
+// each segment, padded to 64 bytes, and then for each channel the spectra in the layout of PartitionedIR followed by the head,
+// again padded to 64 bytes.
+class IRLibrary
+{
+public:
+    struct Entry
+    {
+        const char* name;           // At most kMaxNameLength characters
+        int samplerate;
+        const PartitionedIR* ir;
+    };
+
+    enum { kMaxNameLength = 63 };
+
+    IRLibrary();
+    ~IRLibrary();
+
+    bool Open(const char* filename);    // False if the file can't be mapped or is not a valid library
+    void Close();                       // Must not be called while PartitionedIRs of the library are in use
+    inline int GetNumEntries() const { return numentries; }
+    const char* GetName(int index) const;
+    int Find(const char* name, int blocksize, int samplerate, int numchannels) const; // Index of a matching entry, or -1
+
+    // Initializes ir to use the spectra of an entry in place. The library must stay open for as long as ir is in use.
+    void GetEntry(int index, PartitionedIR& ir) const;
+
+    static bool Write(const char* filename, const Entry* entries, int numentries);
+
+protected:
+    IRLibrary(const IRLibrary&);
+    IRLibrary& operator=(const IRLibrary&);
+
+    enum { kVersion = 2 };
+
+    struct FileHeader
+    {
+        char magic[8];              // "NAPIRLIB"
+        UInt32 version;
+        UInt32 numentries;
+    };
+
+    struct FileEntry
+    {
+        char name[kMaxNameLength + 1];
+        UInt32 samplerate;
+        UInt32 blocksize;
+        UInt32 numchannels;
+        UInt32 length;
+        UInt32 headlength;
+        UInt32 numsegments;
+        UInt64 offset;              // Position of the data of the entry in the file
+    };
+
+    struct FileSegment
+    {
+        UInt32 partitionsize;
+        UInt32 numpartitions;
+        UInt32 offset;
+        UInt32 stride;              // Must match GetSplitComplexStride, so that the spectra can be used as they are
+        UInt32 format;              // PartitionedIR::SpectrumFormat
+    };
+
+    static int GetHeadSize(int headlength) { return (headlength + 15) & ~15; }
+    static size_t GetSegmentTableSize(int numsegments) { return (numsegments * sizeof(FileSegment) + 63) & ~(size_t)63; }
+    static bool ReadSegments(const FileEntry& entry, const FileSegment* filesegments, PartitionedIR::Segment* layout);
+
+protected:
+    MappedFile file;
+    const FileEntry* entries;
+    int numentries;
+};
+
+// Sample rate conversion by a fixed ratio with a Kaiser-windowed sinc filter. The filter is stored as a bank of phases, one per
+// fractional position of the output samples between the input samples, so that every output sample is a single DotProduct.
+// Ratios of rates with a small common divisor (e.g. 44100 to 48000) use the exact phases, other ones interpolate between
+// kMaxPhases phases. The passband reaches about 0.42 times the lower of the two rates, everything from its Nyquist frequency
+// on is attenuated by about 80 dB. Immutable once created, so one converter serves all users of the same ratio.
+class Resampler
+{
+public:
+    enum { kMaxPhases = 512, kNumTaps = 64 };
+
+    static const Resampler* Get(int inrate, int outrate);
+
+public:
+    inline int GetInputRate() const { return inrate; }
+    inline int GetOutputRate() const { return outrate; }
+    inline int GetNumTaps() const { return numtaps; } // Length of the filter in input samples, kNumTaps at the lower rate
+    int GetOutputLength(int numinput) const; // Number of output samples covering numinput input samples
+
+    // Converts numinput samples spaced inputstride floats apart, e.g. one channel of an interleaved buffer, to numoutput samples
+    // spaced outputstride floats apart. Output sample n is taken at input position n * inrate / outrate, samples outside of the
+    // input are zero. Allocates a temporary copy of the input, so this is meant for preparing data rather than the audio thread.
+    void Process(const float* input, int numinput, int inputstride, float* output, int numoutput, int outputstride) const;
+
+protected:
+    Resampler(int inrate, int outrate);
+    ~Resampler();
+
+    friend class ResamplerRegistry;
+
+protected:
+    int inrate;
+    int outrate;
+    int upfactor;                   // outrate and inrate divided by their greatest common divisor
+    int downfactor;
+    int numphases;
+    int numtaps;
+    float* filters;                 // numphases + 1 phases of numtaps coefficients, the last one being the first shifted by a sample
+    Resampler* next;
+};
+
+// Staging buffer for a sample that scripts upload in chunks. The buffer is allocated and filled without touching the sample in use,
+// which is then swapped for it as a whole, so that threads using the sample never wait for a large allocation or copy. Not thread-safe
+// by itself, the plugins protect their uploads with a mutex that the audio thread doesn't take.
+class SampleUpload
+{
+public:
+    SampleUpload();
+    ~SampleUpload();
+
+public:
+    // Discards any upload in progress and allocates the staging buffer for numsamples frames of numchannels (at most 8) interleaved channels
+    bool Begin(int numsamples, int numchannels, int samplerate, const char* name);
+
+    // Copies the next numsamples frames to the staging buffer. Fails without an upload in progress or if they don't fit.
+    bool Append(const float* data, int numsamples);
+
+    // Hands the staging buffer over to the caller, who deletes it with delete[], and ends the upload. NULL for an empty sample.
+    float* Detach();
+
+public:
+    inline bool IsActive() const { return active; }
+    inline bool IsComplete() const { return active && filled == numsamples; }
+    inline int GetNumSamples() const { return numsamples; }
+    inline int GetNumChannels() const { return numchannels; }
+    inline int GetSampleRate() const { return samplerate; }
+    inline const char* GetName() const { return name; }
+
+protected:
+    SampleUpload(const SampleUpload&);
+    SampleUpload& operator=(const SampleUpload&);
+
+protected:
+    float* data;
+    int numsamples;
+    int numchannels;
+    int samplerate;
+    int filled;                     // Frames appended so far
+    bool active;
+    char name[1024];
+};
+
 class HistoryBuffer
 {
 public:
@@ -468,6 +988,89 @@ protected:
     Mutex* mutex;
 };
 
+// Auto-resetting event: Wait blocks until Signal has been called at least once since the last Wait returned.
+class Event
+{
+public:
+    Event();
+    ~Event();
+public:
+    void Signal();
+    void Wait();
+protected:
+#if PLATFORM_WIN
+    HANDLE handle;
+#else
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool signaled;
+#endif
+};
+
+class Thread
+{
+public:
+    typedef void (*ThreadFunc)(void* arg);
+    Thread();
+    ~Thread();
+public:
+    void Start(ThreadFunc func, void* arg);
+    void Join();
+    bool IsRunning() const { return running; }
+    static void YieldTimeSlice();       // Lets other threads run on this core, for short waits on another thread
+protected:
+    Thread(const Thread&);
+    Thread& operator=(const Thread&);
+#if PLATFORM_WIN
+    static DWORD WINAPI Run(LPVOID arg);
+    HANDLE handle;
+#else
+    static void* Run(void* arg);
+    pthread_t thread;
+#endif
+    ThreadFunc func;
+    void* arg;
+    bool running;
+};
+
+// Worker threads shared by any number of PartitionedConvolvers. The audio thread never takes a lock of the pool: it queues and
+// collects segments through an atomic state per segment and wakes the workers. It only waits when a worker is still busy with
+// a segment whose result is due. Before Init the pool has no workers and the calling thread processes all segments itself.
+class ConvolutionThreadPool
+{
+public:
+    ConvolutionThreadPool();
+    ~ConvolutionThreadPool();
+
+    void Init(int numthreads);
+    inline int GetNumThreads() const { return numthreads; }
+
+protected:
+    ConvolutionThreadPool(const ConvolutionThreadPool&);
+    ConvolutionThreadPool& operator=(const ConvolutionThreadPool&);
+    void Cleanup();
+    static void WorkerThread(void* arg);
+    bool RunQueuedSegment();
+    friend class PartitionedConvolver;
+    void Register(PartitionedConvolver* convolver);
+    void Unregister(PartitionedConvolver* convolver);
+    void Wake();
+
+    struct Worker
+    {
+        ConvolutionThreadPool* pool;
+        Event wakeup;
+        Thread thread;
+    };
+
+protected:
+    Mutex mutex;                        // Protects the list of convolvers
+    PartitionedConvolver* convolvers;
+    int numthreads;
+    Worker* workers;
+    volatile bool quit;
+};
+
 void RegisterParameter(
     UnityAudioEffectDefinition& desc,
     const char* name,
@@ -499,3 +1102,28 @@ void DeclareEffect(
     );
 
 } // namespace AudioPluginUtil
+
+// Simplistic unit-test framework, also used by the plugins. The tests run while the library is being loaded.
+#define ENABLE_TESTS ((PLATFORM_WIN || PLATFORM_OSX) && 1)
+#if ENABLE_TESTS
+    #define NAP_TESTSUITE(name) \
+        namespace testsuite_##name { inline const char* GetSuiteName() { return #name; } }\
+        namespace testsuite_##name
+    #define NAP_UNITTEST(name) \
+        struct NAP_Test_##name { NAP_Test_##name(const char* testname); };\
+        static NAP_Test_##name test_##name(#name);\
+        NAP_Test_##name::NAP_Test_##name(const char* testname)
+    #define NAP_CHECK(...) \
+        do\
+        {\
+            if(!(__VA_ARGS__))\
+            {\
+                printf("%s(%d): Unit test '%s' failed for expression '%s'.\n", __FILE__, __LINE__, testname, #__VA_ARGS__);\
+                assert(false && "Unit test in native audio plugin framework failed!");\
+            }\
+        } while(false)
+#else
+    #define NAP_TESTSUITE(name) namespace testsuite_##name
+    #define NAP_UNITTEST(name) static void test_##name()
+    #define NAP_CHECK(...) do {} while(false)
+#endif
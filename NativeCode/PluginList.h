@@ -14,6 +14,7 @@ DECLARE_EFFECT("Demo TeeDee9o9", TeeDee)
 DECLARE_EFFECT("Demo TubeResonator", TubeResonator)
 DECLARE_EFFECT("Demo Vocoder", Vocoder)
 DECLARE_EFFECT("Demo WahWah", WahWah)
+DECLARE_EFFECT("Demo AmbisonicDecoder", AmbisonicDecoder)
 DECLARE_EFFECT("Demo ConvolutionReverb", ConvolutionReverb)
 DECLARE_EFFECT("Demo CorrelationMeter", CorrelationMeter)
 DECLARE_EFFECT("Demo Granulator", Granulator)
@@ -21,6 +22,7 @@ DECLARE_EFFECT("Demo LoudnessMeter", LoudnessMeter)
 DECLARE_EFFECT("Demo Oscilloscope", Oscilloscope)
 DECLARE_EFFECT("Demo Routing", Routing)
 DECLARE_EFFECT("Demo Spatializer", Spatializer)
+DECLARE_EFFECT("Demo Spatializer Ambisonic Bus", SpatializerAmbisonicBus)
 DECLARE_EFFECT("Demo Spatializer Reverb", SpatializerReverb)
 
 #if PLATFORM_OSX | PLATFORM_LINUX | PLATFORM_WIN
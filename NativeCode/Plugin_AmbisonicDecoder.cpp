@@ -0,0 +1,127 @@
+// Please note that this will only work on Unity 2017.1 or higher.
+// Binaural decoder for first to third order ambisonic sources (ACN/SN3D) that uses the Spatializer's HRTFs through a fixed set of virtual
+// speakers, see Spatializer::DecodeAmbisonic.
+
+#include "AudioPluginUtil.h"
+#include "Spatializer.h"
+
+namespace AmbisonicDecoder
+{
+    enum
+    {
+        P_MAXORDER,
+        P_NUM
+    };
+
+    struct EffectData
+    {
+        float p[P_NUM];
+        Spatializer::AmbisonicDecoder* decoder;
+    };
+
+    inline bool IsHostCompatible(UnityAudioEffectState* state)
+    {
+        // ambisonicdata is only supported from SDK version 1.04 (i.e. Unity 2017.1) and onwards.
+        return
+            state->structsize >= sizeof(UnityAudioEffectState) &&
+            state->hostapiversion >= 0x010400;
+    }
+
+    int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition)
+    {
+        int numparams = P_NUM;
+        definition.paramdefs = new UnityAudioParameterDefinition[numparams];
+        AudioPluginUtil::RegisterParameter(definition, "Max Order", "", 1.0f, 3.0f, 3.0f, 1.0f, 1.0f, P_MAXORDER, "Highest ambisonic order that is decoded. Lower orders need fewer transforms but give a less sharp image.");
+        definition.flags |= UnityAudioEffectDefinitionFlags_IsAmbisonicDecoder;
+        return numparams;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
+    {
+        EffectData* effectdata = new EffectData;
+        memset(effectdata, 0, sizeof(EffectData));
+        effectdata->decoder = Spatializer::CreateAmbisonicDecoder();
+        state->effectdata = effectdata;
+        AudioPluginUtil::InitParametersFromDefinitions(InternalRegisterEffectDefinition, effectdata->p);
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        Spatializer::ReleaseAmbisonicDecoder(data->decoder);
+        delete data;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback(UnityAudioEffectState* state, int index, float value)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (index >= P_NUM)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        data->p[index] = value;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback(UnityAudioEffectState* state, int index, float* value, char *valuestr)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (index >= P_NUM)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        if (value != NULL)
+            *value = data->p[index];
+        if (valuestr != NULL)
+            valuestr[0] = 0;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    int UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples)
+    {
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels)
+    {
+        if (inchannels < 4 || outchannels < 2)
+        {
+            memset(outbuffer, 0, length * outchannels * sizeof(float));
+            return UNITY_AUDIODSP_OK;
+        }
+
+        EffectData* data = state->GetEffectData<EffectData>();
+
+        if (IsHostCompatible(state) && state->ambisonicdata != NULL)
+        {
+            // The sound field turns with the source and against the listener. Combine both rotations (the matrices are column-major), leaving
+            // out any scaling of the source.
+            const float* m = state->ambisonicdata->listenermatrix;
+            const float* s = state->ambisonicdata->sourcematrix;
+            float r[3][3];
+            for (int c = 0; c < 3; c++)
+            {
+                float len = 0.0f;
+                for (int i = 0; i < 3; i++)
+                {
+                    r[i][c] = m[i] * s[c * 4] + m[4 + i] * s[c * 4 + 1] + m[8 + i] * s[c * 4 + 2];
+                    len += r[i][c] * r[i][c];
+                }
+                len = (len > 0.0f) ? (1.0f / sqrtf(len)) : 0.0f;
+                for (int i = 0; i < 3; i++)
+                    r[i][c] *= len;
+            }
+
+            // Ambisonics uses x front, y left and z up, while Unity has x right, y up and z front
+            static const int axis[3] = { 2, 0, 1 };
+            static const float sign[3] = { 1.0f, -1.0f, 1.0f };
+            float rotation[9];
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    rotation[i * 3 + j] = sign[i] * sign[j] * r[axis[i]][axis[j]];
+            Spatializer::SetAmbisonicRotation(data->decoder, rotation);
+        }
+
+        Spatializer::DecodeAmbisonic(data->decoder, inbuffer, inchannels, (int)data->p[P_MAXORDER], outbuffer, outchannels, length);
+
+        return UNITY_AUDIODSP_OK;
+    }
+}
@@ -4,8 +4,13 @@ namespace ConvolutionReverb
 {
     const float MAXLENGTH = 15.0f;
     const int MAXSAMPLE = 16;
+    const int MAXPARTITIONSIZE = 8192; // Largest partition used for the tail of long impulse responses
+    const int MAXHEADLENGTH = 2048;     // Longest part of the impulse response that may be convolved directly in the time domain
+    const float MINTRIMFLOOR = -150.0f; // Trim floor at which impulse responses are not trimmed at all
+    const int MAXLIBRARYIR = 256;       // Number of impulse response names that the "Use Library" parameter can select from
 
     AudioPluginUtil::Mutex sampleMutex;
+    AudioPluginUtil::Mutex uploadMutex;     // Protects the uploads in progress, which are only swapped into the samples under sampleMutex when committed
 
     struct IRSample
     {
@@ -30,8 +35,48 @@ namespace ConvolutionReverb
         return samples[index];
     }
 
+    inline AudioPluginUtil::SampleUpload& GetUpload(int index)
+    {
+        static AudioPluginUtil::SampleUpload uploads[MAXSAMPLE];
+        return uploads[index];
+    }
+
     int globalupdatecount = 0;
 
+    // Impulse response library loaded via ConvolutionReverb_LoadLibrary. Shared impulse responses built from it hold a reference,
+    // so that the mapping outlives them when another library is loaded.
+    struct MappedLibrary
+    {
+        AudioPluginUtil::IRLibrary file;
+        int refcount;
+    };
+
+    MappedLibrary* library = NULL;      // Protected by sampleMutex
+    int libraryupdatecount = 0;
+
+    static void ReleaseLibrary(MappedLibrary* lib)
+    {
+        if (lib == NULL)
+            return;
+        AudioPluginUtil::MutexScopeLock mutexScope(sampleMutex);
+        if (--lib->refcount == 0)
+            delete lib;
+    }
+
+    // Library entries are selected by name, the block size, sample rate and channel count are matched when the impulse response is built
+    static const char* GetLibraryName(const AudioPluginUtil::IRLibrary& lib, int index)
+    {
+        for (int i = 0; i < lib.GetNumEntries(); i++)
+        {
+            int k = 0;
+            while (k < i && strcmp(lib.GetName(k), lib.GetName(i)) != 0)
+                k++;
+            if (k == i && index-- == 0)
+                return lib.GetName(i);
+        }
+        return NULL;
+    }
+
     enum Param
     {
         P_WET,
@@ -45,31 +90,86 @@ namespace ConvolutionReverb
         P_RESONANCE,
         P_USESAMPLE,
         P_REVERSE,
+        P_THREADED,
+        P_HEADLENGTH,
+        P_LIBRARY,
+        P_TRIMFLOOR,
+        P_HALFPRECISION,
+        P_TRUESTEREO,
         P_NUM
     };
 
-    struct Channel
+    // Parameters that an impulse response is built from. The audio thread compares these against the last request to decide when to
+    // ask the worker for a new impulse response.
+    struct ImpulseRequest
     {
-        AudioPluginUtil::UnityComplexNumber** h;
-        AudioPluginUtil::UnityComplexNumber** x;
-        float* impulse;
-        float* s;
+        float p[P_NUM];
+        int numchannels;
+        int hopsize;
+        int samplerate;
+        int sampleupdatecount;
+        int libraryupdatecount;
     };
 
-    struct EffectData
+    // Partitioned spectra and GUI preview of an impulse response. These never change once built, so all instances requesting
+    // the same impulse response share one copy through the cache below.
+    struct SharedImpulse
+    {
+        ImpulseRequest key;
+        int refcount;
+        AudioPluginUtil::Mutex buildmutex;                  // Held by the instance that builds the impulse response until it is done
+        AudioPluginUtil::PartitionedIR ir;
+        float* preview;                                     // Pre-integrated impulse responses of all channels
+        int previewsamples;
+        MappedLibrary* library;                             // Owner of the spectra when ir was taken from a library, otherwise NULL
+        SharedImpulse* next;
+
+        SharedImpulse() : refcount(0), preview(NULL), previewsamples(0), library(NULL), next(NULL) {}
+        ~SharedImpulse() { delete[] preview; ReleaseLibrary(library); }
+    };
+
+    AudioPluginUtil::Mutex cacheMutex;
+    SharedImpulse* impulsecache = NULL;
+
+    // Worker threads for the tails of all instances with "Threaded Tail" enabled, started when the first one needs them. The pool lives
+    // from the first instance to the last one rather than as a static object, since threads cannot be started or joined while the
+    // library is being loaded or unloaded.
+    const int NUMTAILTHREADS = 2;
+    AudioPluginUtil::Mutex threadPoolMutex;
+    AudioPluginUtil::ConvolutionThreadPool* threadpool = NULL;
+    int threadpoolrefcount = 0;
+
+    // Shared impulse response with the convolution state of one instance, prepared on the worker thread and handed to the audio thread as a whole
+    struct Impulse
     {
-        AudioPluginUtil::Mutex* mutex;
-        float p[P_NUM];
         int numchannels;
-        int numpartitions;
-        int fftsize;
         int hopsize;
-        int bufferindex;
-        int writeoffset;
-        int samplerate;
-        float lastparams[P_NUM];
-        AudioPluginUtil::UnityComplexNumber* tmpoutput;
-        Channel* channels;
+        SharedImpulse* shared;
+        AudioPluginUtil::PartitionedConvolver* convolver;
+        float* tmpbuffer;
+        float** blocks;                                     // Per-channel views into tmpbuffer, collecting input and holding the wet output of the last block
+
+        Impulse() : shared(NULL), convolver(NULL), tmpbuffer(NULL), blocks(NULL) {}
+        ~Impulse();
+    };
+
+    struct EffectData
+    {
+        AudioPluginUtil::Mutex* mutex;                      // Protects request, dirty and the preview data
+        float p[P_NUM];
+        ImpulseRequest request;                             // Most recently requested impulse parameters
+        ImpulseRequest processrequest;                      // Last request made by the audio thread, only accessed by it
+        bool dirty;                                         // Request has not been picked up by the worker yet
+        Impulse* current;                                   // Impulse response in use by the audio thread
+        Impulse* fading;                                    // Previous impulse response, faded out over the block in which it was replaced
+        Impulse* volatile pending;                          // Published by the worker, taken over by the audio thread
+        Impulse* volatile retired;                          // Handed back by the audio thread, deleted by the worker
+        AudioPluginUtil::Thread* worker;
+        AudioPluginUtil::Event* wakeup;
+        volatile bool quit;
+        SharedImpulse* preview;                             // Most recently prepared impulse response, shown by the GUI
+        int fill;                                           // Samples of the current block collected in current->blocks
+        int latency;                                        // 0 while the callbacks line up with the blocks, otherwise one block
     };
 
     int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition)
@@ -87,69 +187,108 @@ namespace ConvolutionReverb
         AudioPluginUtil::RegisterParameter(definition, "Resonance", "%", 0.0f, 1.0f, 0.0f, 100.0f, 3.0f, P_RESONANCE, "Resonance amount of filter (applied both to synthetic and sample impulse responses)");
         AudioPluginUtil::RegisterParameter(definition, "Use Sample", "", -1.0f, MAXSAMPLE - 1, -1.0f, 1.0f, 1.0f, P_USESAMPLE, "-1 = use synthetic impulse response, otherwise indicates the slot of a sample uploaded by scripts via ConvolutionReverb_UploadSample");
         AudioPluginUtil::RegisterParameter(definition, "Reverse", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_REVERSE, "Reverse impulse response for scary effects ;-)");
+        AudioPluginUtil::RegisterParameter(definition, "Threaded Tail", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_THREADED, "1 = convolve the later parts of long impulse responses on shared worker threads to reduce the load on the audio thread");
+        AudioPluginUtil::RegisterParameter(definition, "Head Length", "samples", 0.0f, MAXHEADLENGTH, 0.0f, 1.0f, 1.0f, P_HEADLENGTH, "Number of samples at the start of the impulse response that are convolved directly without FFT, which allows the rest to use longer partitions than the block size");
+        AudioPluginUtil::RegisterParameter(definition, "Trim Floor", "dB", MINTRIMFLOOR, -20.0f, -120.0f, 1.0f, 1.0f, P_TRIMFLOOR, "The part of the impulse response after its remaining energy has dropped below this level is not convolved. -150 dB keeps all of it.");
+        AudioPluginUtil::RegisterParameter(definition, "Half Precision Tail", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_HALFPRECISION, "1 = store the spectra of the later parts of the impulse response as bfloat16, which halves their memory and bandwidth at an error of about -50 dB");
+        AudioPluginUtil::RegisterParameter(definition, "True Stereo", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_TRUESTEREO, "1 = convolve each input channel of a stereo signal with its own impulse response for each output channel. Samples with four channels hold these in the order LL, LR, RL, RR, stereo samples leave out the crossed paths.");
+        AudioPluginUtil::RegisterParameter(definition, "Use Library", "", -1.0f, MAXLIBRARYIR - 1, -1.0f, 1.0f, 1.0f, P_LIBRARY, "-1 = off, otherwise indicates a pre-transformed impulse response in the library loaded by scripts via ConvolutionReverb_LoadLibrary. Used instead of the synthetic or sample impulse response while the library has an entry for the current block size, sample rate and channel count.");
         return numparams;
     }
 
-    static void SetupImpulse(EffectData* data, int numchannels, int blocksize, int samplerate)
+    // True if both requests result in the same impulse response, i.e. only the wet, gain and threading parameters differ
+    static bool IsSameImpulse(const ImpulseRequest& a, const ImpulseRequest& b)
     {
-        AudioPluginUtil::MutexScopeLock mutexScope1(*data->mutex);
+        return
+            a.numchannels == b.numchannels &&
+            a.hopsize == b.hopsize &&
+            a.samplerate == b.samplerate &&
+            a.p[P_TIME] == b.p[P_TIME] &&
+            a.p[P_DECAY] == b.p[P_DECAY] &&
+            a.p[P_DIFFUSION] == b.p[P_DIFFUSION] &&
+            a.p[P_STEREO] == b.p[P_STEREO] &&
+            a.p[P_CUTHI] == b.p[P_CUTHI] &&
+            a.p[P_CUTLO] == b.p[P_CUTLO] &&
+            a.p[P_RESONANCE] == b.p[P_RESONANCE] &&
+            (int)a.p[P_USESAMPLE] == (int)b.p[P_USESAMPLE] &&
+            a.p[P_REVERSE] == b.p[P_REVERSE] &&
+            (int)a.p[P_HEADLENGTH] == (int)b.p[P_HEADLENGTH] &&
+            (int)a.p[P_LIBRARY] == (int)b.p[P_LIBRARY] &&
+            a.p[P_TRIMFLOOR] == b.p[P_TRIMFLOOR] &&
+            (a.p[P_HALFPRECISION] >= 0.5f) == (b.p[P_HALFPRECISION] >= 0.5f) &&
+            (a.p[P_TRUESTEREO] >= 0.5f) == (b.p[P_TRUESTEREO] >= 0.5f) &&
+            a.sampleupdatecount == b.sampleupdatecount &&
+            a.libraryupdatecount == b.libraryupdatecount;
+    }
 
-        AudioPluginUtil::Random random;
+    static bool IsSameRequest(const ImpulseRequest& a, const ImpulseRequest& b)
+    {
+        return IsSameImpulse(a, b) && (a.p[P_THREADED] >= 0.5f) == (b.p[P_THREADED] >= 0.5f);
+    }
 
+    static ImpulseRequest MakeRequest(const EffectData* data, int numchannels, int blocksize, int samplerate)
+    {
         int usesample = (int)data->p[P_USESAMPLE];
 
-        // if no parameters have changed, there's no need to recalculate the impulse
-        if (data->numchannels == numchannels &&
-            data->hopsize == blocksize &&
-            data->samplerate == samplerate &&
-            data->lastparams[P_TIME] == data->p[P_TIME] &&
-            data->lastparams[P_DECAY] == data->p[P_DECAY] &&
-            data->lastparams[P_DIFFUSION] == data->p[P_DIFFUSION] &&
-            data->lastparams[P_STEREO] == data->p[P_STEREO] &&
-            data->lastparams[P_CUTHI] == data->p[P_CUTHI] &&
-            data->lastparams[P_CUTLO] == data->p[P_CUTLO] &&
-            data->lastparams[P_RESONANCE] == data->p[P_RESONANCE] &&
-            (int)data->lastparams[P_USESAMPLE] == usesample &&
-            data->lastparams[P_REVERSE] == data->p[P_REVERSE] &&
-            (usesample < 0 || GetIRSample(usesample).updatecount == globalupdatecount)
-            )
-            return;
-
-        AudioPluginUtil::MutexScopeLock mutexScope2(sampleMutex);
+        ImpulseRequest request;
+        memcpy(request.p, data->p, sizeof(data->p));
+        request.numchannels = numchannels;
+        request.hopsize = blocksize;
+        request.samplerate = samplerate;
+        request.sampleupdatecount = (usesample < 0) ? 0 : GetIRSample(usesample).updatecount;
+        request.libraryupdatecount = ((int)data->p[P_LIBRARY] < 0) ? 0 : libraryupdatecount;
+        return request;
+    }
 
-        // delete old buffers (can be avoided if numchannels, numpartitions and hopsize stay the same)
-        for (int i = 0; i < data->numchannels; i++)
+    // Hands the request to the worker unless it is the one that was posted last. Both the audio and the GUI thread post requests,
+    // so the comparison has to be made under the lock as well.
+    static void PostRequest(EffectData* data, const ImpulseRequest& request)
+    {
         {
-            Channel& c = data->channels[i];
-            for (int k = 0; k < data->numpartitions; k++)
-            {
-                delete[] c.h[k];
-                delete[] c.x[k];
-            }
-            delete[] c.h;
-            delete[] c.x;
-            delete[] c.s;
-            delete[] c.impulse;
+            AudioPluginUtil::MutexScopeLock mutexScope(*data->mutex);
+            if (IsSameRequest(request, data->request))
+                return;
+            data->request = request;
+            data->dirty = true;
         }
-        delete[] data->channels;
-        delete[] data->tmpoutput;
 
-        memcpy(data->lastparams, data->p, sizeof(data->p));
+        data->wakeup->Signal();
+    }
+
+    // Called from the audio thread. Only takes the lock when parameters have changed since the last callback.
+    static void RequestImpulse(EffectData* data, int numchannels, int blocksize, int samplerate)
+    {
+        ImpulseRequest request = MakeRequest(data, numchannels, blocksize, samplerate);
+
+        // if no parameters have changed, there's no need to recalculate the impulse
+        if (IsSameRequest(request, data->processrequest))
+            return;
+
+        data->processrequest = request;
+        PostRequest(data, request);
+    }
+
+    // Number of impulse responses convolved, one per channel or one per pair of input and output channel in true-stereo mode
+    static int GetNumPaths(const ImpulseRequest& request)
+    {
+        if (request.p[P_TRUESTEREO] >= 0.5f && request.numchannels == 2)
+            return 4;
+        return request.numchannels;
+    }
 
-        // reinitialize data
-        data->bufferindex = 0;
-        data->writeoffset = 0;
-        data->numchannels = numchannels;
-        data->hopsize = blocksize;
-        data->fftsize = blocksize * 2;
-        data->tmpoutput = new AudioPluginUtil::UnityComplexNumber[data->fftsize];
-        data->channels = new Channel[data->numchannels];
-        data->samplerate = samplerate;
+    // Renders the synthetic or sample impulse response of all paths, returning one buffer with the paths one after another.
+    // Must be called with sampleMutex held.
+    static float* RenderImpulse(const ImpulseRequest& request, int& impulsesamples)
+    {
+        AudioPluginUtil::Random random;
 
-        memset(data->tmpoutput, 0, sizeof(AudioPluginUtil::UnityComplexNumber) * data->fftsize);
+        const float* p = request.p;
+        const int numchannels = GetNumPaths(request), hopsize = request.hopsize, samplerate = request.samplerate;
+        const bool truestereo = (numchannels != request.numchannels);
+        int usesample = (int)p[P_USESAMPLE];
 
         // calculate length of impulse in samples
-        int reallength = (int)ceilf(samplerate * data->p[P_TIME]);
+        int reallength = (int)ceilf(samplerate * p[P_TIME]);
         if (usesample >= 0)
         {
             IRSample& s = GetIRSample(usesample);
@@ -159,34 +298,34 @@ namespace ConvolutionReverb
                 reallength = (int)ceilf(s.numsamples * (float)samplerate / (float)s.samplerate);
         }
 
-        // calculate length of impulse in samples as a multiple of the number of partitions processed
-        data->numpartitions = 0;
-        while (data->numpartitions * data->hopsize < reallength)
-            data->numpartitions++;
-        int impulsesamples = data->numpartitions * data->hopsize;
+        // calculate length of impulse in samples as a multiple of the block size
+        impulsesamples = 0;
+        while (impulsesamples < reallength)
+            impulsesamples += hopsize;
+        float* impulsedata = new float[impulsesamples * numchannels];
+        float** impulses = new float*[numchannels];
+        for (int i = 0; i < numchannels; i++)
+            impulses[i] = impulsedata + i * impulsesamples;
 
         // calculate individual impulse responses per channel
         float sampletime = 1.0f / (float)samplerate;
-        for (int i = 0; i < data->numchannels; i++)
+        for (int i = 0; i < numchannels; i++)
         {
-            Channel& c = data->channels[i];
-            c.impulse = new float[impulsesamples];
-            c.s = new float[data->fftsize];
-            memset(c.s, 0, sizeof(float) * data->fftsize);
+            float* impulse = impulses[i];
 
-            float cuthi = 2.0f * sinf(0.25f * AudioPluginUtil::kPI * data->p[P_CUTHI] * sampletime);
-            float cutlo = 2.0f * sinf(0.25f * AudioPluginUtil::kPI * data->p[P_CUTLO] * sampletime);
-            float bw = 0.9f - 0.89f * data->p[P_RESONANCE]; bw *= bw;
-            float decayconst = (data->p[P_STEREO] * random.GetFloat(0.0f, 0.01f) - 1.0f) / (reallength * 0.01f * data->p[P_DECAY]);
+            float cuthi = 2.0f * sinf(0.25f * AudioPluginUtil::kPI * p[P_CUTHI] * sampletime);
+            float cutlo = 2.0f * sinf(0.25f * AudioPluginUtil::kPI * p[P_CUTLO] * sampletime);
+            float bw = 0.9f - 0.89f * p[P_RESONANCE]; bw *= bw;
+            float decayconst = (p[P_STEREO] * random.GetFloat(0.0f, 0.01f) - 1.0f) / (reallength * 0.01f * p[P_DECAY]);
 
             if (usesample < 0)
             {
                 // calculate the impulse response as decaying white noise
-                float d = 10.0f - 0.09f * data->p[P_DIFFUSION];
+                float d = 10.0f - 0.09f * p[P_DIFFUSION];
                 for (int n = 0; n < impulsesamples; n++)
                 {
                     float env = expf(decayconst * n);
-                    c.impulse[n] = env * powf(random.GetFloat(0.1f, 1.0f), d) * random.GetFloat(-1.0f, 1.0f);
+                    impulse[n] = env * powf(random.GetFloat(0.1f, 1.0f), d) * random.GetFloat(-1.0f, 1.0f);
                 }
             }
             else
@@ -205,24 +344,18 @@ namespace ConvolutionReverb
                     s = dummysample;
                 }
 
-                int channel = (i < numchannels) ? i : (numchannels - 1);
-                float speed = (float)s.samplerate / (float)samplerate;
-                for (int n = 0; n < impulsesamples; n++)
+                int channel = (i < s.numchannels) ? i : (s.numchannels - 1);
+                if (truestereo && s.numchannels < numchannels)
+                    channel = (i == 1 || i == 2) ? -1 : (i == 3 && s.numchannels > 1) ? 1 : 0;
+                if (channel < 0)
+                    memset(impulse, 0, sizeof(float) * impulsesamples);
+                else if (s.samplerate != samplerate)
+                    AudioPluginUtil::Resampler::Get(s.samplerate, samplerate)->Process(s.data + channel, s.numsamples, s.numchannels, impulse, impulsesamples, 1);
+                else
                 {
-                    float fpos = n * speed;
-                    int ipos1 = (int)ceilf(fpos);
-                    if (ipos1 >= s.numsamples)
-                        ipos1 = s.numsamples - 1;
-                    int ipos2 = ipos1 + 1;
-                    if (ipos2 >= s.numsamples)
-                        ipos2 = s.numsamples - 1;
-                    fpos -= ipos1;
-                    float s1 = s.data[ipos1 * s.numchannels + channel];
-                    float s2 = s.data[ipos2 * s.numchannels + channel];
-                    c.impulse[n] = s1 + (s2 - s1) * fpos;
+                    for (int n = 0; n < impulsesamples; n++)
+                        impulse[n] = (n < s.numsamples) ? s.data[n * s.numchannels + channel] : 0.0f;
                 }
-
-                s.updatecount = globalupdatecount;
             }
 
             float lpf = 0.0f, bpf = 0.0f, gain = 0.5f * (1.0f - bw * bw);
@@ -231,69 +364,307 @@ namespace ConvolutionReverb
                 float env = expf(decayconst * n);
                 float cut = cutlo + (cuthi - cutlo) * env;
                 lpf += cut * bpf;
-                bpf += cut * (c.impulse[n] - lpf - bpf * bw);
+                bpf += cut * (impulse[n] - lpf - bpf * bw);
                 lpf += cut * bpf;
                 bpf -= cut * (lpf + bpf * bw);
-                c.impulse[n] = gain * lpf;
-                //c.impulse[n] = env * sinf(n * 2.0f * 3.1415926f * 1000.0f / 44100.0f); // damped sine -- useful for debugging with click input signals
+                impulse[n] = gain * lpf;
+                //impulse[n] = env * sinf(n * 2.0f * 3.1415926f * 1000.0f / 44100.0f); // damped sine -- useful for debugging with click input signals
             }
 
-            if (data->p[P_REVERSE] > 0.5f)
+            if (p[P_REVERSE] > 0.5f)
             {
                 int len = impulsesamples >> 1;
                 for (int n = 0; n < len; n++)
                 {
-                    float tmp = c.impulse[n];
-                    c.impulse[n] = c.impulse[impulsesamples - 1 - n];
-                    c.impulse[impulsesamples - 1 - n] = tmp;
+                    float tmp = impulse[n];
+                    impulse[n] = impulse[impulsesamples - 1 - n];
+                    impulse[impulsesamples - 1 - n] = tmp;
                 }
             }
+        }
 
+        // normalize the gain of each output channel, keeping the balance between the direct and crossed paths in true-stereo mode
+        for (int o = 0; o < request.numchannels; o++)
+        {
             // measure signal power
             float power = 0.0f;
-            for (int n = 0; n < impulsesamples; n++)
-                power += c.impulse[n] * c.impulse[n];
+            for (int i = o; i < numchannels; i += request.numchannels)
+                for (int n = 0; n < impulsesamples; n++)
+                    power += impulses[i][n] * impulses[i][n];
 
             // normalize gain
-            float scale = 1.0f / sqrtf(power);
+            float scale = (power > 0.0f) ? (1.0f / sqrtf(power)) : 0.0f;
+            for (int i = o; i < numchannels; i += request.numchannels)
+                for (int n = 0; n < impulsesamples; n++)
+                    impulses[i][n] *= scale;
+        }
+        delete[] impulses;
+
+        return impulsedata;
+    }
+
+    // Returns the number of samples that are convolved, dropping the part of the impulse responses of all channels in which the
+    // backward-integrated energy (the energy decay curve) is below the trim floor. The result is rounded up to whole blocks.
+    static int GetTrimmedLength(const ImpulseRequest& request, float** impulses, int impulsesamples)
+    {
+        if (request.p[P_TRIMFLOOR] <= MINTRIMFLOOR)
+            return impulsesamples;
+
+        const double floor = pow(10.0, 0.1 * request.p[P_TRIMFLOOR]);
+        int length = request.hopsize;
+        for (int i = 0; i < GetNumPaths(request); i++)
+        {
+            const float* impulse = impulses[i];
+            double total = 0.0;
             for (int n = 0; n < impulsesamples; n++)
-                c.impulse[n] *= scale;
+                total += impulse[n] * impulse[n];
 
-            // partition the impulse response
-            c.h = new AudioPluginUtil::UnityComplexNumber*[data->numpartitions];
-            c.x = new AudioPluginUtil::UnityComplexNumber*[data->numpartitions];
-            float* src = c.impulse;
-            for (int k = 0; k < data->numpartitions; k++)
+            double threshold = total * floor, remaining = 0.0;
+            int n = impulsesamples;
+            while (n > length && remaining + impulse[n - 1] * impulse[n - 1] <= threshold)
             {
-                c.h[k] = new AudioPluginUtil::UnityComplexNumber[data->fftsize];
-                c.x[k] = new AudioPluginUtil::UnityComplexNumber[data->fftsize];
-                memset(c.x[k], 0, sizeof(AudioPluginUtil::UnityComplexNumber) * data->fftsize);
-                memset(c.h[k], 0, sizeof(AudioPluginUtil::UnityComplexNumber) * data->fftsize);
-                for (int n = 0; n < data->hopsize; n++)
-                    c.h[k][n].re = *src++;
-                AudioPluginUtil::FFT::Forward(c.h[k], data->fftsize, false);
+                remaining += impulse[n - 1] * impulse[n - 1];
+                n--;
             }
+            length = n;
+        }
+
+        length = (length + request.hopsize - 1) / request.hopsize * request.hopsize;
+        return (length < impulsesamples) ? length : impulsesamples;
+    }
+
+    static AudioPluginUtil::PartitionedIR::SpectrumFormat GetTailFormat(const ImpulseRequest& request)
+    {
+        return (request.p[P_HALFPRECISION] >= 0.5f) ? AudioPluginUtil::PartitionedIR::kBFloat16 : AudioPluginUtil::PartitionedIR::kFloat32;
+    }
+
+    // Builds the impulse response, its partitioned spectra and the GUI preview. This allocates and is expensive, so it runs on the
+    // worker thread (or in CreateCallback).
+    static void BuildSharedImpulse(SharedImpulse* shared)
+    {
+        const ImpulseRequest& request = shared->key;
+        const int numchannels = GetNumPaths(request), hopsize = request.hopsize;
+
+        AudioPluginUtil::MutexScopeLock mutexScope(sampleMutex);
+
+        // a library entry is used as it is, without any of the preparation below
+        const char* libraryname = (library != NULL && (int)request.p[P_LIBRARY] >= 0) ? GetLibraryName(library->file, (int)request.p[P_LIBRARY]) : NULL;
+        int entry = (libraryname != NULL) ? library->file.Find(libraryname, hopsize, request.samplerate, numchannels) : -1;
+        if (entry >= 0)
+        {
+            library->file.GetEntry(entry, shared->ir);
+            shared->library = library;
+            library->refcount++;
+
+            // the library only has the spectra, so the GUI shows a flat line
+            shared->previewsamples = hopsize;
+            shared->preview = new float[hopsize * numchannels];
+            memset(shared->preview, 0, sizeof(float) * hopsize * numchannels);
+            return;
+        }
+
+        int impulsesamples;
+        float* impulsedata = RenderImpulse(request, impulsesamples);
+        float** impulses = new float*[numchannels];
+        for (int i = 0; i < numchannels; i++)
+            impulses[i] = impulsedata + i * impulsesamples;
+
+        // partition the impulse responses of all paths (direct convolution of the head, short partitions after it and longer ones in the tail)
+        // the GUI preview still shows all of the impulse response
+        shared->ir.Init(impulses, numchannels, GetTrimmedLength(request, impulses, impulsesamples), hopsize, MAXPARTITIONSIZE, (int)request.p[P_HEADLENGTH], GetTailFormat(request));
+
+        for (int i = 0; i < numchannels; i++)
+        {
+            float* curve = impulses[i];
 
             // integrate peak detection filtered impulse for later resampling via box-filtering when GUI requests preview waveform
             double sum = 0.0, peak = 0.0;
             for (int n = 0; n < impulsesamples; n++)
             {
-                float a = fabsf(c.impulse[n]);
+                float a = fabsf(curve[n]);
                 if (a > peak)
                     peak = a;
                 else
                     peak = peak * 0.99f + 1.0e-9f;
                 sum += peak;
-                c.impulse[n] = (float)sum;
+                curve[n] = (float)sum;
             }
             double dc = -sum / (double)impulsesamples;
             sum = 0.0;
             for (int n = 0; n < impulsesamples; n++)
             {
-                c.impulse[n] -= (float)sum;
+                curve[n] -= (float)sum;
                 sum -= dc;
             }
         }
+        delete[] impulses;
+
+        shared->preview = impulsedata;
+        shared->previewsamples = impulsesamples;
+    }
+
+    // Returns the shared impulse response for the request with an added reference, building it if no instance has it yet
+    static SharedImpulse* AcquireSharedImpulse(const ImpulseRequest& request)
+    {
+        SharedImpulse* shared = NULL;
+        bool build = false;
+        {
+            AudioPluginUtil::MutexScopeLock mutexScope(cacheMutex);
+            for (shared = impulsecache; shared != NULL; shared = shared->next)
+                if (IsSameImpulse(shared->key, request))
+                    break;
+
+            if (shared != NULL)
+                shared->refcount++;
+            else
+            {
+                // publish the entry right away so that other instances asking for the same impulse response wait for it
+                // instead of building their own copy
+                shared = new SharedImpulse();
+                shared->key = request;
+                shared->refcount = 1;
+                shared->next = impulsecache;
+                impulsecache = shared;
+                shared->buildmutex.Lock();
+                build = true;
+            }
+        }
+
+        // build without holding the cache lock, so that instances with other impulse responses are not held up
+        if (build)
+        {
+            BuildSharedImpulse(shared);
+            shared->buildmutex.Unlock();
+        }
+        else
+            AudioPluginUtil::MutexScopeLock waitScope(shared->buildmutex);
+
+        return shared;
+    }
+
+    static SharedImpulse* RetainSharedImpulse(SharedImpulse* shared)
+    {
+        AudioPluginUtil::MutexScopeLock mutexScope(cacheMutex);
+        shared->refcount++;
+        return shared;
+    }
+
+    static void ReleaseSharedImpulse(SharedImpulse* shared)
+    {
+        if (shared == NULL)
+            return;
+        AudioPluginUtil::MutexScopeLock mutexScope(cacheMutex);
+        if (--shared->refcount > 0)
+            return;
+        SharedImpulse** link = &impulsecache;
+        while (*link != shared)
+            link = &(*link)->next;
+        *link = shared->next;
+        delete shared;
+    }
+
+    Impulse::~Impulse()
+    {
+        delete convolver; // may still be in use by the thread pool until this returns
+        ReleaseSharedImpulse(shared);
+        delete[] tmpbuffer;
+        delete[] blocks;
+    }
+
+    static void RetainThreadPool()
+    {
+        AudioPluginUtil::MutexScopeLock mutexScope(threadPoolMutex);
+        if (threadpoolrefcount++ == 0)
+            threadpool = new AudioPluginUtil::ConvolutionThreadPool();
+    }
+
+    // Must only be called once all impulses of the instance are deleted, so that no convolver is registered with the pool anymore
+    static void ReleaseThreadPool()
+    {
+        AudioPluginUtil::MutexScopeLock mutexScope(threadPoolMutex);
+        if (--threadpoolrefcount == 0)
+        {
+            delete threadpool; // joins the workers
+            threadpool = NULL;
+        }
+    }
+
+    static AudioPluginUtil::ConvolutionThreadPool* GetThreadPool()
+    {
+        AudioPluginUtil::MutexScopeLock mutexScope(threadPoolMutex);
+        if (threadpool->GetNumThreads() == 0)
+            threadpool->Init(NUMTAILTHREADS);
+        return threadpool;
+    }
+
+    // Sets up the convolution state of one instance for a shared impulse response, taking over the reference
+    static Impulse* CreateImpulse(SharedImpulse* shared, bool threaded)
+    {
+        const int numchannels = shared->key.numchannels, hopsize = shared->key.hopsize;
+        Impulse* impulse = new Impulse();
+        impulse->numchannels = numchannels;
+        impulse->hopsize = hopsize;
+        impulse->shared = shared;
+        impulse->convolver = new AudioPluginUtil::PartitionedConvolver();
+        impulse->convolver->Init(&shared->ir, threaded ? GetThreadPool() : NULL, (shared->ir.GetNumChannels() != numchannels) ? numchannels : 0);
+        impulse->tmpbuffer = new float[hopsize * numchannels];
+        memset(impulse->tmpbuffer, 0, sizeof(float) * hopsize * numchannels);
+        impulse->blocks = new float*[numchannels];
+        for (int i = 0; i < numchannels; i++)
+            impulse->blocks[i] = impulse->tmpbuffer + i * hopsize;
+        return impulse;
+    }
+
+    static void WorkerThread(void* arg)
+    {
+        EffectData* data = (EffectData*)arg;
+        while (true)
+        {
+            data->wakeup->Wait();
+            if (data->quit)
+                break;
+
+            delete AudioPluginUtil::AtomicExchangePointer(&data->retired, (Impulse*)NULL);
+
+            ImpulseRequest request;
+            {
+                AudioPluginUtil::MutexScopeLock mutexScope(*data->mutex);
+                if (!data->dirty)
+                    continue;
+                request = data->request;
+                data->dirty = false;
+            }
+
+            SharedImpulse* shared = AcquireSharedImpulse(request);
+            SharedImpulse* preview = RetainSharedImpulse(shared); // the GUI holds its own reference
+            Impulse* impulse = CreateImpulse(shared, request.p[P_THREADED] >= 0.5f);
+
+            {
+                AudioPluginUtil::MutexScopeLock mutexScope(*data->mutex);
+                SharedImpulse* tmp = data->preview;
+                data->preview = preview;
+                preview = tmp;
+            }
+            ReleaseSharedImpulse(preview);
+
+            // an impulse response that the audio thread has not picked up yet has been superseded by this one
+            delete AudioPluginUtil::AtomicExchangePointer(&data->pending, impulse);
+        }
+    }
+
+    // The block size of the convolution only follows the DSP buffer size of the host. Callbacks of other lengths, as they occur in
+    // offline rendering and in the editor, are buffered in ProcessCallback instead of rebuilding the impulse response. So are those
+    // of a buffer size that the FFT can't transform blocks of, for which the largest supported block size below it is used.
+    static int GetBlockSize(UnityAudioEffectState* state)
+    {
+        if (state->structsize >= sizeof(UnityAudioEffectState) && state->hostapiversion >= 0x010300 && state->dspbuffersize > 0)
+        {
+            int blocksize = (int)state->dspbuffersize;
+            while (!AudioPluginUtil::FFTPlan::IsSupportedSize(2 * blocksize))
+                blocksize--;
+            return blocksize;
+        }
+        return 1024;
     }
 
     UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
@@ -301,20 +672,83 @@ namespace ConvolutionReverb
         EffectData* data = new EffectData;
         memset(data, 0, sizeof(EffectData));
         data->mutex = new AudioPluginUtil::Mutex();
+        data->wakeup = new AudioPluginUtil::Event();
         state->effectdata = data;
         AudioPluginUtil::InitParametersFromDefinitions(InternalRegisterEffectDefinition, data->p);
-        SetupImpulse(data, 2, 1024, state->samplerate); // Assuming stereo and 1024 sample block size
+        RetainThreadPool();
+
+        // The first impulse response is built right away so that processing can start immediately
+        memcpy(data->request.p, data->p, sizeof(data->p));
+        data->request.numchannels = 2; // Assuming stereo
+        data->request.hopsize = GetBlockSize(state);
+        data->request.samplerate = state->samplerate;
+        data->preview = AcquireSharedImpulse(data->request);
+        data->current = CreateImpulse(RetainSharedImpulse(data->preview), data->p[P_THREADED] >= 0.5f);
+
+        data->worker = new AudioPluginUtil::Thread();
+        data->worker->Start(WorkerThread, data);
         return UNITY_AUDIODSP_OK;
     }
 
     UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state)
     {
         EffectData* data = state->GetEffectData<EffectData>();
+        data->quit = true;
+        data->wakeup->Signal();
+        delete data->worker;
+        delete data->current;
+        delete data->fading;
+        delete data->pending;
+        delete data->retired;
+        ReleaseSharedImpulse(data->preview);
+        ReleaseThreadPool();
+        delete data->wakeup;
         delete data->mutex;
         delete data;
         return UNITY_AUDIODSP_OK;
     }
 
+    // Convolves the block collected in data->current->blocks in place. A newly prepared impulse response with the same block size
+    // takes over here, crossfading from the old one over the block.
+    static void ProcessBlock(EffectData* data)
+    {
+        bool crossfade = false;
+        if (data->fading == NULL)
+        {
+            Impulse* impulse = AudioPluginUtil::AtomicExchangePointer(&data->pending, (Impulse*)NULL);
+            if (impulse != NULL)
+            {
+                data->fading = data->current;
+                data->current = impulse;
+                crossfade = true;
+            }
+        }
+
+        Impulse* current = data->current;
+        Impulse* fading = data->fading;
+        if (crossfade)
+        {
+            for (int i = 0; i < current->numchannels; i++)
+                memcpy(current->blocks[i], fading->blocks[i], sizeof(float) * current->hopsize);
+        }
+
+        current->convolver->Process(current->blocks, current->blocks);
+
+        if (crossfade)
+        {
+            fading->convolver->Process(fading->blocks, fading->blocks);
+
+            const float step = 1.0f / (float)current->hopsize;
+            for (int i = 0; i < current->numchannels; i++)
+            {
+                float* block = current->blocks[i];
+                const float* prev = fading->blocks[i];
+                for (int n = 0; n < current->hopsize; n++)
+                    block[n] = prev[n] + (block[n] - prev[n]) * (n * step);
+            }
+        }
+    }
+
     UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels)
     {
         EffectData* data = state->GetEffectData<EffectData>();
@@ -322,65 +756,96 @@ namespace ConvolutionReverb
         const float wet = data->p[P_WET] * 0.01f;
         const float gain = powf(10.0f, 0.05f * data->p[P_GAIN]);
 
-        // this should be done on a separate thread to avoid cpu spikes
-        SetupImpulse(data, outchannels, (int)length, state->samplerate);
+        RequestImpulse(data, outchannels, GetBlockSize(state), state->samplerate);
 
-        // Lock data here in case float parameters are changed in pause/stopped mode and cause further calls to SetupImpulse
-        AudioPluginUtil::MutexScopeLock mutexScope1(*data->mutex);
+        // hand the impulse response that was faded out in the previous block back to the worker, unless it is still busy with the last one
+        if (data->fading != NULL && AudioPluginUtil::AtomicLoadPointer(&data->retired) == NULL)
+        {
+            AudioPluginUtil::AtomicStorePointer(&data->retired, data->fading);
+            data->fading = NULL;
+            data->wakeup->Signal();
+        }
 
-        int writeoffset; // set inside loop
+        // an impulse response for a different block size or channel count can't be crossfaded, so it replaces the old one right away
+        Impulse* pending = AudioPluginUtil::AtomicLoadPointer(&data->pending);
+        if (data->fading == NULL && pending != NULL && (pending->hopsize != data->current->hopsize || pending->numchannels != data->current->numchannels))
+        {
+            data->fading = data->current;
+            data->current = AudioPluginUtil::AtomicExchangePointer(&data->pending, (Impulse*)NULL);
+            data->fill = 0;
+            data->latency = 0;
+        }
 
-        for (int i = 0; i < inchannels; i++)
+        if (data->current->numchannels != inchannels)
         {
-            Channel& c = data->channels[i];
+            // the channel count changed and the new impulse response is still being prepared
+            for (int n = 0; n < (int)length * outchannels; n++)
+                outbuffer[n] = inbuffer[n] * (1.0f - wet);
+            return UNITY_AUDIODSP_OK;
+        }
 
-            // feed new data to input buffer s
-            float* s = c.s;
-            const int mask = data->fftsize - 1;
-            writeoffset = data->writeoffset;
-            for (int n = 0; n < data->hopsize; n++)
-            {
-                s[writeoffset] = inbuffer[n * inchannels + i];
-                writeoffset = (writeoffset + 1) & mask;
-            }
+        int pos = 0;
+        while (pos < (int)length)
+        {
+            const int hopsize = data->current->hopsize;
+            int num = (int)length - pos;
+            if (num > hopsize - data->fill)
+                num = hopsize - data->fill;
 
-            // calculate X=FFT(s)
-            writeoffset = data->writeoffset;
-            AudioPluginUtil::UnityComplexNumber* x = c.x[data->bufferindex];
-            for (int n = 0; n < data->fftsize; n++)
+            const float* src = inbuffer + pos * inchannels;
+            float* dst = outbuffer + pos * outchannels;
+            if (data->latency == 0 && data->fill == 0 && num == hopsize)
             {
-                x[n].Set(s[writeoffset], 0.0f);
-                writeoffset = (writeoffset + 1) & mask;
-            }
-            AudioPluginUtil::FFT::Forward(x, data->fftsize, false);
+                // a whole block within this callback is convolved right away without latency
+                for (int i = 0; i < inchannels; i++)
+                {
+                    float* block = data->current->blocks[i];
+                    for (int n = 0; n < hopsize; n++)
+                        block[n] = src[n * inchannels + i];
+                }
 
-            writeoffset = (writeoffset + data->hopsize) & mask;
+                ProcessBlock(data);
 
-            // calculate y=IFFT(sum(convolve(H_k, X_k), k=1..numpartitions))
-            AudioPluginUtil::UnityComplexNumber* y = data->tmpoutput;
-            memset(y, 0, sizeof(AudioPluginUtil::UnityComplexNumber) * data->fftsize);
-            for (int k = 0; k < data->numpartitions; k++)
-            {
-                AudioPluginUtil::UnityComplexNumber* h = c.h[k];
-                AudioPluginUtil::UnityComplexNumber* x = c.x[(k + data->bufferindex) % data->numpartitions];
-                for (int n = 0; n < data->fftsize; n++)
-                    AudioPluginUtil::UnityComplexNumber::MulAdd(h[n], x[n], y[n], y[n]);
+                for (int i = 0; i < inchannels; i++)
+                {
+                    const float* block = data->current->blocks[i];
+                    for (int n = 0; n < hopsize; n++)
+                    {
+                        float input = src[n * outchannels + i];
+                        dst[n * outchannels + i] = input + (gain * block[n] - input) * wet;
+                    }
+                }
             }
-            AudioPluginUtil::FFT::Backward(y, data->fftsize, false);
-
-            // overlap-save readout
-            for (int n = 0; n < data->hopsize; n++)
+            else
             {
-                float input = inbuffer[n * outchannels + i];
-                outbuffer[n * outchannels + i] = input + (gain * y[n].re - input) * wet;
+                // Otherwise the input is collected and the wet signal played back one block later from the output of the previous block
+                // in the same buffer. The output of the previous block has been played already when switching to this, so it starts over.
+                if (data->latency == 0)
+                {
+                    for (int i = 0; i < inchannels; i++)
+                        memset(data->current->blocks[i], 0, sizeof(float) * hopsize);
+                    data->latency = hopsize;
+                }
+                for (int i = 0; i < inchannels; i++)
+                {
+                    float* block = data->current->blocks[i] + data->fill;
+                    for (int n = 0; n < num; n++)
+                    {
+                        float input = src[n * inchannels + i];
+                        dst[n * outchannels + i] = input + (gain * block[n] - input) * wet;
+                        block[n] = input;
+                    }
+                }
+                data->fill += num;
+                if (data->fill == hopsize)
+                {
+                    ProcessBlock(data);
+                    data->fill = 0;
+                }
             }
+            pos += num;
         }
 
-        if (--data->bufferindex < 0)
-            data->bufferindex = data->numpartitions - 1;
-
-        data->writeoffset = writeoffset;
-
         return UNITY_AUDIODSP_OK;
     }
 
@@ -408,15 +873,41 @@ namespace ConvolutionReverb
     int UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples)
     {
         EffectData* data = state->GetEffectData<EffectData>();
-        AudioPluginUtil::MutexScopeLock mutexScope(*data->mutex);
-        if (strncmp(name, "Impulse", 7) == 0)
+        if (strcmp(name, "Latency") == 0)
+        {
+            // delay of the wet signal in samples added by buffering callbacks that are not whole blocks, the dry signal is not delayed
+            if (numsamples > 0)
+                buffer[0] = (float)data->latency;
+        }
+        else if (strcmp(name, "Partitions") == 0)
+        {
+            // number of partitions convolved per channel after trimming, followed by the number of samples they cover
+            AudioPluginUtil::MutexScopeLock mutexScope(*data->mutex);
+            const AudioPluginUtil::PartitionedIR& ir = data->preview->ir;
+            int numpartitions = 0;
+            for (int i = 0; i < ir.GetNumSegments(); i++)
+                numpartitions += ir.GetSegment(i).numpartitions;
+            if (numsamples > 0)
+                buffer[0] = (float)numpartitions;
+            if (numsamples > 1)
+                buffer[1] = (float)ir.GetLength();
+        }
+        else if (strncmp(name, "Impulse", 7) == 0)
         {
-            SetupImpulse(data, data->numchannels, data->hopsize, data->samplerate);
+            // also picks up parameter changes while the audio thread is paused, the preview is updated once the worker is done
+            ImpulseRequest request;
+            {
+                AudioPluginUtil::MutexScopeLock mutexScope(*data->mutex);
+                request = data->request;
+            }
+            PostRequest(data, MakeRequest(data, request.numchannels, request.hopsize, request.samplerate));
+            AudioPluginUtil::MutexScopeLock mutexScope(*data->mutex);
+            const SharedImpulse* preview = data->preview;
             int index = name[7] - '0';
-            if (index >= data->numchannels)
+            if (index >= preview->key.numchannels)
                 return UNITY_AUDIODSP_OK;
-            const float* src = data->channels[index].impulse;
-            float scale = (float)(data->hopsize * data->numpartitions - 2) / (float)numsamples;
+            const float* src = preview->preview + index * preview->previewsamples;
+            float scale = (float)(preview->previewsamples - 2) / (float)numsamples;
             float prev_val = 0.0f, time_scale = 1.0f / scale;
             for (int n = 0; n < numsamples; n++)
             {
@@ -432,34 +923,72 @@ namespace ConvolutionReverb
     }
 }
 
-extern "C" UNITY_AUDIODSP_EXPORT_API bool ConvolutionReverb_UploadSample(int index, float* data, int numsamples, int numchannels, int samplerate, const char* name)
+// Starts uploading a sample of numsamples frames with numchannels interleaved channels to the given slot in chunks, replacing any upload
+// to it that is still in progress. The sample in the slot stays in use until the upload is committed.
+extern "C" UNITY_AUDIODSP_EXPORT_API bool ConvolutionReverb_BeginUpload(int index, int numsamples, int numchannels, int samplerate, const char* name)
 {
     if (index < 0 || index >= ConvolutionReverb::MAXSAMPLE)
         return false;
-    AudioPluginUtil::MutexScopeLock mutexScope(ConvolutionReverb::sampleMutex);
-    ConvolutionReverb::IRSample& s = ConvolutionReverb::GetIRSample(index);
-    if (s.allocated)
-        delete[] s.data;
-    int num = numsamples * numchannels;
-    if (num > 0)
+    AudioPluginUtil::MutexScopeLock mutexScope(ConvolutionReverb::uploadMutex);
+    return ConvolutionReverb::GetUpload(index).Begin(numsamples, numchannels, samplerate, name);
+}
+
+// Appends the next numsamples frames to the upload in progress
+extern "C" UNITY_AUDIODSP_EXPORT_API bool ConvolutionReverb_AppendUpload(int index, float* data, int numsamples)
+{
+    if (index < 0 || index >= ConvolutionReverb::MAXSAMPLE)
+        return false;
+    AudioPluginUtil::MutexScopeLock mutexScope(ConvolutionReverb::uploadMutex);
+    return ConvolutionReverb::GetUpload(index).Append(data, numsamples);
+}
+
+// Replaces the sample in the slot with the uploaded one once all of its frames have been appended
+extern "C" UNITY_AUDIODSP_EXPORT_API bool ConvolutionReverb_CommitUpload(int index)
+{
+    if (index < 0 || index >= ConvolutionReverb::MAXSAMPLE)
+        return false;
+
+    ConvolutionReverb::IRSample upload;
+    memset(&upload, 0, sizeof(upload));
     {
-        s.data = new float[num];
-        s.allocated = 1;
-        strcpy_s(s.name, name);
-        memcpy(s.data, data, numsamples * numchannels * sizeof(float));
+        AudioPluginUtil::MutexScopeLock mutexScope(ConvolutionReverb::uploadMutex);
+        AudioPluginUtil::SampleUpload& u = ConvolutionReverb::GetUpload(index);
+        if (!u.IsComplete())
+            return false;
+        upload.numsamples = u.GetNumSamples();
+        upload.numchannels = u.GetNumChannels();
+        upload.samplerate = u.GetSampleRate();
+        strcpy_s(upload.name, u.GetName());
+        upload.data = u.Detach();
     }
-    else
+
+    // only the pointers are swapped while holding sampleMutex, the previous data is freed after releasing it
+    float* prev;
     {
-        s.data = NULL;
+        AudioPluginUtil::MutexScopeLock mutexScope(ConvolutionReverb::sampleMutex);
+        ConvolutionReverb::IRSample& s = ConvolutionReverb::GetIRSample(index);
+        prev = s.allocated ? s.data : NULL;
+        s.data = upload.data;
         s.allocated = 1;
+        if (upload.numsamples > 0)
+            strcpy_s(s.name, upload.name);
+        s.numsamples = upload.numsamples;
+        s.numchannels = upload.numchannels;
+        s.samplerate = upload.samplerate;
+        s.updatecount = ++ConvolutionReverb::globalupdatecount;
     }
-    s.numsamples = numsamples;
-    s.numchannels = numchannels;
-    s.samplerate = samplerate;
-    s.updatecount = ++ConvolutionReverb::globalupdatecount;
+    delete[] prev;
     return true;
 }
 
+extern "C" UNITY_AUDIODSP_EXPORT_API bool ConvolutionReverb_UploadSample(int index, float* data, int numsamples, int numchannels, int samplerate, const char* name)
+{
+    return
+        ConvolutionReverb_BeginUpload(index, numsamples, numchannels, samplerate, name) &&
+        ConvolutionReverb_AppendUpload(index, data, numsamples) &&
+        ConvolutionReverb_CommitUpload(index);
+}
+
 extern "C" UNITY_AUDIODSP_EXPORT_API const char* ConvolutionReverb_GetSampleName(int index)
 {
     if (index < 0)
@@ -476,3 +1005,106 @@ extern "C" UNITY_AUDIODSP_EXPORT_API const char* ConvolutionReverb_GetSampleName
 
     return "Not set";
 }
+
+// Maps a library written by ConvolutionReverb_WriteLibrary, replacing the previous one. Instances using an entry of the previous library
+// keep it mapped until they switch to another impulse response. NULL unloads the library. Returns the number of entries, or -1 on failure.
+extern "C" UNITY_AUDIODSP_EXPORT_API int ConvolutionReverb_LoadLibrary(const char* filename)
+{
+    ConvolutionReverb::MappedLibrary* lib = NULL;
+    if (filename != NULL)
+    {
+        lib = new ConvolutionReverb::MappedLibrary();
+        lib->refcount = 1;
+        if (!lib->file.Open(filename))
+        {
+            delete lib;
+            return -1;
+        }
+    }
+
+    ConvolutionReverb::MappedLibrary* prev;
+    {
+        AudioPluginUtil::MutexScopeLock mutexScope(ConvolutionReverb::sampleMutex);
+        prev = ConvolutionReverb::library;
+        ConvolutionReverb::library = lib;
+        ++ConvolutionReverb::libraryupdatecount;
+    }
+    ConvolutionReverb::ReleaseLibrary(prev);
+    return (lib != NULL) ? lib->file.GetNumEntries() : 0;
+}
+
+// Name of the impulse response that the "Use Library" parameter selects with the given index
+extern "C" UNITY_AUDIODSP_EXPORT_API const char* ConvolutionReverb_GetLibraryName(int index)
+{
+    if (index < 0)
+        return "Off";
+
+    AudioPluginUtil::MutexScopeLock mutexScope(ConvolutionReverb::sampleMutex);
+    const char* name = (ConvolutionReverb::library != NULL) ? ConvolutionReverb::GetLibraryName(ConvolutionReverb::library->file, index) : NULL;
+    return (name != NULL) ? name : "Not set";
+}
+
+// Prepares the uploaded samples with the given parameters (or the defaults if params is NULL) for all combinations of block size and
+// sample rate, and writes them to a library under the names they were uploaded with. Returns the number of entries written, or -1 on failure,
+// which includes rates that are not positive and block sizes that the FFT can't transform (see AudioPluginUtil::FFTPlan::IsSupportedSize).
+extern "C" UNITY_AUDIODSP_EXPORT_API int ConvolutionReverb_WriteLibrary(const char* filename, const float* params, int numparams, const int* blocksizes, int numblocksizes, const int* samplerates, int numsamplerates, int numchannels)
+{
+    using namespace ConvolutionReverb;
+
+    if (numchannels <= 0 || numblocksizes <= 0 || numsamplerates <= 0)
+        return -1;
+    for (int b = 0; b < numblocksizes; b++)
+        if (blocksizes[b] <= 0 || !AudioPluginUtil::FFTPlan::IsSupportedSize(2 * blocksizes[b]))
+            return -1;
+    for (int k = 0; k < numsamplerates; k++)
+        if (samplerates[k] <= 0)
+            return -1;
+
+    ImpulseRequest request;
+    memset(&request, 0, sizeof(request));
+    AudioPluginUtil::InitParametersFromDefinitions(InternalRegisterEffectDefinition, request.p);
+    if (params != NULL)
+        memcpy(request.p, params, sizeof(float) * ((numparams < P_NUM) ? numparams : P_NUM));
+    request.numchannels = numchannels;
+    const int numpaths = GetNumPaths(request);
+
+    AudioPluginUtil::MutexScopeLock mutexScope(sampleMutex);
+
+    const int maxentries = MAXSAMPLE * numblocksizes * numsamplerates;
+    AudioPluginUtil::PartitionedIR* irs = new AudioPluginUtil::PartitionedIR[maxentries];
+    AudioPluginUtil::IRLibrary::Entry* entries = new AudioPluginUtil::IRLibrary::Entry[maxentries];
+    int numentries = 0;
+    for (int i = 0; i < MAXSAMPLE; i++)
+    {
+        IRSample& s = GetIRSample(i);
+        if (s.numsamples == 0)
+            continue;
+        request.p[P_USESAMPLE] = (float)i;
+        for (int k = 0; k < numsamplerates; k++)
+        {
+            for (int b = 0; b < numblocksizes; b++)
+            {
+                request.samplerate = samplerates[k];
+                request.hopsize = blocksizes[b];
+                int impulsesamples;
+                float* impulsedata = RenderImpulse(request, impulsesamples);
+                float** impulses = new float*[numpaths];
+                for (int c = 0; c < numpaths; c++)
+                    impulses[c] = impulsedata + c * impulsesamples;
+                irs[numentries].Init(impulses, numpaths, GetTrimmedLength(request, impulses, impulsesamples), request.hopsize, MAXPARTITIONSIZE, (int)request.p[P_HEADLENGTH], GetTailFormat(request));
+                delete[] impulses;
+                delete[] impulsedata;
+
+                entries[numentries].name = s.name;
+                entries[numentries].samplerate = request.samplerate;
+                entries[numentries].ir = &irs[numentries];
+                numentries++;
+            }
+        }
+    }
+
+    bool ok = AudioPluginUtil::IRLibrary::Write(filename, entries, numentries);
+    delete[] entries;
+    delete[] irs;
+    return ok ? numentries : -1;
+}
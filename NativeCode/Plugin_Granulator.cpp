@@ -7,6 +7,8 @@ namespace Granulator
     const int MAXSAMPLE = 16;
 
     AudioPluginUtil::Mutex sampleMutex;
+    AudioPluginUtil::Mutex uploadMutex;     // Protects the uploads in progress, which are only swapped into the samples under sampleMutex when committed
+    AudioPluginUtil::Mutex convertMutex;    // Serializes replacing samples, so that the new ones can be converted without holding sampleMutex
     int debug_graincount = 0;
 
     struct GranulatorSample
@@ -33,7 +35,56 @@ namespace Granulator
         return samples[index];
     }
 
+    inline AudioPluginUtil::SampleUpload& GetUpload(int index)
+    {
+        static AudioPluginUtil::SampleUpload uploads[MAXSAMPLE];
+        return uploads[index];
+    }
+
     int globalupdatecount = 0;
+    // Sample rate of the most recently created instance, uploaded samples are converted to it. There is only one rate for all instances,
+    // as Unity runs every effect at the output rate of the mixer and re-creates them when that changes. Protected by convertMutex.
+    int outputsamplerate = 0;
+
+    static void UpdatePreview(GranulatorSample& s)
+    {
+        delete[] s.preview;
+        s.preview = new float[s.numsamples * s.numchannels];
+
+        double integrator[8]; memset(integrator, 0, sizeof(integrator));
+        float* src = s.data;
+        float* dst = s.preview;
+        for (int n = 0; n < s.numsamples; n++)
+        {
+            for (int i = 0; i < s.numchannels; i++)
+            {
+                // Calculate full integrated signal for better reconstruction in GetFloatBufferCallback.
+                // The small leak of 0.1% prevents build-up of DC.
+                integrator[i] = integrator[i] * 0.9999f + fabsf(*src++);
+                *dst++ = (float)(integrator[i]);
+            }
+        }
+    }
+
+    // Converts an uploaded sample to the given rate, so that grains only interpolate for their speed and not for the rate too, and
+    // computes a new preview for it. Only replaces the data and preview pointers of s without deleting them, so it can be called on
+    // a copy of a sample that the audio thread is still using.
+    static void ConvertSample(GranulatorSample& s, int samplerate)
+    {
+        if (s.numsamples == 0 || s.samplerate <= 0 || samplerate <= 0 || s.samplerate == samplerate)
+            return;
+
+        const AudioPluginUtil::Resampler* resampler = AudioPluginUtil::Resampler::Get(s.samplerate, samplerate);
+        int numsamples = resampler->GetOutputLength(s.numsamples);
+        float* data = new float[numsamples * s.numchannels];
+        for (int i = 0; i < s.numchannels; i++)
+            resampler->Process(s.data + i, s.numsamples, s.numchannels, data + i, numsamples, s.numchannels);
+        s.data = data;
+        s.preview = NULL;
+        s.numsamples = numsamples;
+        s.samplerate = samplerate;
+        UpdatePreview(s);
+    }
 
     enum Param
     {
@@ -162,6 +213,32 @@ namespace Granulator
         memset(data->delay.data, 0, sizeof(float) * data->delay.numsamples * data->delay.numchannels);
         memset(data->delay.preview, 0, sizeof(float) * data->delay.numsamples * data->delay.numchannels);
         AudioPluginUtil::InitParametersFromDefinitions(InternalRegisterEffectDefinition, data->p);
+
+        // samples uploaded before any instance existed are converted now, outside of sampleMutex so that other instances keep playing
+        AudioPluginUtil::MutexScopeLock mutexScope(Granulator::convertMutex);
+        outputsamplerate = state->samplerate;
+        for (int i = 0; i < MAXSAMPLE; i++)
+        {
+            GranulatorSample& s = GetGranulatorSample(i);
+            GranulatorSample converted = s;
+            ConvertSample(converted, outputsamplerate);
+            if (converted.data == s.data)
+                continue;
+
+            float* prevdata;
+            float* prevpreview;
+            {
+                AudioPluginUtil::MutexScopeLock sampleScope(Granulator::sampleMutex);
+                prevdata = s.data;
+                prevpreview = s.preview;
+                s.data = converted.data;
+                s.preview = converted.preview;
+                s.numsamples = converted.numsamples;
+                s.samplerate = converted.samplerate;
+            }
+            delete[] prevdata;
+            delete[] prevpreview;
+        }
         return UNITY_AUDIODSP_OK;
     }
 
@@ -348,57 +425,86 @@ namespace Granulator
     }
 }
 
-extern "C" UNITY_AUDIODSP_EXPORT_API bool Granulator_UploadSample(int index, float* data, int numsamples, int numchannels, int samplerate, const char* name)
+// Starts uploading a sample of numsamples frames with numchannels interleaved channels to the given slot in chunks, replacing any upload
+// to it that is still in progress. The sample in the slot stays in use until the upload is committed.
+extern "C" UNITY_AUDIODSP_EXPORT_API bool Granulator_BeginUpload(int index, int numsamples, int numchannels, int samplerate, const char* name)
+{
+    if (index < 0 || index >= Granulator::MAXSAMPLE)
+        return false;
+    AudioPluginUtil::MutexScopeLock mutexScope(Granulator::uploadMutex);
+    return Granulator::GetUpload(index).Begin(numsamples, numchannels, samplerate, name);
+}
+
+// Appends the next numsamples frames to the upload in progress
+extern "C" UNITY_AUDIODSP_EXPORT_API bool Granulator_AppendUpload(int index, float* data, int numsamples)
 {
     if (index < 0 || index >= Granulator::MAXSAMPLE)
         return false;
+    AudioPluginUtil::MutexScopeLock mutexScope(Granulator::uploadMutex);
+    return Granulator::GetUpload(index).Append(data, numsamples);
+}
 
-    AudioPluginUtil::MutexScopeLock mutexScope(Granulator::sampleMutex);
+// Replaces the sample in the slot with the uploaded one once all of its frames have been appended. The sample is converted and its
+// preview computed before taking sampleMutex, which the audio thread holds while playing grains from it.
+extern "C" UNITY_AUDIODSP_EXPORT_API bool Granulator_CommitUpload(int index)
+{
+    if (index < 0 || index >= Granulator::MAXSAMPLE)
+        return false;
 
-    Granulator::GranulatorSample& s = Granulator::GetGranulatorSample(index);
-    if (s.allocated)
+    Granulator::GranulatorSample upload;
+    memset(&upload, 0, sizeof(upload));
     {
-        delete[] s.data;
-        delete[] s.preview;
+        AudioPluginUtil::MutexScopeLock mutexScope(Granulator::uploadMutex);
+        AudioPluginUtil::SampleUpload& u = Granulator::GetUpload(index);
+        if (!u.IsComplete())
+            return false;
+        upload.numsamples = u.GetNumSamples();
+        upload.numchannels = u.GetNumChannels();
+        upload.samplerate = u.GetSampleRate();
+        strcpy_s(upload.name, u.GetName());
+        upload.data = u.Detach();
     }
 
-    int num = numsamples * numchannels;
-    if (num > 0)
-    {
-        s.data = new float[num];
-        s.preview = new float[num];
-        s.allocated = 1;
-        strcpy_s(s.name, name);
-        memcpy(s.data, data, num * sizeof(float));
-        double integrator[8]; memset(integrator, 0, sizeof(integrator));
-        float* src = s.data;
-        float* dst = s.preview;
-        for (int n = 0; n < numsamples; n++)
-        {
-            for (int i = 0; i < numchannels; i++)
-            {
-                // Calculate full integrated signal for better reconstruction in GetFloatBufferCallback.
-                // The small leak of 0.1% prevents build-up of DC.
-                integrator[i] = integrator[i] * 0.9999f + fabsf(*src++);
-                *dst++ = (float)(integrator[i]);
-            }
-        }
-    }
-    else
+    // holding convertMutex until the sample is in its slot, as an instance created at another rate in the meantime would only
+    // convert the samples that are already there
+    AudioPluginUtil::MutexScopeLock convertScope(Granulator::convertMutex);
+    float* uploaddata = upload.data;
+    Granulator::ConvertSample(upload, Granulator::outputsamplerate);
+    if (upload.data != uploaddata)
+        delete[] uploaddata;
+    if (upload.numsamples > 0 && upload.preview == NULL)
+        Granulator::UpdatePreview(upload);
+
+    float* prevdata;
+    float* prevpreview;
     {
-        s.data = NULL;
-        s.preview = NULL;
-        s.allocated = 0;
+        AudioPluginUtil::MutexScopeLock mutexScope(Granulator::sampleMutex);
+        Granulator::GranulatorSample& s = Granulator::GetGranulatorSample(index);
+        prevdata = s.data;
+        prevpreview = s.preview;
+        s.data = upload.data;
+        s.preview = upload.preview;
+        s.allocated = (upload.numsamples > 0) ? 1 : 0;
+        if (upload.numsamples > 0)
+            strcpy_s(s.name, upload.name);
+        s.numsamples = upload.numsamples;
+        s.numchannels = upload.numchannels;
+        s.samplerate = upload.samplerate;
+        s.updatecount = ++Granulator::globalupdatecount;
     }
-
-    s.numsamples = numsamples;
-    s.numchannels = numchannels;
-    s.samplerate = samplerate;
-    s.updatecount = ++Granulator::globalupdatecount;
-
+    delete[] prevdata;
+    delete[] prevpreview;
     return true;
 }
 
+extern "C" UNITY_AUDIODSP_EXPORT_API bool Granulator_UploadSample(int index, float* data, int numsamples, int numchannels, int samplerate, const char* name)
+{
+    return
+        Granulator_BeginUpload(index, numsamples, numchannels, samplerate, name) &&
+        Granulator_AppendUpload(index, data, numsamples) &&
+        Granulator_CommitUpload(index);
+}
+
 extern "C" UNITY_AUDIODSP_EXPORT_API const char* Granulator_GetSampleName(int index)
 {
     if (index < 0)
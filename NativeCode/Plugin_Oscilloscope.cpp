@@ -19,7 +19,9 @@ namespace Oscilloscope
         AudioPluginUtil::HistoryBuffer history[8];
         AudioPluginUtil::HistoryBuffer spectrum[8];
         int numchannels;
-        AudioPluginUtil::UnityComplexNumber fftbuf[FFTSIZE];
+        const AudioPluginUtil::FFTPlan* fftplan;
+        float fftinput[FFTSIZE];
+        AudioPluginUtil::UnityComplexNumber fftbuf[FFTSIZE / 2 + 1];
         float smoothspec[8][FFTSIZE];
     };
 
@@ -39,6 +41,7 @@ namespace Oscilloscope
         EffectData* data = new EffectData;
         memset(data, 0, sizeof(EffectData));
         AudioPluginUtil::InitParametersFromDefinitions(InternalRegisterEffectDefinition, data->p);
+        data->fftplan = AudioPluginUtil::FFTPlan::Get(FFTSIZE, false);
         state->effectdata = data;
         for (int i = 0; i < 8; i++)
         {
@@ -73,16 +76,16 @@ namespace Oscilloscope
                 int windowsize = FFTSIZE / 2;
                 int w = history.writeindex;
                 float c = 1.0f, s = 0.0f, f = 2.0f * sinf(AudioPluginUtil::kPI / (float)windowsize);
-                memset(data->fftbuf, 0, sizeof(AudioPluginUtil::UnityComplexNumber) * FFTSIZE);
+                memset(data->fftinput + windowsize, 0, sizeof(float) * (FFTSIZE - windowsize));
                 for (int n = 0; n < windowsize; n++)
                 {
-                    data->fftbuf[n].re = history.data[w] * (0.5f - 0.5f * c);
+                    data->fftinput[n] = history.data[w] * (0.5f - 0.5f * c);
                     s += c * f;
                     c -= s * f;
                     if (--w < 0)
                         w = history.length - 1;
                 }
-                AudioPluginUtil::FFT::Forward(data->fftbuf, FFTSIZE, true);
+                data->fftplan->ForwardReal(data->fftinput, data->fftbuf);
                 float specdecay = powf(10.0f, 0.05f * data->p[P_SpectrumDecay] * length / (float)state->samplerate);
                 for (int n = 0; n < FFTSIZE / 2; n++)
                 {
@@ -28,13 +28,15 @@ namespace PitchDetector
         struct Data
         {
             float p[P_NUM];
+            const AudioPluginUtil::FFTPlan* fftplan;
             int counter;
             float env;
             float phase;
             float buffer[WINSIZE];
             float window[WINSIZE];
             float acnf[FFTSIZE];
-            AudioPluginUtil::UnityComplexNumber spec[FFTSIZE];
+            float acf[FFTSIZE];
+            AudioPluginUtil::UnityComplexNumber spec[FFTSIZE / 2 + 1];
         };
         union
         {
@@ -65,17 +67,20 @@ namespace PitchDetector
 
         // Calculate window and autocorrelation normalization factor
         EffectData::Data* data = &effectdata->data;
+        data->fftplan = AudioPluginUtil::FFTPlan::Get(FFTSIZE, false);
         for (int i = 0; i < WINSIZE; i++)
         {
             float w = 0.5f - 0.5f * cosf(i * AudioPluginUtil::kPI / (float)WINSIZE);
             data->window[i] = w;
-            data->spec[i].re = w;
+            data->acf[i] = w;
         }
 
-        // Window correction
-        AudioPluginUtil::FFT::Forward(data->spec, FFTSIZE, true);
-        for (int i = 0; i < FFTSIZE; i++)
+        // Window correction (the spectrum of the real window is symmetric, so mirror the upper half)
+        data->fftplan->ForwardReal(data->acf, data->spec);
+        for (int i = 0; i <= FFTSIZE / 2; i++)
             data->acnf[i] = 1.0f / data->spec[i].Magnitude2();
+        for (int i = FFTSIZE / 2 + 1; i < FFTSIZE; i++)
+            data->acnf[i] = data->acnf[FFTSIZE - i];
 
         state->effectdata = effectdata;
         AudioPluginUtil::InitParametersFromDefinitions(InternalRegisterEffectDefinition, effectdata->data.p);
@@ -139,33 +144,28 @@ namespace PitchDetector
                     data->buffer[i] = data->buffer[i + HOPSIZE];
 
                 for (int i = 0; i < WINSIZE; i++)
-                {
-                    data->spec[i].re = data->buffer[i] * data->window[i];
-                    data->spec[i].im = 0.0f;
-                }
+                    data->acf[i] = data->buffer[i] * data->window[i];
 
                 for (int i = WINSIZE; i < FFTSIZE; i++)
-                {
-                    data->spec[i].re = 0.0f;
-                    data->spec[i].im = 0.0f;
-                }
+                    data->acf[i] = 0.0f;
 
-                AudioPluginUtil::FFT::Forward(data->spec, FFTSIZE, true);
+                data->fftplan->ForwardReal(data->acf, data->spec);
 
                 int locut = (int)data->p[P_LOCUT];
                 int hicut = (int)data->p[P_HICUT];
                 memset(data->spec, 0, sizeof(AudioPluginUtil::UnityComplexNumber) * locut);
-                memset(data->spec + hicut, 0, sizeof(AudioPluginUtil::UnityComplexNumber) * (FFTSIZE - 2 * hicut));
-                memset(data->spec + FFTSIZE - locut, 0, sizeof(AudioPluginUtil::UnityComplexNumber) * locut);
+                memset(data->spec + hicut, 0, sizeof(AudioPluginUtil::UnityComplexNumber) * (FFTSIZE / 2 + 1 - hicut));
 
                 // Fast autocorrelation
-                for (int i = 0; i < FFTSIZE; i++)
+                for (int i = 0; i <= FFTSIZE / 2; i++)
                 {
                     data->spec[i].re = data->spec[i].Magnitude2() * data->acnf[n]; // Correct for windowing
                     data->spec[i].im = 0.0f;
                     debugdata[i] = data->spec[i].re;
                 }
-                AudioPluginUtil::FFT::Backward(data->spec, FFTSIZE, true);
+                for (int i = FFTSIZE / 2 + 1; i < FFTSIZE; i++)
+                    debugdata[i] = debugdata[FFTSIZE - i];
+                data->fftplan->BackwardReal(data->spec, data->acf);
 
                 int startbin = (int)data->p[P_LOBIN];
                 int endbin = (int)data->p[P_HIBIN];
@@ -173,7 +173,7 @@ namespace PitchDetector
                 float maxval = 0.0f;
                 for (int n = startbin; n < endbin; n++)
                 {
-                    float a = data->spec[n].re;
+                    float a = data->acf[n];
                     if (a > maxval)
                     {
                         maxbin = n;
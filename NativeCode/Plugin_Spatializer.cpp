@@ -1,6 +1,7 @@
 // Please note that this will only work on Unity 5.2 or higher.
 
 #include "AudioPluginUtil.h"
+#include "Spatializer.h"
 
 extern float hrtfSrcData[];
 extern float reverbmixbuffer[];
@@ -12,48 +13,103 @@ namespace Spatializer
         P_AUDIOSRCATTN,
         P_FIXEDVOLUME,
         P_CUSTOMFALLOFF,
+        P_AMBISONICBUS,
         P_NUM
     };
 
     const int HRTFLEN = 512;
+    const int HRTFBINS = HRTFLEN + 1; // Number of bins in the real-input spectrum of the zero-padded HRTFLEN * 2 long filter
 
     const float GAINCORRECTION = 2.0f;
 
+    const float HRTFCHANGETHRESHOLD = 1.0e-4f; // Energy of the change of the filters relative to their energy (-40 dB) above which the output is crossfaded
+
+    const int GRIDAZIMUTHS = 72;        // Azimuth steps of the precomputed HRTF grid, i.e. 5 degrees
+    const int GRIDELEVATIONS = 13;      // Elevation steps of the grid, the measured rings from -40 to 80 degrees in steps of 10 degrees
+
+    const int NUMVIRTUALSPEAKERS = 26;
+
+    // Real spherical harmonics in ACN channel order and SN3D normalization (AmbiX) up to third order for the unit vector x (front), y (left), z (up)
+    void EvaluateAmbisonicGains(float x, float y, float z, float* gains)
+    {
+        const float s3 = 1.7320508f, s15 = 3.8729833f, s38 = 0.6123724f, s58 = 0.7905694f;
+        gains[0] = 1.0f;
+        gains[1] = y;
+        gains[2] = z;
+        gains[3] = x;
+        gains[4] = s3 * x * y;
+        gains[5] = s3 * y * z;
+        gains[6] = 0.5f * (3.0f * z * z - 1.0f);
+        gains[7] = s3 * x * z;
+        gains[8] = 0.5f * s3 * (x * x - y * y);
+        gains[9] = s58 * y * (3.0f * x * x - y * y);
+        gains[10] = s15 * x * y * z;
+        gains[11] = s38 * y * (5.0f * z * z - 1.0f);
+        gains[12] = 0.5f * z * (5.0f * z * z - 3.0f);
+        gains[13] = s38 * x * (5.0f * z * z - 1.0f);
+        gains[14] = 0.5f * s15 * z * (x * x - y * y);
+        gains[15] = s58 * x * (x * x - 3.0f * y * y);
+    }
+
+    // The 26 point Lebedev grid integrates spherical harmonics exactly up to 7th order, so sampling the sound field at these virtual speakers
+    // with the quadrature weights decodes third order without loss
+    void GetVirtualSpeaker(int index, float* dir, float& weight)
+    {
+        static const float r2 = 0.70710678f, r3 = 0.57735027f;
+        static const float speakers[NUMVIRTUALSPEAKERS][4] =
+        {
+            {  1,  0,  0, 1.0f / 21.0f }, { -1,  0,  0, 1.0f / 21.0f }, {  0,  1,  0, 1.0f / 21.0f },
+            {  0, -1,  0, 1.0f / 21.0f }, {  0,  0,  1, 1.0f / 21.0f }, {  0,  0, -1, 1.0f / 21.0f },
+            {  r2,  r2,  0, 4.0f / 105.0f }, {  r2, -r2,  0, 4.0f / 105.0f }, { -r2,  r2,  0, 4.0f / 105.0f }, { -r2, -r2,  0, 4.0f / 105.0f },
+            {  r2,  0,  r2, 4.0f / 105.0f }, {  r2,  0, -r2, 4.0f / 105.0f }, { -r2,  0,  r2, 4.0f / 105.0f }, { -r2,  0, -r2, 4.0f / 105.0f },
+            {  0,  r2,  r2, 4.0f / 105.0f }, {  0,  r2, -r2, 4.0f / 105.0f }, {  0, -r2,  r2, 4.0f / 105.0f }, {  0, -r2, -r2, 4.0f / 105.0f },
+            {  r3,  r3,  r3, 9.0f / 280.0f }, {  r3,  r3, -r3, 9.0f / 280.0f }, {  r3, -r3,  r3, 9.0f / 280.0f }, {  r3, -r3, -r3, 9.0f / 280.0f },
+            { -r3,  r3,  r3, 9.0f / 280.0f }, { -r3,  r3, -r3, 9.0f / 280.0f }, { -r3, -r3,  r3, 9.0f / 280.0f }, { -r3, -r3, -r3, 9.0f / 280.0f }
+        };
+        dir[0] = speakers[index][0];
+        dir[1] = speakers[index][1];
+        dir[2] = speakers[index][2];
+        weight = speakers[index][3];
+    }
+
     class HRTFData
     {
         struct CircleCoeffs
         {
             int numangles;
-            float* hrtf;
+            float* hrtf; // Per angle the real parts of all bins followed by the imaginary parts
             float* angles;
 
-            void GetHRTF(AudioPluginUtil::UnityComplexNumber* h, float angle, float mix)
+            // Interpolates between the measured angles around the ring, wrapping around at 360 degrees
+            void GetHRTF(float* dst, float angle) const
             {
-                int index1 = 0;
-                while (index1 < numangles && angles[index1] < angle)
-                    index1++;
-                if (index1 > 0)
+                int index1 = numangles - 1;
+                while (index1 > 0 && angles[index1] > angle)
                     index1--;
                 int index2 = (index1 + 1) % numangles;
-                float* hrtf1 = hrtf + HRTFLEN * 4 * index1;
-                float* hrtf2 = hrtf + HRTFLEN * 4 * index2;
-                float f = (angle - angles[index1]) / (angles[index2] - angles[index1]);
-                for (int n = 0; n < HRTFLEN * 2; n++)
-                {
-                    h[n].re += (hrtf1[0] + (hrtf2[0] - hrtf1[0]) * f - h[n].re) * mix;
-                    h[n].im += (hrtf1[1] + (hrtf2[1] - hrtf1[1]) * f - h[n].im) * mix;
-                    hrtf1 += 2;
-                    hrtf2 += 2;
-                }
+                float angle1 = angles[index1], angle2 = angles[index2];
+                if (angle1 > angle)
+                    angle1 -= 360.0f;
+                if (angle2 <= angle1)
+                    angle2 += 360.0f;
+                const float* hrtf1 = hrtf + HRTFBINS * 2 * index1;
+                const float* hrtf2 = hrtf + HRTFBINS * 2 * index2;
+                float f = (angle - angle1) / (angle2 - angle1);
+                for (int n = 0; n < HRTFBINS * 2; n++)
+                    dst[n] = hrtf1[n] + (hrtf2[n] - hrtf1[n]) * f;
             }
         };
 
     public:
-        CircleCoeffs hrtfChannel[2][14];
+        float* grid; // Per ear, elevation and azimuth step the real parts of all bins followed by the imaginary parts
+        float* decoderfilters; // Per ambisonic order, channel and ear the virtual speaker HRTFs weighted by their decoding gains and summed
+        const AudioPluginUtil::FFTPlan* fftplan;
 
     public:
         HRTFData()
         {
+            fftplan = AudioPluginUtil::FFTPlan::Get(HRTFLEN * 2, false);
+            CircleCoeffs hrtfChannel[2][14];
             float* p = hrtfSrcData;
             for (int c = 0; c < 2; c++)
             {
@@ -63,43 +119,416 @@ namespace Spatializer
                     coeffs.numangles = (int)(*p++);
                     coeffs.angles = p;
                     p += coeffs.numangles;
-                    coeffs.hrtf = new float[coeffs.numangles * HRTFLEN * 4];
+                    coeffs.hrtf = new float[coeffs.numangles * HRTFBINS * 2];
                     float* dst = coeffs.hrtf;
-                    AudioPluginUtil::UnityComplexNumber h[HRTFLEN * 2];
+                    float ir[HRTFLEN * 2];
                     for (int a = 0; a < coeffs.numangles; a++)
                     {
-                        memset(h, 0, sizeof(h));
+                        memset(ir, 0, sizeof(float) * HRTFLEN);
                         for (int n = 0; n < HRTFLEN; n++)
-                            h[n + HRTFLEN].re = p[n];
+                            ir[n + HRTFLEN] = p[n];
                         p += HRTFLEN;
-                        AudioPluginUtil::FFT::Forward(h, HRTFLEN * 2, false);
-                        for (int n = 0; n < HRTFLEN * 2; n++)
+                        AudioPluginUtil::SplitComplex h = { dst, dst + HRTFBINS };
+                        fftplan->ForwardReal(ir, h);
+                        dst += HRTFBINS * 2;
+                    }
+                }
+            }
+
+            // Resample the rings, which are measured at different azimuth steps, to a uniform grid once, so that looking up a direction
+            // only needs to blend the four surrounding grid points
+            grid = new float[2 * GRIDELEVATIONS * GRIDAZIMUTHS * HRTFBINS * 2];
+            for (int c = 0; c < 2; c++)
+                for (int e = 0; e < GRIDELEVATIONS; e++)
+                    for (int a = 0; a < GRIDAZIMUTHS; a++)
+                        hrtfChannel[c][e].GetHRTF(GetGridHRTF(c, e, a), a * (360.0f / GRIDAZIMUTHS));
+
+            for (int c = 0; c < 2; c++)
+                for (int e = 0; e < 14; e++)
+                    delete[] hrtfChannel[c][e].hrtf;
+
+            // The ambisonic decoder feeds each channel through the sum of the virtual speaker HRTFs weighted by the channel's gain for that
+            // speaker, so that it needs a fixed number of multiply-adds per ambisonic channel rather than per speaker. The gains use max-rE
+            // weighting of the orders to keep the energy of a decoded source focused in its direction. Speakers below the lowest measured
+            // ring use its HRTFs.
+            static const float kDeg2Rad = AudioPluginUtil::kPI / 180.0f;
+            static const float kRad2Deg = 180.0f / AudioPluginUtil::kPI;
+            decoderfilters = new float[MAXAMBISONICORDER * MAXAMBISONICCHANNELS * 2 * HRTFBINS * 2];
+            memset(decoderfilters, 0, sizeof(float) * MAXAMBISONICORDER * MAXAMBISONICCHANNELS * 2 * HRTFBINS * 2);
+            for (int s = 0; s < NUMVIRTUALSPEAKERS; s++)
+            {
+                float dir[3], weight, gains[MAXAMBISONICCHANNELS];
+                GetVirtualSpeaker(s, dir, weight);
+                EvaluateAmbisonicGains(dir[0], dir[1], dir[2], gains);
+                float azimuth = atan2f(-dir[1], dir[0]) * kRad2Deg;
+                if (azimuth < 0.0f)
+                    azimuth += 360.0f;
+                float elevation = asinf(dir[2]) * kRad2Deg;
+                float hrtf[2][HRTFBINS * 2];
+                for (int c = 0; c < 2; c++)
+                {
+                    AudioPluginUtil::SplitComplex h = { hrtf[c], hrtf[c] + HRTFBINS };
+                    GetHRTF(c, h, azimuth, elevation);
+                }
+                for (int order = 1; order <= MAXAMBISONICORDER; order++)
+                {
+                    float x = cosf(137.9f * kDeg2Rad / (order + 1.51f));
+                    float orderweights[MAXAMBISONICORDER + 1] = { 1.0f, x, 0.5f * (3.0f * x * x - 1.0f), 0.5f * x * (5.0f * x * x - 3.0f) };
+                    for (int k = 0; k < (order + 1) * (order + 1); k++)
+                    {
+                        int l = (k >= 9) ? 3 : (k >= 4) ? 2 : (k >= 1) ? 1 : 0;
+                        float g = weight * (2 * l + 1) * orderweights[l] * gains[k];
+                        for (int c = 0; c < 2; c++)
                         {
-                            *dst++ = h[n].re;
-                            *dst++ = h[n].im;
+                            float* dst = GetDecoderFilter(order, k, c);
+                            for (int n = 0; n < HRTFBINS * 2; n++)
+                                dst[n] += hrtf[c][n] * g;
                         }
                     }
                 }
             }
         }
+
+        inline float* GetGridHRTF(int channel, int elevation, int azimuth) const
+        {
+            return grid + ((channel * GRIDELEVATIONS + elevation) * GRIDAZIMUTHS + azimuth) * HRTFBINS * 2;
+        }
+
+        inline float* GetDecoderFilter(int order, int channel, int ear) const
+        {
+            return decoderfilters + (((order - 1) * MAXAMBISONICCHANNELS + channel) * 2 + ear) * HRTFBINS * 2;
+        }
+
+        // Bilinear interpolation of the grid at the given azimuth (0 to 360 degrees) and elevation (in degrees)
+        void GetHRTF(int channel, const AudioPluginUtil::SplitComplex& h, float azimuth, float elevation) const
+        {
+            float a = azimuth * (GRIDAZIMUTHS / 360.0f);
+            int a1 = AudioPluginUtil::FastFloor(a);
+            float fa = a - a1;
+            a1 = (a1 < 0) ? 0 : (a1 % GRIDAZIMUTHS);
+            int a2 = (a1 + 1 < GRIDAZIMUTHS) ? (a1 + 1) : 0;
+
+            float e = AudioPluginUtil::FastClip(elevation * 0.1f + 4, 0, GRIDELEVATIONS - 1);
+            int e1 = AudioPluginUtil::FastFloor(e);
+            if (e1 > GRIDELEVATIONS - 2)
+                e1 = GRIDELEVATIONS - 2;
+            float fe = e - e1;
+
+            const float* h11 = GetGridHRTF(channel, e1, a1);
+            const float* h12 = GetGridHRTF(channel, e1, a2);
+            const float* h21 = GetGridHRTF(channel, e1 + 1, a1);
+            const float* h22 = GetGridHRTF(channel, e1 + 1, a2);
+            const float w11 = (1.0f - fa) * (1.0f - fe), w12 = fa * (1.0f - fe), w21 = (1.0f - fa) * fe, w22 = fa * fe;
+            for (int n = 0; n < HRTFBINS; n++)
+                h.re[n] = h11[n] * w11 + h12[n] * w12 + h21[n] * w21 + h22[n] * w22;
+            h11 += HRTFBINS;
+            h12 += HRTFBINS;
+            h21 += HRTFBINS;
+            h22 += HRTFBINS;
+            for (int n = 0; n < HRTFBINS; n++)
+                h.im[n] = h11[n] * w11 + h12[n] * w12 + h21[n] * w21 + h22[n] * w22;
+        }
+    };
+
+    // Function-local so that the decoder can already be used by the unit tests that run while the library is loaded
+    static HRTFData& GetSharedData()
+    {
+        static HRTFData data;
+        return data;
+    }
+
+    struct AmbisonicDecoder
+    {
+        float buffer[MAXAMBISONICCHANNELS][HRTFLEN * 2];    // Overlap-save input of each ambisonic channel
+        float xre[MAXAMBISONICCHANNELS][HRTFBINS], xim[MAXAMBISONICCHANNELS][HRTFBINS];
+        float yre[2][HRTFBINS], yim[2][HRTFBINS];
+        float output[2][HRTFLEN * 2];
+        float scratchre[HRTFLEN * 2], scratchim[HRTFLEN * 2];
+        float rotation[MAXAMBISONICCHANNELS][MAXAMBISONICCHANNELS];     // Rotation of the spherical harmonics applied to the input
+        float prevrotation[MAXAMBISONICCHANNELS][MAXAMBISONICCHANNELS]; // Rotation of the previous call, faded to the new one over the block
+        bool rotate;                                                    // SetAmbisonicRotation has been called
+        int fifopos;                                                    // Frames of the current chunk collected so far
+        bool buffered;                                                  // A callback that is not made of whole chunks has been seen, so the output is delayed by one chunk
     };
 
-    static HRTFData sharedData;
+    AmbisonicDecoder* CreateAmbisonicDecoder()
+    {
+        GetSharedData();
+        AmbisonicDecoder* decoder = new AmbisonicDecoder;
+        memset(decoder, 0, sizeof(AmbisonicDecoder));
+        return decoder;
+    }
+
+    void ReleaseAmbisonicDecoder(AmbisonicDecoder* decoder)
+    {
+        delete decoder;
+    }
+
+    // Sets the rotation (row-major 3x3 matrix in ambisonic coordinates) that turns the input sound field before decoding. The matrix for
+    // each order is found by projecting the rotated spherical harmonics back onto the unrotated ones, which the virtual speaker grid
+    // integrates exactly.
+    void SetAmbisonicRotation(AmbisonicDecoder* decoder, const float* matrix)
+    {
+        memcpy(decoder->prevrotation, decoder->rotation, sizeof(decoder->rotation));
+        memset(decoder->rotation, 0, sizeof(decoder->rotation));
+        for (int s = 0; s < NUMVIRTUALSPEAKERS; s++)
+        {
+            float dir[3], weight, gains[MAXAMBISONICCHANNELS], rotatedgains[MAXAMBISONICCHANNELS];
+            GetVirtualSpeaker(s, dir, weight);
+            EvaluateAmbisonicGains(dir[0], dir[1], dir[2], gains);
+            EvaluateAmbisonicGains(
+                matrix[0] * dir[0] + matrix[1] * dir[1] + matrix[2] * dir[2],
+                matrix[3] * dir[0] + matrix[4] * dir[1] + matrix[5] * dir[2],
+                matrix[6] * dir[0] + matrix[7] * dir[1] + matrix[8] * dir[2],
+                rotatedgains);
+            for (int l = 0; l <= MAXAMBISONICORDER; l++)
+                for (int k = l * l; k < (l + 1) * (l + 1); k++)
+                    for (int j = l * l; j < (l + 1) * (l + 1); j++)
+                        decoder->rotation[k][j] += weight * (2 * l + 1) * rotatedgains[k] * gains[j];
+        }
+        if (!decoder->rotate)
+            memcpy(decoder->prevrotation, decoder->rotation, sizeof(decoder->rotation));
+        decoder->rotate = true;
+    }
+
+    // Transforms the chunk collected in the second half of the input buffers and keeps it in the first half as history for the next chunk
+    static void DecodeAmbisonicChunk(AmbisonicDecoder* decoder, int order)
+    {
+        const HRTFData& sharedData = GetSharedData();
+        const int numchannels = (order + 1) * (order + 1);
+        const AudioPluginUtil::SplitComplex scratch = { decoder->scratchre, decoder->scratchim };
+        AudioPluginUtil::SplitComplex spectra[MAXAMBISONICCHANNELS], outputspectra[2];
+        for (int k = 0; k < numchannels; k++)
+        {
+            spectra[k].re = decoder->xre[k];
+            spectra[k].im = decoder->xim[k];
+        }
+        for (int c = 0; c < 2; c++)
+        {
+            outputspectra[c].re = decoder->yre[c];
+            outputspectra[c].im = decoder->yim[c];
+        }
+
+        int k = 0;
+        for (; k + 1 < numchannels; k += 2)
+            sharedData.fftplan->ForwardRealPair(decoder->buffer[k], decoder->buffer[k + 1], spectra[k], spectra[k + 1], scratch);
+        if (k < numchannels)
+            sharedData.fftplan->ForwardReal(decoder->buffer[k], spectra[k]);
+
+        for (int c = 0; c < 2; c++)
+        {
+            for (k = 0; k < numchannels; k++)
+            {
+                float* filter = sharedData.GetDecoderFilter(order, k, c);
+                AudioPluginUtil::SplitComplex h = { filter, filter + HRTFBINS };
+                if (k == 0)
+                    AudioPluginUtil::SplitComplexMul(spectra[k], h, outputspectra[c], HRTFBINS);
+                else
+                    AudioPluginUtil::SplitComplexMulAdd(spectra[k], h, outputspectra[c], HRTFBINS);
+            }
+        }
+        sharedData.fftplan->BackwardRealPair(outputspectra[0], outputspectra[1], decoder->output[0], decoder->output[1]);
+
+        for (k = 0; k < numchannels; k++)
+            memcpy(decoder->buffer[k], decoder->buffer[k] + HRTFLEN, sizeof(float) * HRTFLEN);
+    }
+
+    static inline void WriteAmbisonicFrame(const AmbisonicDecoder* decoder, int pos, float* dst, int outchannels)
+    {
+        dst[0] = decoder->output[0][pos] * GAINCORRECTION;
+        dst[1] = decoder->output[1][pos] * GAINCORRECTION;
+        for (int c = 2; c < outchannels; c++)
+            dst[c] = 0.0f;
+    }
+
+    // Decodes the first (order + 1)^2 channels of the interleaved ambisonic input to binaural stereo in the first two output channels, costing
+    // one forward transform per ambisonic channel and one inverse transform for both ears per HRTFLEN frames regardless of how many sources
+    // were mixed into the input. Callbacks made of whole chunks are decoded without latency. Once any other length is seen, the decoder
+    // switches for good to collecting the input in a FIFO and playing back the previous chunk, which delays the output by HRTFLEN frames.
+    void DecodeAmbisonic(AmbisonicDecoder* decoder, const float* input, int inchannels, int order, float* output, int outchannels, unsigned int length)
+    {
+        order = (order < 1) ? 1 : (order > MAXAMBISONICORDER) ? MAXAMBISONICORDER : order;
+        while (order > 0 && (order + 1) * (order + 1) > inchannels)
+            order--;
+        if (order == 0)
+        {
+            memset(output, 0, sizeof(float) * length * outchannels);
+            return;
+        }
+
+        if (!decoder->buffered && (length % HRTFLEN) != 0)
+        {
+            decoder->buffered = true;
+            memset(decoder->output, 0, sizeof(decoder->output));
+        }
+
+        const int numchannels = (order + 1) * (order + 1);
+        const float fadestep = 1.0f / (float)length;
+        for (unsigned int n = 0; n < length; n++)
+        {
+            const float* x = input + n * inchannels;
+            const int pos = HRTFLEN + decoder->fifopos;
+            if (decoder->rotate)
+            {
+                // Channels only mix with the other channels of the same order under rotation
+                float f = n * fadestep;
+                for (int l = 0; l <= order; l++)
+                {
+                    for (int k = l * l; k < (l + 1) * (l + 1); k++)
+                    {
+                        float y = 0.0f, prevy = 0.0f;
+                        for (int j = l * l; j < (l + 1) * (l + 1); j++)
+                        {
+                            y += decoder->rotation[k][j] * x[j];
+                            prevy += decoder->prevrotation[k][j] * x[j];
+                        }
+                        decoder->buffer[k][pos] = prevy + (y - prevy) * f;
+                    }
+                }
+            }
+            else
+            {
+                for (int k = 0; k < numchannels; k++)
+                    decoder->buffer[k][pos] = x[k];
+            }
+
+            if (decoder->buffered)
+                WriteAmbisonicFrame(decoder, decoder->fifopos, output + n * outchannels, outchannels);
+
+            if (++decoder->fifopos == HRTFLEN)
+            {
+                DecodeAmbisonicChunk(decoder, order);
+                decoder->fifopos = 0;
+                if (!decoder->buffered)
+                {
+                    float* dst = output + (n + 1 - HRTFLEN) * outchannels;
+                    for (int i = 0; i < HRTFLEN; i++)
+                        WriteAmbisonicFrame(decoder, i, dst + i * outchannels, outchannels);
+                }
+            }
+        }
+
+        memcpy(decoder->prevrotation, decoder->rotation, sizeof(decoder->rotation));
+    }
 
     struct InstanceChannel
     {
-        AudioPluginUtil::UnityComplexNumber h[HRTFLEN * 2];
-        AudioPluginUtil::UnityComplexNumber x[HRTFLEN * 2];
-        AudioPluginUtil::UnityComplexNumber y[HRTFLEN * 2];
+        // Spectra in split complex layout
+        float hre[HRTFBINS], him[HRTFBINS];
+        float prevhre[HRTFBINS], prevhim[HRTFBINS];         // Filter of the previous chunk, faded out while the new one is faded in
+        float xre[HRTFBINS], xim[HRTFBINS];
+        float yre[HRTFBINS], yim[HRTFBINS];
+        float prevyre[HRTFBINS], prevyim[HRTFBINS];
         float buffer[HRTFLEN * 2];
+        float output[HRTFLEN * 2];
+        float prevoutput[HRTFLEN * 2];
     };
 
     struct EffectData
     {
         float p[P_NUM];
         InstanceChannel ch[2];
+        bool hrtfvalid;                                     // The filters have been used for a previous chunk
+        float scratchre[HRTFLEN * 2], scratchim[HRTFLEN * 2]; // Complex signal holding both ears for the forward transform
+        float busgains[MAXAMBISONICCHANNELS];               // Ambisonic encoding gains of the previous callback, ramped to the new ones
+        bool busgainsvalid;
+        float fifoinput[HRTFLEN * 2];                       // Interleaved stereo input of the current chunk
+        float fifooutput[HRTFLEN * 2];                      // Interleaved stereo output of the previous chunk
+        int fifopos;                                        // Frames of the current chunk collected so far
+        bool buffered;                                      // A callback that is not made of whole chunks has been seen, so the output is delayed by one chunk
     };
 
+    // Convolves the input buffers of both ears with their filters into their outputs. Both ears are transformed together as the real and
+    // imaginary parts of one complex signal. With crossfade, the output of the previous filters is computed as well and faded to the
+    // output of the new ones over the chunk.
+    static void ConvolveChunk(EffectData* data, const HRTFData& sharedData, bool crossfade)
+    {
+        AudioPluginUtil::SplitComplex h[2], prevh[2], spectra[2], outputspectra[2], prevoutputspectra[2];
+        const AudioPluginUtil::SplitComplex scratch = { data->scratchre, data->scratchim };
+        for (int c = 0; c < 2; c++)
+        {
+            InstanceChannel& ch = data->ch[c];
+            h[c].re = ch.hre;
+            h[c].im = ch.him;
+            prevh[c].re = ch.prevhre;
+            prevh[c].im = ch.prevhim;
+            spectra[c].re = ch.xre;
+            spectra[c].im = ch.xim;
+            outputspectra[c].re = ch.yre;
+            outputspectra[c].im = ch.yim;
+            prevoutputspectra[c].re = ch.prevyre;
+            prevoutputspectra[c].im = ch.prevyim;
+        }
+
+        sharedData.fftplan->ForwardRealPair(data->ch[0].buffer, data->ch[1].buffer, spectra[0], spectra[1], scratch);
+
+        for (int c = 0; c < 2; c++)
+            AudioPluginUtil::SplitComplexMul(spectra[c], h[c], outputspectra[c], HRTFBINS);
+        sharedData.fftplan->BackwardRealPair(outputspectra[0], outputspectra[1], data->ch[0].output, data->ch[1].output);
+
+        if (crossfade)
+        {
+            for (int c = 0; c < 2; c++)
+                AudioPluginUtil::SplitComplexMul(spectra[c], prevh[c], prevoutputspectra[c], HRTFBINS);
+            sharedData.fftplan->BackwardRealPair(prevoutputspectra[0], prevoutputspectra[1], data->ch[0].prevoutput, data->ch[1].prevoutput);
+
+            const float fadestep = 1.0f / (float)HRTFLEN;
+            for (int c = 0; c < 2; c++)
+            {
+                InstanceChannel& ch = data->ch[c];
+                for (int n = 0; n < HRTFLEN; n++)
+                    ch.output[n] = ch.prevoutput[n] + (ch.output[n] - ch.prevoutput[n]) * (n * fadestep);
+            }
+        }
+    }
+
+    // Spatializes one chunk of HRTFLEN interleaved stereo frames, which may be processed in place
+    static void SpatializeChunk(EffectData* data, const HRTFData& sharedData, const float* input, float* output, const float* spreadmatrix, const float* stereopan, float spatialblend)
+    {
+        double change = 0.0, energy = 0.0;
+        for (int c = 0; c < 2; c++)
+        {
+            const InstanceChannel& ch = data->ch[c];
+            for (int n = 0; n < HRTFBINS; n++)
+            {
+                float dre = ch.hre[n] - ch.prevhre[n], dim = ch.him[n] - ch.prevhim[n];
+                change += dre * dre + dim * dim;
+                energy += ch.hre[n] * ch.hre[n] + ch.him[n] * ch.him[n];
+            }
+        }
+
+        // Small changes of the filters are applied right away, larger ones are faded in over the chunk from the output of the previous
+        // filters, which costs an extra inverse transform only while the source moves
+        bool crossfade = data->hrtfvalid && change > energy * HRTFCHANGETHRESHOLD;
+        data->hrtfvalid = true;
+
+        for (int c = 0; c < 2; c++)
+        {
+            InstanceChannel& ch = data->ch[c];
+            for (int n = 0; n < HRTFLEN; n++)
+            {
+                float left  = input[n * 2];
+                float right = input[n * 2 + 1];
+                ch.buffer[n] = ch.buffer[n + HRTFLEN];
+                ch.buffer[n + HRTFLEN] = left * spreadmatrix[c] + right * spreadmatrix[1 - c];
+            }
+        }
+
+        ConvolveChunk(data, sharedData, crossfade);
+
+        for (int c = 0; c < 2; c++)
+        {
+            InstanceChannel& ch = data->ch[c];
+            for (int n = 0; n < HRTFLEN; n++)
+            {
+                float s = input[n * 2 + c] * stereopan[c];
+                output[n * 2 + c] = s + (ch.output[n] * GAINCORRECTION - s) * spatialblend;
+            }
+            memcpy(ch.prevhre, ch.hre, sizeof(ch.hre));
+            memcpy(ch.prevhim, ch.him, sizeof(ch.him));
+        }
+    }
+
     inline bool IsHostCompatible(UnityAudioEffectState* state)
     {
         // Somewhat convoluted error checking here because hostapiversion is only supported from SDK version 1.03 (i.e. Unity 5.2) and onwards.
@@ -116,6 +545,7 @@ namespace Spatializer
         AudioPluginUtil::RegisterParameter(definition, "AudioSrc Attn", "", 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, P_AUDIOSRCATTN, "AudioSource distance attenuation");
         AudioPluginUtil::RegisterParameter(definition, "Fixed Volume", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_FIXEDVOLUME, "Fixed volume amount");
         AudioPluginUtil::RegisterParameter(definition, "Custom Falloff", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_CUSTOMFALLOFF, "Custom volume falloff amount (logarithmic)");
+        AudioPluginUtil::RegisterParameter(definition, "Ambisonic Bus", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_AMBISONICBUS, "Only encode the source into the shared ambisonic bus that the Spatializer Ambisonic Bus effect decodes to binaural for all sources at once");
         definition.flags |= UnityAudioEffectDefinitionFlags_IsSpatializer;
         return numparams;
     }
@@ -132,6 +562,7 @@ namespace Spatializer
 
     UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
     {
+        GetSharedData();
         EffectData* effectdata = new EffectData;
         memset(effectdata, 0, sizeof(EffectData));
         state->effectdata = effectdata;
@@ -174,34 +605,20 @@ namespace Spatializer
         return UNITY_AUDIODSP_OK;
     }
 
-    static void GetHRTF(int channel, AudioPluginUtil::UnityComplexNumber* h, float azimuth, float elevation)
-    {
-        float e = AudioPluginUtil::FastClip(elevation * 0.1f + 4, 0, 12);
-        float f = floorf(e);
-        int index1 = (int)f;
-        if (index1 < 0)
-            index1 = 0;
-        else if (index1 > 12)
-            index1 = 12;
-        int index2 = index1 + 1;
-        if (index2 > 12)
-            index2 = 12;
-        sharedData.hrtfChannel[channel][index1].GetHRTF(h, azimuth, 1.0f);
-        sharedData.hrtfChannel[channel][index2].GetHRTF(h, azimuth, e - f);
-    }
-
     UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels)
     {
-        // Check that I/O formats are right and that the host API supports this feature
+        EffectData* data = state->GetEffectData<EffectData>();
+        const bool bus = data->p[P_AMBISONICBUS] >= 0.5f;
+
+        // Check that I/O formats are right and that the host API supports this feature. The ambisonic bus holds AMBISONICBUSFRAMES frames.
         if (inchannels != 2 || outchannels != 2 ||
-            !IsHostCompatible(state) || state->spatializerdata == NULL)
+            !IsHostCompatible(state) || state->spatializerdata == NULL ||
+            (bus && length > AMBISONICBUSFRAMES))
         {
             memcpy(outbuffer, inbuffer, length * outchannels * sizeof(float));
             return UNITY_AUDIODSP_OK;
         }
 
-        EffectData* data = state->GetEffectData<EffectData>();
-
         static const float kRad2Deg = 180.0f / AudioPluginUtil::kPI;
 
         float* m = state->spatializerdata->listenermatrix;
@@ -225,8 +642,69 @@ namespace Spatializer
         float spatialblend = state->spatializerdata->spatialblend;
         float reverbmix = state->spatializerdata->reverbzonemix;
 
-        GetHRTF(0, data->ch[0].h, azimuth, elevation);
-        GetHRTF(1, data->ch[1].h, azimuth, elevation);
+        // In bus mode the source is panned into the shared third order ambisonic bus with a few gains per sample instead of being convolved
+        // here. The stereo input is downmixed, so the spread setting does not apply.
+        if (bus)
+        {
+            // Ambisonics uses x front, y left and z up
+            float gains[MAXAMBISONICCHANNELS];
+            float dist = sqrtf(dir_x * dir_x + dir_y * dir_y + dir_z * dir_z);
+            if (dist < 0.001f)
+                EvaluateAmbisonicGains(1.0f, 0.0f, 0.0f, gains);
+            else
+                EvaluateAmbisonicGains(dir_z / dist, -dir_x / dist, dir_y / dist, gains);
+            if (!data->busgainsvalid)
+                memcpy(data->busgains, gains, sizeof(gains));
+            data->busgainsvalid = true;
+            data->hrtfvalid = false;
+
+            float g[MAXAMBISONICCHANNELS], dg[MAXAMBISONICCHANNELS];
+            for (int k = 0; k < MAXAMBISONICCHANNELS; k++)
+            {
+                g[k] = data->busgains[k];
+                dg[k] = (gains[k] - g[k]) / (float)length;
+            }
+
+            float stereopan[2] =
+            {
+                1.0f - AudioPluginUtil::FastMax(0.0f, state->spatializerdata->stereopan),
+                1.0f - AudioPluginUtil::FastMax(0.0f, -state->spatializerdata->stereopan)
+            };
+
+            float* bus = ambisonicbusbuffer;
+            for (unsigned int n = 0; n < length; n++)
+            {
+                float left  = inbuffer[n * 2];
+                float right = inbuffer[n * 2 + 1];
+                float mono = (left + right) * spatialblend;
+                for (int k = 0; k < MAXAMBISONICCHANNELS; k++)
+                {
+                    g[k] += dg[k];
+                    bus[k] += mono * g[k];
+                }
+                bus += MAXAMBISONICCHANNELS;
+
+                for (int c = 0; c < 2; c++)
+                {
+                    float x = inbuffer[n * 2 + c];
+                    float y = x * stereopan[c] * (1.0f - spatialblend);
+                    outbuffer[n * 2 + c] = y;
+                    reverbmixbuffer[n * 2 + c] += (y + x * spatialblend) * reverbmix;
+                }
+            }
+
+            memcpy(data->busgains, gains, sizeof(gains));
+            return UNITY_AUDIODSP_OK;
+        }
+        data->busgainsvalid = false;
+
+        const HRTFData& sharedData = GetSharedData();
+
+        for (int c = 0; c < 2; c++)
+        {
+            AudioPluginUtil::SplitComplex h = { data->ch[c].hre, data->ch[c].him };
+            sharedData.GetHRTF(c, h, azimuth, elevation);
+        }
 
         // From the FMOD documentation:
         //   A spread angle of 0 makes the stereo sound mono at the point of the 3D emitter.
@@ -238,51 +716,232 @@ namespace Spatializer
         float spread = cosf(state->spatializerdata->spread * AudioPluginUtil::kPI / 360.0f);
         float spreadmatrix[2] = { 2.0f - spread, spread };
 
-        float* reverb = reverbmixbuffer;
-        for (unsigned int sampleOffset = 0; sampleOffset < length; sampleOffset += HRTFLEN)
+        // stereopan is in the [-1; 1] range, this acts the way fmod does it for stereo
+        float stereopan[2] =
         {
-            for (int c = 0; c < 2; c++)
-            {
-                // stereopan is in the [-1; 1] range, this acts the way fmod does it for stereo
-                float stereopan = 1.0f - ((c == 0) ? AudioPluginUtil::FastMax(0.0f, state->spatializerdata->stereopan) : AudioPluginUtil::FastMax(0.0f, -state->spatializerdata->stereopan));
+            1.0f - AudioPluginUtil::FastMax(0.0f, state->spatializerdata->stereopan),
+            1.0f - AudioPluginUtil::FastMax(0.0f, -state->spatializerdata->stereopan)
+        };
 
-                InstanceChannel& ch = data->ch[c];
+        // The convolution works on chunks of HRTFLEN frames. As in DecodeAmbisonic, callbacks made of whole chunks are processed without
+        // latency, and once any other length is seen the input is collected in a FIFO for good, which delays the output by HRTFLEN frames.
+        if (!data->buffered && (length % HRTFLEN) != 0)
+        {
+            data->buffered = true;
+            memset(data->fifooutput, 0, sizeof(data->fifooutput));
+        }
 
-                for (int n = 0; n < HRTFLEN; n++)
+        if (data->buffered)
+        {
+            for (unsigned int n = 0; n < length; n++)
+            {
+                float* x = data->fifoinput + data->fifopos * 2;
+                const float* y = data->fifooutput + data->fifopos * 2;
+                for (int c = 0; c < 2; c++)
                 {
-                    float left  = inbuffer[n * 2];
-                    float right = inbuffer[n * 2 + 1];
-                    ch.buffer[n] = ch.buffer[n + HRTFLEN];
-                    ch.buffer[n + HRTFLEN] = left * spreadmatrix[c] + right * spreadmatrix[1 - c];
+                    x[c] = inbuffer[n * 2 + c];
+                    outbuffer[n * 2 + c] = y[c];
+                    reverbmixbuffer[n * 2 + c] += y[c] * reverbmix;
                 }
-
-                for (int n = 0; n < HRTFLEN * 2; n++)
+                if (++data->fifopos == HRTFLEN)
                 {
-                    ch.x[n].re = ch.buffer[n];
-                    ch.x[n].im = 0.0f;
+                    SpatializeChunk(data, sharedData, data->fifoinput, data->fifooutput, spreadmatrix, stereopan, spatialblend);
+                    data->fifopos = 0;
                 }
+            }
+            return UNITY_AUDIODSP_OK;
+        }
 
-                AudioPluginUtil::FFT::Forward(ch.x, HRTFLEN * 2, false);
+        for (unsigned int sampleOffset = 0; sampleOffset < length; sampleOffset += HRTFLEN)
+            SpatializeChunk(data, sharedData, inbuffer + sampleOffset * 2, outbuffer + sampleOffset * 2, spreadmatrix, stereopan, spatialblend);
 
-                for (int n = 0; n < HRTFLEN * 2; n++)
-                    AudioPluginUtil::UnityComplexNumber::Mul<float, float, float>(ch.x[n], ch.h[n], ch.y[n]);
+        for (unsigned int n = 0; n < length * 2; n++)
+            reverbmixbuffer[n] += outbuffer[n] * reverbmix;
 
-                AudioPluginUtil::FFT::Backward(ch.y, HRTFLEN * 2, false);
+        return UNITY_AUDIODSP_OK;
+    }
+}
 
-                for (int n = 0; n < HRTFLEN; n++)
+NAP_TESTSUITE(Spatializer)
+{
+    NAP_UNITTEST(AmbisonicBlockSizes)
+    {
+        // The decoder shared by the Spatializer Ambisonic Bus and the AmbisonicDecoder works on chunks of 512 frames. Other callback lengths,
+        // such as a 256 frame DSP buffer, must stay inside the buffers and give the output of chunk-aligned callbacks one chunk later.
+        const int numchannels = 16, numframes = 8192, chunk = 512, guard = 16;
+        static const int lengths[] = { 1024, 256, 300 };
+        const int numlengths = (int)(sizeof(lengths) / sizeof(lengths[0]));
+        AudioPluginUtil::Random r;
+        float* input = new float[numframes * numchannels];
+        for (int n = 0; n < numframes * numchannels; n++)
+            input[n] = r.GetFloat(-1.0f, 1.0f);
+        float* output[numlengths];
+        float* block = new float[1024 * 2 + guard];
+        for (int i = 0; i < numlengths; i++)
+        {
+            int length = lengths[i];
+            output[i] = new float[numframes * 2];
+            memset(output[i], 0, sizeof(float) * numframes * 2);
+            Spatializer::AmbisonicDecoder* decoder = Spatializer::CreateAmbisonicDecoder();
+            for (int offset = 0; offset + length <= numframes; offset += length)
+            {
+                for (int n = 0; n < guard; n++)
+                    block[length * 2 + n] = 12345.0f;
+                Spatializer::DecodeAmbisonic(decoder, input + offset * numchannels, numchannels, 3, block, 2, length);
+                for (int n = 0; n < guard; n++)
+                    NAP_CHECK(block[length * 2 + n] == 12345.0f);
+                memcpy(output[i] + offset * 2, block, sizeof(float) * length * 2);
+            }
+            Spatializer::ReleaseAmbisonicDecoder(decoder);
+        }
+        for (int i = 1; i < numlengths; i++)
+        {
+            int end = (numframes / lengths[i]) * lengths[i];
+            for (int n = chunk * 2; n < end; n++)
+            {
+                NAP_CHECK(fabsf(output[i][n * 2] - output[0][(n - chunk) * 2]) < 1.0e-5f);
+                NAP_CHECK(fabsf(output[i][n * 2 + 1] - output[0][(n - chunk) * 2 + 1]) < 1.0e-5f);
+            }
+        }
+        for (int i = 0; i < numlengths; i++)
+            delete[] output[i];
+        delete[] input;
+        delete[] block;
+    }
+
+    NAP_UNITTEST(SourceBlockSizes)
+    {
+        // Callbacks that are not made of whole chunks, such as a 256 frame DSP buffer, must be spatialized rather than passed through and give
+        // the output of chunk-aligned callbacks one chunk later.
+        const int numframes = 8192, chunk = Spatializer::HRTFLEN;
+        static const int lengths[] = { 1024, 256, 300 };
+        const int numlengths = (int)(sizeof(lengths) / sizeof(lengths[0]));
+        AudioPluginUtil::Random r;
+        float* input = new float[numframes * 2];
+        for (int n = 0; n < numframes * 2; n++)
+            input[n] = r.GetFloat(-1.0f, 1.0f);
+        float* output[numlengths];
+        for (int i = 0; i < numlengths; i++)
+        {
+            int length = lengths[i];
+            output[i] = new float[numframes * 2];
+            memset(output[i], 0, sizeof(float) * numframes * 2);
+            UnityAudioSpatializerData spatializerdata;
+            memset(&spatializerdata, 0, sizeof(spatializerdata));
+            for (int k = 0; k < 16; k += 5)
+                spatializerdata.listenermatrix[k] = spatializerdata.sourcematrix[k] = 1.0f;
+            spatializerdata.sourcematrix[12] = 1.0f;
+            spatializerdata.sourcematrix[14] = 1.0f;
+            spatializerdata.spatialblend = 1.0f;
+            UnityAudioEffectState state;
+            memset(&state, 0, sizeof(state));
+            state.structsize = sizeof(state);
+            state.hostapiversion = 0x010300;
+            state.spatializerdata = &spatializerdata;
+            state.internal = &state;
+            Spatializer::CreateCallback(&state);
+            for (int offset = 0; offset + length <= numframes; offset += length)
+                Spatializer::ProcessCallback(&state, input + offset * 2, output[i] + offset * 2, length, 2, 2);
+            Spatializer::ReleaseCallback(&state);
+        }
+        for (int i = 1; i < numlengths; i++)
+        {
+            int end = (numframes / lengths[i]) * lengths[i];
+            for (int n = 0; n < chunk; n++)
+                NAP_CHECK(output[i][n * 2] == 0.0f && output[i][n * 2 + 1] == 0.0f);
+            for (int n = chunk; n < end; n++)
+            {
+                NAP_CHECK(fabsf(output[i][n * 2] - output[0][(n - chunk) * 2]) < 1.0e-5f);
+                NAP_CHECK(fabsf(output[i][n * 2 + 1] - output[0][(n - chunk) * 2 + 1]) < 1.0e-5f);
+            }
+        }
+        for (int i = 0; i < numlengths; i++)
+            delete[] output[i];
+        delete[] input;
+    }
+
+    NAP_UNITTEST(PairedConvolution)
+    {
+        // Transforming both ears as one complex signal must give the same output as transforming them separately, also while crossfading
+        // from the previous filters.
+        const Spatializer::HRTFData& sharedData = Spatializer::GetSharedData();
+        const int fftsize = Spatializer::HRTFLEN * 2, numchunks = 8;
+        Spatializer::EffectData* data = new Spatializer::EffectData;
+        memset(data, 0, sizeof(Spatializer::EffectData));
+        AudioPluginUtil::SplitComplex spectra[2], outputspectra[4];
+        float* buffers[2];
+        float* outputs[4];
+        for (int i = 0; i < 2; i++)
+        {
+            buffers[i] = new float[fftsize];
+            spectra[i].re = new float[fftsize];
+            spectra[i].im = new float[fftsize];
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            outputs[i] = new float[fftsize];
+            outputspectra[i].re = new float[fftsize];
+            outputspectra[i].im = new float[fftsize];
+        }
+        AudioPluginUtil::Random r;
+        float maxerror = 0.0f, peak = 0.0f;
+        for (int chunk = 0; chunk < numchunks; chunk++)
+        {
+            bool crossfade = (chunk & 1) != 0;
+            for (int c = 0; c < 2; c++)
+            {
+                Spatializer::InstanceChannel& ch = data->ch[c];
+                memcpy(ch.prevhre, ch.hre, sizeof(ch.hre));
+                memcpy(ch.prevhim, ch.him, sizeof(ch.him));
+                AudioPluginUtil::SplitComplex h = { ch.hre, ch.him };
+                sharedData.GetHRTF(c, h, chunk * 50.0f, chunk * 10.0f - 40.0f);
+                for (int n = 0; n < Spatializer::HRTFLEN; n++)
                 {
-                    float s = inbuffer[n * 2 + c] * stereopan;
-                    float y = s + (ch.y[n].re * GAINCORRECTION - s) * spatialblend;
-                    outbuffer[n * 2 + c] = y;
-                    reverb[n * 2 + c] += y * reverbmix;
+                    ch.buffer[n] = ch.buffer[n + Spatializer::HRTFLEN];
+                    ch.buffer[n + Spatializer::HRTFLEN] = r.GetFloat(-1.0f, 1.0f);
                 }
+                memcpy(buffers[c], ch.buffer, sizeof(float) * fftsize);
             }
 
-            inbuffer += HRTFLEN * 2;
-            outbuffer += HRTFLEN * 2;
-            reverb += HRTFLEN * 2;
-        }
+            Spatializer::ConvolveChunk(data, sharedData, crossfade);
 
-        return UNITY_AUDIODSP_OK;
+            // Previous implementation: the ears and the previous filters are transformed as separate real signals
+            sharedData.fftplan->ForwardRealBatch(buffers, spectra, 2);
+            for (int c = 0; c < 2; c++)
+            {
+                Spatializer::InstanceChannel& ch = data->ch[c];
+                AudioPluginUtil::SplitComplex h = { ch.hre, ch.him }, prevh = { ch.prevhre, ch.prevhim };
+                AudioPluginUtil::SplitComplexMul(spectra[c], h, outputspectra[c], Spatializer::HRTFBINS);
+                AudioPluginUtil::SplitComplexMul(spectra[c], prevh, outputspectra[c + 2], Spatializer::HRTFBINS);
+            }
+            sharedData.fftplan->BackwardRealBatch(outputspectra, outputs, crossfade ? 4 : 2);
+
+            for (int c = 0; c < 2; c++)
+            {
+                for (int n = 0; n < Spatializer::HRTFLEN; n++)
+                {
+                    float y = outputs[c][n];
+                    if (crossfade)
+                        y = outputs[c + 2][n] + (y - outputs[c + 2][n]) * (n * (1.0f / (float)Spatializer::HRTFLEN));
+                    maxerror = std::max(maxerror, fabsf(data->ch[c].output[n] - y));
+                    peak = std::max(peak, fabsf(y));
+                }
+            }
+        }
+        NAP_CHECK(peak > 0.0f);
+        NAP_CHECK(maxerror <= peak * 1.0e-5f);
+        for (int i = 0; i < 2; i++)
+        {
+            delete[] buffers[i];
+            delete[] spectra[i].re;
+            delete[] spectra[i].im;
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            delete[] outputs[i];
+            delete[] outputspectra[i].re;
+            delete[] outputspectra[i].im;
+        }
+        delete data;
     }
 }
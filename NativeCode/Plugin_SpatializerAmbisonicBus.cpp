@@ -0,0 +1,95 @@
+// Decodes the shared third order ambisonic bus that Spatializer instances in ambisonic bus mode encode their sources into, so that the
+// binaural convolution runs once per mixer block instead of once per source. Like the Spatializer Reverb this relies on the effect being
+// processed after all the sources that feed it. Callbacks of any length up to the capacity of the bus can be decoded, but lengths that are
+// not multiples of 512 frames delay the output by 512 frames, see Spatializer::DecodeAmbisonic.
+
+#include "AudioPluginUtil.h"
+#include "Spatializer.h"
+
+float ambisonicbusbuffer[Spatializer::MAXAMBISONICCHANNELS * Spatializer::AMBISONICBUSFRAMES] = { 0 };
+
+namespace SpatializerAmbisonicBus
+{
+    enum
+    {
+        P_ORDER,
+        P_NUM
+    };
+
+    struct EffectData
+    {
+        float p[P_NUM];
+        Spatializer::AmbisonicDecoder* decoder;
+    };
+
+    int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition)
+    {
+        int numparams = P_NUM;
+        definition.paramdefs = new UnityAudioParameterDefinition[numparams];
+        AudioPluginUtil::RegisterParameter(definition, "Order", "", 1.0f, 3.0f, 3.0f, 1.0f, 1.0f, P_ORDER, "Ambisonic order that the bus is decoded at. Lower orders need fewer transforms but give a less sharp image.");
+        return numparams;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
+    {
+        EffectData* effectdata = new EffectData;
+        memset(effectdata, 0, sizeof(EffectData));
+        effectdata->decoder = Spatializer::CreateAmbisonicDecoder();
+        state->effectdata = effectdata;
+        AudioPluginUtil::InitParametersFromDefinitions(InternalRegisterEffectDefinition, effectdata->p);
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        Spatializer::ReleaseAmbisonicDecoder(data->decoder);
+        delete data;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback(UnityAudioEffectState* state, int index, float value)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (index >= P_NUM)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        data->p[index] = value;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback(UnityAudioEffectState* state, int index, float* value, char *valuestr)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (index >= P_NUM)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        if (value != NULL)
+            *value = data->p[index];
+        if (valuestr != NULL)
+            valuestr[0] = 0;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    int UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples)
+    {
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels)
+    {
+        if (inchannels != 2 || outchannels != 2 || length > Spatializer::AMBISONICBUSFRAMES)
+        {
+            memcpy(outbuffer, inbuffer, length * outchannels * sizeof(float));
+            return UNITY_AUDIODSP_OK;
+        }
+
+        EffectData* data = state->GetEffectData<EffectData>();
+
+        Spatializer::DecodeAmbisonic(data->decoder, ambisonicbusbuffer, Spatializer::MAXAMBISONICCHANNELS, (int)data->p[P_ORDER], outbuffer, outchannels, length);
+        for (unsigned int n = 0; n < length * 2; n++)
+            outbuffer[n] += inbuffer[n];
+
+        memset(ambisonicbusbuffer, 0, sizeof(float) * Spatializer::MAXAMBISONICCHANNELS * length);
+
+        return UNITY_AUDIODSP_OK;
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+// Ambisonic decoder of the Spatializer, which the Spatializer Ambisonic Bus and the Ambisonic Decoder use to share its HRTFs, and the
+// ambisonic bus that Spatializer instances in bus mode encode their sources into
+
+namespace Spatializer
+{
+    const int MAXAMBISONICORDER = 3;
+    const int MAXAMBISONICCHANNELS = (MAXAMBISONICORDER + 1) * (MAXAMBISONICORDER + 1);
+    const int AMBISONICBUSFRAMES = 4096;    // Capacity of ambisonicbusbuffer, longer callbacks are neither encoded nor decoded
+
+    struct AmbisonicDecoder;
+
+    AmbisonicDecoder* CreateAmbisonicDecoder();
+    void ReleaseAmbisonicDecoder(AmbisonicDecoder* decoder);
+    void SetAmbisonicRotation(AmbisonicDecoder* decoder, const float* matrix);
+    void DecodeAmbisonic(AmbisonicDecoder* decoder, const float* input, int inchannels, int order, float* output, int outchannels, unsigned int length);
+}
+
+// MAXAMBISONICCHANNELS interleaved channels, defined by the Spatializer Ambisonic Bus
+extern float ambisonicbusbuffer[Spatializer::MAXAMBISONICCHANNELS * Spatializer::AMBISONICBUSFRAMES];